@@ -0,0 +1,22 @@
+#ifndef ALLOCS_H
+#define ALLOCS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// with -DCHESS_ALLOCS=ON the binary replaces the global operator new to count
+// heap allocations per thread. Position level work, generating, making and checking moves and
+// evaluating, is meant to make none, scratch space comes from fixed buffers
+// like move_list, and the audit command holds it to that
+namespace allocs {
+    // true in a CHESS_ALLOCS build
+    bool enabled();
+    // allocations made by the calling thread so far, 0 without CHESS_ALLOCS
+    uint64_t count();
+
+    // runs every board operation and perft over a few positions, fails if any allocated
+    int audit_command(const std::vector<std::string> &args);
+}
+
+#endif
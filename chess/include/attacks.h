@@ -0,0 +1,42 @@
+#ifndef ATTACKS_H
+#define ATTACKS_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// attack sets for move generation. Knights, kings and pawns come from fixed
+// tables. Sliders go through one of three backends picked once at startup:
+// PEXT indexed tables where BMI2 is fast, fancy magic tables elsewhere, or a
+// plain ray walk without tables. CHESS_ATTACKS=portable|magic|pext in the
+// environment overrides the choice
+namespace attacks {
+    enum backend { portable, magic, pext };
+
+    using slider_fn = uint64_t (*)(int square, uint64_t occupied);
+    extern slider_fn bishop_fn;
+    extern slider_fn rook_fn;
+
+    inline uint64_t bishop(int square, uint64_t occupied) { return bishop_fn(square, occupied); }
+    inline uint64_t rook(int square, uint64_t occupied) { return rook_fn(square, occupied); }
+    inline uint64_t queen(int square, uint64_t occupied) { return bishop_fn(square, occupied) | rook_fn(square, occupied); }
+
+    uint64_t knight(int square);
+    uint64_t king(int square);
+    // the squares a pawn of the colour on the square attacks
+    uint64_t pawn(int colour, int square);
+
+    const char *name(backend b);
+    bool parse(const std::string &text, backend &res);
+    bool supported(backend b);
+    // PEXT unless the CPU lacks BMI2 or microcodes it, as AMD did before Zen 3
+    backend host_choice();
+
+    backend selected();
+    // builds the backend's tables the first time, not thread safe
+    void select(backend b);
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "board.h"
+#include "packed.h"
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// many positions at once. The positions are kept as a struct of arrays, one
+// array per piece bitboard, so a kernel loads the same bitboard of 4 (AVX2)
+// or 8 (AVX-512) positions into one register. Sliders use Kogge-Stone fills,
+// which need only shifts and masks, and per piece work runs every lane's
+// pieces in step until the lane with the most is done
+namespace batch {
+    class positions {
+        public:
+            size_t size() const { return side.size(); }
+            void clear();
+            void add(const board &pos);
+            void add(const packed_position &p);
+
+            std::array<std::vector<uint64_t>, 12> pieces;
+            std::vector<uint64_t> side;     // all ones when black is to move
+            std::vector<uint64_t> castling; // K Q k q in the low four bits
+            std::vector<uint64_t> ep;       // the en passant square as a bitboard
+    };
+
+    // per position, the same as board::gen_attacked for each colour, board::in_check
+    // and the size of board::gen_legal_moves
+    struct results {
+        std::array<std::vector<uint64_t>, 2> attacks;
+        std::vector<unsigned char> in_check;
+        std::vector<unsigned short> legal_moves;
+    };
+
+    enum isa { scalar, avx2, avx512 };
+
+    const char *isa_name(isa kernel);
+    bool supported(isa kernel);
+    // positions left over after the last full vector go through the scalar kernel
+    void run(const positions &in, results &out, isa kernel);
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -3,20 +3,25 @@
 
 #include "bitboard.h"
 #include "board_utils.h"
-#include <stack>
+#include "move_list.h"
+#include "nnue.h"
+#include "packed.h"
+#include "pawns.h"
 #include <map>
 #include <vector>
-#include <functional>
 #include <array>
 #include <bit>
 #include <iostream>
 #include <cmath> 
-#include <set>
 
 using namespace std;
 
 
+// the const members only read the board, so any number of threads can query
+// one shared position as long as none of them moves on it
 class board {
+    friend class move_picker;
+
     private:
         array<bitboard, 12> is_piece;
         bool white_short_castle;
@@ -47,33 +52,119 @@ class board {
         bitboard &is_white;
         bitboard &is_black;
 
-        board();
-        board(const board& to_copy);
+        // tapered material and piece-square score from white's point of view,
+        // kept up to date by put_piece and remove_piece
+        int mg_score;
+        int eg_score;
+        int game_phase;
 
-        void update_is_anything_color();
+        // zobrist key over the pawns alone, for the pawn structure cache
+        unsigned long long pawn_key;
+        // zobrist key of the whole position, pieces, castling rights, en passant file and side
+        unsigned long long hash_key;
 
-        bitboard gen_attacked(int gen_turn);
-        stack<pair<int, int>> gen_moves();
+        // per perspective sums of the active network features
+        nnue::accumulator acc;
 
-        bool is_legal();
+        board();
 
-        void make_move(const pair<int, int> &move);
-        void make_move(const pair<int, int> &start, const pair<int, int> &end);
+        void update_is_anything_color();
 
+        void put_piece(int piece, int square);
+        void remove_piece(int piece, int square);
+        void refresh_eval();
+        void refresh_keys();
+        unsigned long long state_key() const;
+        void finish_move();
+        int tapered(int mg, int eg) const;
+        void update_accumulator(int piece, int square, bool add);
+        void refresh_accumulators();
+        void check_incremental() const;
+
+        // pieces of colour by attacking the square with the given squares occupied
+        unsigned long long attackers(int square, int by, unsigned long long occupied) const;
+        // for a pseudo legal move, whether the mover's king is safe afterwards
+        bool keeps_king_safe(const pair<int, int> &move) const;
 
     public: 
         enum game_state {undecided, white_won, draw_3_fold, draw_50_rule, draw_stalemate, black_won };
-        
-        game_state current_state;
 
-        void update_state();
+        board(const board& to_copy);
 
-        set<string> print_moves();
+        // kinds of pseudo legal moves, promotions are kept apart from both
+        // captures and quiets so that staged generation can order them
+        enum move_kind { captures = 1, promotions = 2, quiets = 4, all_moves = 7 };
 
-        void user_move(set<string> legal);
+        // moves of the pieces standing on the from squares, the king may be left in check
+        void gen_pseudo_moves(move_list &res, int kinds, unsigned long long from = ~0ULL) const;
 
+        bitboard gen_attacked(int gen_turn) const;
+        // the legal moves, the last one on top, none once the game is over
+        move_list gen_moves() const;
+        // the legal moves, also after the fifty move rule ends the game
+        void gen_legal_moves(move_list &res) const;
+
+        // how the game stands, worked out afresh on every call. The second
+        // form takes what gen_moves gave for this position and saves
+        // generating again. Repetitions need the game history, so draw_3_fold
+        // is left to whoever keeps it
+        game_state state() const;
+        game_state state(const move_list &moves) const;
+
+        bool is_legal() const;
+
+        // one move checked against the board without generating any, for moves
+        // from a user, a file or a cache. They agree with gen_pseudo_moves and
+        // gen_legal_moves on every move, including the ones no generator makes
+        bool is_pseudo_legal(const pair<int, int> &move) const;
+        bool is_legal(const pair<int, int> &move) const;
+
+        void make_move(const pair<int, int> &move);
+        void make_move(const pair<int, int> &start, const pair<int, int> &end);
+
+        const array<bitboard, 12> &pieces() const { return is_piece; }
+        bool side_to_move() const { return turn; }
+        unsigned long long pawn_hash() const { return pawn_key; }
+        unsigned long long hash() const { return hash_key; }
+        // hash() without an en passant file no pawn can legally take on, so the
+        // same position reached with and without a double push gets one key
+        unsigned long long position_key() const;
+        int halfmove_clock() const { return ply_100; }
+        // K Q k q packed into the low four bits
+        int castling_rights() const { 
+            return white_short_castle | (white_long_castle << 1) | (black_short_castle << 2) | (black_long_castle << 3); 
+        }
+        // square behind a pawn that just made a double push, -1 if there is none
+        int en_passant_square() const { return en_pessant.first == -1 ? -1 : en_pessant.first * 8 + en_pessant.second; }
+
+        bool in_check() const;
+
+        // static evaluation in centipawns from the side to move's point of view
+        int evaluate() const;
+        // adds pawn structure and king shelter, looked up in the given pawn cache
+        int evaluate(pawns::table &pawn_cache) const;
+
+        // recomputes the incremental scores from scratch and compares them
+        bool eval_is_consistent() const;
+        bool accumulator_is_consistent() const;
+        bool keys_are_consistent() const;
+
+        // prints the legal moves, or the result once there are none
+        move_list print_moves() const;
+
+        void user_move(const move_list &legal);
+
+        // expects a fen that passes is_valid_fen
         board (const string &fen);
+        // all six fields in the form the constructor reads, one king a side
+        static bool is_valid_fen(const string &fen);
+
+        string to_fen() const;
+
+        packed_position pack() const;
+        // expects a packed position that passes packed::is_valid
+        static board from_packed(const packed_position &packed);
 
-        void print_board();
+        void print_board() const;
 };
 #endif
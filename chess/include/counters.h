@@ -0,0 +1,56 @@
+#ifndef COUNTERS_H
+#define COUNTERS_H
+
+#include <array>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// hardware performance counters around a stretch of code, through Linux
+// perf_event_open. Every event is opened on its own so that one the CPU or
+// the kernel lacks only costs that event, and counts are scaled up when the
+// kernel had to multiplex them. Only user space on the calling thread is
+// counted, which perf_event_paranoid 2, the usual default, still allows.
+// Elsewhere, or in a container without access, nothing opens and the
+// benchmarks fall back to wall clock time
+namespace counters {
+    enum event { cycles, instructions, branches, branch_misses, l1d_misses, llc_misses, page_faults, event_count };
+
+    const char *name(event e);
+
+    struct reading {
+        std::array<uint64_t, event_count> value = {};
+        std::array<bool, event_count> valid = {};
+        // time all events were enabled over the time they were actually counted, 1 unless multiplexed
+        double multiplexing = 1;
+
+        bool has(event e) const { return valid[e]; }
+    };
+
+    class group {
+        public:
+            // opens whatever events it can
+            group();
+            ~group();
+            group(const group &) = delete;
+            group &operator=(const group &) = delete;
+
+            // at least one event counts
+            bool available() const;
+            // why the missing events are missing, empty when all opened
+            const std::string &problem() const { return why; }
+
+            // reset and enable every open event
+            void start();
+            reading stop();
+
+        private:
+            std::array<int, event_count> fds;
+            std::string why;
+    };
+
+    // one line per event with the count per node, then IPC and miss rates
+    void report(std::ostream &out, const reading &r, double nodes);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef DEDUP_H
+#define DEDUP_H
+
+#include "packed.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// unique positions out of large streams of FEN lines or packed position files.
+// Keys go into an open addressing set in memory, and when the set reaches its
+// budget the positions it holds are written out sorted by key as a run. The
+// runs are merged at the end, so memory stays bounded however large the input
+namespace dedup {
+    struct options {
+        size_t memory_bytes = size_t(1) << 30;
+        bool flip = false;   // black to move becomes white to move with the colours swapped
+        bool mirror = false; // pawnless positions without castling rights under all eight board symmetries
+    };
+
+    // the canonical form of a position, the label's result follows a colour flip
+    packed_position canonical(const packed_position &p, const options &opts);
+    // over the position itself, the move counters and the label are left out
+    uint64_t key(const packed_position &p);
+
+    struct stats {
+        size_t inputs;  // positions taken in
+        size_t skipped; // malformed FEN lines and invalid packed records, left out
+        size_t unique;
+        size_t runs;
+        double seconds;
+    };
+
+    // with a single run the positions keep their input order, otherwise they come in key order
+    bool run(const std::vector<std::string> &inputs, const std::string &output, const options &opts, stats &res);
+
+    int dedup_command(const std::vector<std::string> &args);
+}
+
+#endif
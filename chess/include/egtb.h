@@ -0,0 +1,82 @@
+#ifndef EGTB_H
+#define EGTB_H
+
+#include "board.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// win, draw or loss together with the distance to mate for pawnless endings of
+// up to five pieces, built by retrograde analysis. Positions are indexed by one
+// of the 462 king pairs left after the eight board symmetries and one square
+// for each further piece, both sides to move, one byte per position
+namespace egtb {
+    constexpr int max_pieces = 5;
+
+    // pieces besides the kings as board piece numbers 1-4 (N B R Q)
+    struct material {
+        std::vector<int> white, black;
+
+        // "KQvKR", "KBNvK", ...
+        static bool parse(const std::string &name, material &res);
+        std::string name() const;
+        int pieces() const { return 2 + int(white.size() + black.size()); }
+
+        // stronger side white and each side queen first, swapped tells whether the colours changed
+        material canonical(bool &swapped) const;
+    };
+
+    // from the side to move's point of view
+    struct result {
+        int wdl;
+        int plies;
+    };
+
+    struct generation_stats {
+        size_t positions;
+        size_t legal;
+        size_t wins, draws, losses;
+        int longest_mate;
+        int passes;
+        double seconds;
+        size_t file_bytes;
+    };
+
+    // builds the table of the material and every table it captures into, and writes
+    // only the requested one. threads <= 0 uses every core
+    bool generate(const std::string &material, const std::string &path, int threads = 0, generation_stats *stats = nullptr);
+
+    class table {
+        public:
+            table();
+            ~table();
+            table(const table &) = delete;
+            table &operator=(const table &) = delete;
+
+            bool open(const std::string &path);
+            void close();
+            bool is_open() const { return values != nullptr; }
+            std::string name() const { return signature; }
+            size_t size_bytes() const { return length; }
+
+            // false when the position has other material, castling rights or is not legal
+            bool probe(const board &pos, result &res) const;
+
+        private:
+            // how positions of the table's material are indexed, built by open
+            struct shape;
+
+            const unsigned char *data;
+            const unsigned char *values;
+            size_t length;
+            std::string signature;
+            std::unique_ptr<shape> lay;
+    };
+
+    int egtb_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef EXTSORT_H
+#define EXTSORT_H
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <queue>
+#include <string>
+#include <vector>
+
+// sorting more records than fit in memory. Each full buffer is sorted and
+// written out as a run, and the runs are merged into one ordered stream at
+// the end. A merge keeps at most fan_in runs open, with more runs a pass
+// first merges consecutive groups of them into longer ones, so the open
+// files stay well under the usual descriptor limits. Records are plain data
+// written in the machine's own byte order, and run files are removed once
+// merged or when the sorter goes away
+namespace extsort {
+    constexpr size_t fan_in = 64;
+
+    template<class T, class Less = std::less<T>>
+    class sorter {
+        public:
+            // runs are named after prefix, read_records bounds the read buffers of a merge together
+            sorter(const std::string &prefix, size_t read_records, Less less = Less())
+                : prefix(prefix), read_records(read_records), less(less) {}
+            ~sorter() {
+                for(auto &path : paths)
+                    if(!path.empty())
+                        std::remove(path.c_str());
+            }
+            sorter(const sorter &) = delete;
+            sorter &operator=(const sorter &) = delete;
+
+            size_t runs() const { return paths.size(); }
+
+            // sorts the records, writes them as the next run and empties them
+            bool spill(std::vector<T> &records) {
+                std::sort(records.begin(), records.end(), less);
+                paths.push_back(next_path());
+                std::ofstream out(paths.back(), std::ios::binary | std::ios::trunc);
+                out.write((const char *)records.data(), records.size() * sizeof(T));
+                out.close();
+                records.clear();
+                return !out.fail();
+            }
+
+            // hands every record of every run to out in order, records equal
+            // under less come in the order their runs were spilled
+            template<class F>
+            bool merge(F out) {
+                while(paths.size() > fan_in) {
+                    std::vector<std::string> longer;
+                    bool ok = true;
+                    for(size_t first=0; first<paths.size() && ok; first+=fan_in) {
+                        size_t last = std::min(paths.size(), first + fan_in);
+                        if(last - first == 1) {
+                            longer.push_back(paths[first]);
+                            paths[first].clear();
+                            continue;
+                        }
+                        longer.push_back(next_path());
+                        std::ofstream file(longer.back(), std::ios::binary | std::ios::trunc);
+                        ok = merge_range(first, last, [&](const T &r) { file.write((const char *)&r, sizeof(T)); });
+                        file.close();
+                        ok = ok && !file.fail();
+                    }
+                    std::erase(paths, std::string());
+                    paths.insert(paths.end(), longer.begin(), longer.end());
+                    if(!ok)
+                        return false;
+                }
+                bool ok = merge_range(0, paths.size(), out);
+                paths.clear();
+                return ok;
+            }
+
+        private:
+            std::string prefix;
+            size_t read_records;
+            Less less;
+            std::vector<std::string> paths;
+            size_t named = 0;
+
+            // a run read back a chunk at a time
+            class reader {
+                public:
+                    reader(const std::string &path, size_t chunk)
+                        : in(path, std::ios::binary), opened(in.is_open()), chunk(chunk), at(0) {
+                        refill();
+                    }
+
+                    bool done() const { return at == buffer.size(); }
+                    bool good() const { return opened && !in.bad(); }
+                    const T &front() const { return buffer[at]; }
+
+                    void pop() {
+                        if(++at == buffer.size())
+                            refill();
+                    }
+
+                private:
+                    std::ifstream in;
+                    bool opened;
+                    size_t chunk;
+                    std::vector<T> buffer;
+                    size_t at;
+
+                    void refill() {
+                        buffer.resize(chunk);
+                        in.read((char *)buffer.data(), chunk * sizeof(T));
+                        buffer.resize(in.gcount() / sizeof(T));
+                        at = 0;
+                    }
+            };
+
+            std::string next_path() {
+                return prefix + ".run" + std::to_string(named++);
+            }
+
+            // merges paths[first, last) into out and removes them
+            template<class F>
+            bool merge_range(size_t first, size_t last, F &&out) {
+                size_t chunk = std::max<size_t>(1024, read_records / std::max<size_t>(last - first, 1));
+                std::vector<reader> readers;
+                readers.reserve(last - first);
+                for(size_t i=first; i<last; i++)
+                    readers.emplace_back(paths[i], chunk);
+
+                auto later = [&](size_t a, size_t b) {
+                    const T &x = readers[a].front(), &y = readers[b].front();
+                    return less(y, x) || (!less(x, y) && b < a);
+                };
+                std::priority_queue<size_t, std::vector<size_t>, decltype(later)> heads(later);
+                for(size_t i=0; i<readers.size(); i++)
+                    if(!readers[i].done())
+                        heads.push(i);
+                while(!heads.empty()) {
+                    size_t i = heads.top();
+                    heads.pop();
+                    out(readers[i].front());
+                    readers[i].pop();
+                    if(!readers[i].done())
+                        heads.push(i);
+                }
+
+                bool ok = true;
+                for(auto &r : readers)
+                    ok = ok && r.good();
+                for(size_t i=first; i<last; i++) {
+                    std::remove(paths[i].c_str());
+                    paths[i].clear();
+                }
+                return ok;
+            }
+    };
+}
+
+#endif
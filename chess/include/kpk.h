@@ -0,0 +1,40 @@
+#ifndef KPK_H
+#define KPK_H
+
+#include "board.h"
+
+#include <string>
+#include <vector>
+
+// king and pawn versus king bitbase, one bit per position telling whether the
+// side with the pawn wins. Positions are stored with the pawn white and on files a-d
+namespace kpk {
+    constexpr int positions = 2 * 24 * 64 * 64;
+
+    // builds the table by iterating to a fixed point, fills the optional stats
+    struct generation_stats {
+        int iterations;
+        double milliseconds;
+        size_t work_bytes;
+    };
+    void generate(generation_stats *stats = nullptr);
+
+    bool load(const std::string &path);
+    bool save(const std::string &path);
+
+    // the table comes, in order of preference, from the embedded copy
+    // (-DCHESS_KPK_EMBED=<header>), a load, or a generation on first use.
+    // Safe to reach from many threads at once, generate and load are not
+    // meant to run while others probe
+    bool ready();
+
+    // white king, white pawn, black king, side to move. Any file, the pawn is mirrored as needed
+    bool probe_kpk(int white_king, int white_pawn, int black_king, int side_to_move);
+
+    // 1 when the pawn's side wins, 0 for a draw, -1 if the position is not KPK
+    int probe(const board &pos);
+
+    int kpk_command(const std::vector<std::string> &args);
+}
+
+#endif
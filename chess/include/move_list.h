@@ -0,0 +1,30 @@
+#ifndef MOVE_LIST_H
+#define MOVE_LIST_H
+
+#include <array>
+#include <utility>
+
+// fixed capacity move buffer, no position has more than 218 legal moves
+// and we stay well above that for the pseudo legal ones. It never touches
+// the heap, and top and pop let it stand in for a stack of moves
+struct move_list {
+    std::array<std::pair<int, int>, 256> moves;
+    int count = 0;
+
+    void push(const std::pair<int, int> &move) { moves[count++] = move; }
+    void clear() { count = 0; }
+    int size() const { return count; }
+    bool empty() const { return count == 0; }
+    const std::pair<int, int> &top() const { return moves[count - 1]; }
+    void pop() { count--; }
+
+    std::pair<int, int> &operator[](int i) { return moves[i]; }
+    const std::pair<int, int> &operator[](int i) const { return moves[i]; }
+
+    std::pair<int, int> *begin() { return moves.data(); }
+    std::pair<int, int> *end() { return moves.data() + count; }
+    const std::pair<int, int> *begin() const { return moves.data(); }
+    const std::pair<int, int> *end() const { return moves.data() + count; }
+};
+
+#endif
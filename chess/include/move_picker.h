@@ -0,0 +1,68 @@
+#ifndef MOVE_PICKER_H
+#define MOVE_PICKER_H
+
+#include "board.h"
+#include "move_list.h"
+
+#include <array>
+#include <utility>
+
+using namespace std;
+
+// yields the legal moves of a position one by one, generating each stage
+// only once the previous one runs dry, so cut nodes never pay for the quiets
+class move_picker {
+    public:
+        static constexpr pair<int, int> no_move = {-1, -1};
+
+        // noisy_only stops after the winning captures and promotions, for quiescence search
+        move_picker(const board &pos, 
+                    pair<int, int> hash_move = no_move, 
+                    array<pair<int, int>, 2> killers = {no_move, no_move},
+                    bool noisy_only = false);
+
+        // writes the next legal move into move, false once every stage is exhausted
+        bool next(pair<int, int> &move);
+
+        // neither a capture nor a promotion, castling counts as quiet
+        static bool is_quiet(const board &pos, const pair<int, int> &move);
+
+    private:
+        enum stage { 
+            hash_stage, 
+            gen_captures_stage, good_captures_stage, 
+            gen_promotions_stage, promotions_stage, 
+            killers_stage, 
+            gen_quiets_stage, quiets_stage, 
+            bad_captures_stage, 
+            done_stage 
+        };
+
+        const board &pos;
+        stage current;
+        bool noisy_only;
+
+        pair<int, int> hash_move;
+        array<pair<int, int>, 2> killers;
+        int killer_index;
+
+        move_list moves;
+        array<int, 256> scores;
+        int index;
+
+        move_list bad_captures;
+        int bad_index;
+
+        bool attacked_ready;
+        bitboard attacked;
+
+        bool next_pseudo(pair<int, int> &move);
+        bool pick_best(pair<int, int> &move);
+        bool legal(const pair<int, int> &move) const;
+
+        int piece_on(int square) const;
+        void score_captures();
+        void score_promotions();
+};
+
+#endif
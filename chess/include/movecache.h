@@ -0,0 +1,84 @@
+#ifndef MOVECACHE_H
+#define MOVECACHE_H
+
+#include "board.h"
+#include "move_list.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// what gen_moves says about a position, its legal moves and the game state,
+// kept for positions that are asked about again, as when browsing a game back
+// and forth. The cache is split into shards, each behind a reader writer
+// lock, and a shard into buckets of eight slots. A position can only live in
+// its own bucket and the bucket evicts by CLOCK: a hit marks a slot, and the
+// hand passes over marked slots once, clearing the mark, before it evicts.
+// Moves are two bytes each, up to 50 fit in a slot and longer lists go to
+// the heap, with a share of the memory cap set aside for them
+namespace movecache {
+    struct stats {
+        uint64_t hits, misses, insertions, evictions;
+        uint64_t uncached; // lists that did not fit what is left for long lists
+        size_t entries, bytes;
+    };
+
+    class cache {
+        public:
+            explicit cache(size_t megabytes = 16);
+            ~cache();
+            cache(const cache &) = delete;
+            cache &operator=(const cache &) = delete;
+
+            // the moves and state gen_moves gives, generated and stored on a miss
+            board::game_state legal_moves(const board &pos, move_list &res);
+            // false if the position is not there
+            bool find(const board &pos, move_list &res, board::game_state &state);
+            void insert(const board &pos, const move_list &moves, board::game_state state);
+
+            stats counters() const;
+            void clear();
+
+            static constexpr int ways = 8;
+            static constexpr int inline_moves = 50;
+
+        private:
+            struct alignas(64) slot {
+                uint64_t key;
+                uint64_t occupied; // a second check against key collisions
+                uint16_t *spilled; // the moves when there are more than inline_moves
+                uint16_t count;
+                unsigned char state;
+                std::atomic<unsigned char> referenced;
+                std::array<uint16_t, inline_moves> moves;
+            };
+
+            struct alignas(64) shard {
+                mutable std::shared_mutex lock;
+                std::unique_ptr<slot[]> slots;
+                std::unique_ptr<unsigned char[]> hands; // per bucket
+                std::atomic<uint64_t> hits{0}, misses{0}, insertions{0}, evictions{0}, uncached{0};
+                size_t entries = 0, spilled_bytes = 0;
+            };
+
+            static constexpr int shard_count = 64;
+            static constexpr unsigned char empty = 255;
+
+            shard &shard_of(uint64_t key) const { return shards[key >> 58]; }
+            size_t bucket_of(uint64_t key) const { return (key & 0xFFFFFFFF) * buckets_per_shard >> 32; }
+            void release(shard &s, slot &e);
+
+            std::unique_ptr<shard[]> shards;
+            size_t buckets_per_shard;
+            size_t spill_budget; // per shard
+    };
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef MOVEPACK_H
+#define MOVEPACK_H
+
+#include "board.h"
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+// games stored as the index of each move among the legal moves of its
+// position, sorted so that the index does not depend on the generator's
+// order. The stream is a format version byte and a varint move count, then
+// either every index in just enough bits for the number of legal moves, or
+// the rank of the move in a cheap ordering (psqt gain, hanging pieces last)
+// through an adaptive binary range coder
+namespace movepack {
+    enum coding { index_bits, ranked_range };
+
+    // false if a move is not legal where it is played, out is appended to
+    bool encode(const std::string &fen, const std::vector<std::pair<int, int>> &moves, coding how,
+                std::vector<unsigned char> &out);
+
+    // replays the stream through make_move on pos, which holds the start
+    // position and is left at the end. False on a corrupt stream
+    bool decode(board &pos, const unsigned char *data, size_t size, coding how,
+                std::vector<std::pair<int, int>> &moves);
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include "bitboard.h"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// HalfKP style network: every non-king piece is a feature relative to the
+// king of each perspective, the first layer sums are kept in per side int16
+// accumulators that make_move updates incrementally
+namespace nnue {
+    constexpr int king_buckets = 64;
+    constexpr int piece_kinds = 10; // own and enemy pawn to queen
+    constexpr int features = king_buckets * piece_kinds * 64;
+    constexpr int l1 = 128;
+    constexpr int l2 = 32;
+
+    struct alignas(32) accumulator {
+        std::array<std::array<int16_t, l1>, 2> values;
+        // false once the king of that perspective moved and a refresh is due
+        std::array<bool, 2> computed = {false, false};
+    };
+
+    // loads a weights file written by write_random or an external trainer,
+    // on failure the previously loaded network (if any) stays active
+    bool load(const std::string &path);
+    // set by load, read inline since the board checks it on every piece update
+    extern bool network_loaded;
+    inline bool loaded() { return network_loaded; }
+
+    // random weights with the file layout load expects, mostly for testing the pipeline
+    bool write_random(const std::string &path, unsigned seed);
+
+    int feature_index(int perspective, int king_square, int piece, int square);
+
+    void add_feature(accumulator &acc, int perspective, int index);
+    void sub_feature(accumulator &acc, int perspective, int index);
+    void refresh(accumulator &acc, int perspective, const std::array<bitboard, 12> &pieces);
+
+    // quantized forward pass, centipawns from the side to move's point of view
+    int evaluate(const accumulator &acc, int side_to_move);
+
+    // same network in plain floating point, the reference for the quantized
+    // path. Dequantized, it runs on the integer weights scaled back, so only
+    // the rounding of the activations separates it from evaluate
+    float evaluate_float(const std::array<bitboard, 12> &pieces, int side_to_move, bool dequantized = false);
+
+    const char *simd_name();
+
+    int init_command(const std::vector<std::string> &args);
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
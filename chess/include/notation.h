@@ -0,0 +1,34 @@
+#ifndef NOTATION_H
+#define NOTATION_H
+
+#include "board.h"
+#include "move_list.h"
+
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// move text without touching the heap. Writers fill a caller's buffer of
+// max_length chars, NUL terminated, and return the length. Parsers match the
+// text against the moves of the position and give no_move unless exactly one fits
+namespace notation {
+    constexpr int max_length = 8;
+    constexpr std::pair<int, int> no_move = {-1, -1};
+
+    // e2e4, e1g1 for castling, e7e8q
+    int write_uci(char *buf, const std::pair<int, int> &move);
+    // the board's own e2-e4, o-o, o-o-o, e7-e8=Q
+    int write_long(char *buf, const std::pair<int, int> &move);
+    // Nbd2, exd6, O-O-O, e8=Q+
+    int write_san(char *buf, const board &pos, const std::pair<int, int> &move);
+
+    std::pair<int, int> parse_uci(const move_list &legal, std::string_view text);
+    std::pair<int, int> parse_long(const move_list &legal, std::string_view text);
+    // checks, mates and !? suffixes are ignored, 0-0 is taken for O-O
+    std::pair<int, int> parse_san(const board &pos, std::string_view text);
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
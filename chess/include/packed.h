@@ -0,0 +1,110 @@
+#ifndef PACKED_H
+#define PACKED_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// a position in 32 bytes: the occupancy, a nibble per occupied square from a1
+// upwards holding the board's piece number, then side to move with castling
+// rights, the en passant square, the halfmove clock and the fullmove number.
+// Byte order is fixed so files move between machines
+struct packed_position {
+    std::array<unsigned char, 32> bytes;
+
+    static constexpr int pieces_at = 8;
+    static constexpr int state_at = 24;
+    // the last three bytes are free for a label, the game result and a score
+    static constexpr int label_at = 29;
+    static constexpr unsigned char no_square = 255;
+
+    uint64_t occupancy() const {
+        uint64_t res = 0;
+        for(int i=7; i>=0; i--)
+            res = res << 8 | bytes[i];
+        return res;
+    }
+    // of the n-th occupied square
+    int piece(int n) const { return bytes[pieces_at + n / 2] >> (4 * (n % 2)) & 15; }
+
+    // result for white, -1 a loss, 0 a draw, 1 a win. Score in centipawns for the side to move
+    void set_label(int result, int score) {
+        bytes[label_at] = result + 2;
+        bytes[label_at + 1] = score & 255;
+        bytes[label_at + 2] = (score >> 8) & 255;
+    }
+    bool has_label() const { return bytes[label_at] != 0; }
+    int result() const { return bytes[label_at] - 2; }
+    int score() const { return int16_t(bytes[label_at + 1] | bytes[label_at + 2] << 8); }
+
+    bool operator==(const packed_position &other) const = default;
+};
+
+static_assert(sizeof(packed_position) == 32);
+
+// files of packed positions: a 64 byte header, the records, then an index with
+// the end of every segment (a game, a batch) as little endian uint64 record numbers
+namespace packed {
+    constexpr size_t header_bytes = 64;
+    // labels without a score carry this one
+    constexpr int no_score = -32768;
+
+    // nibbles in range, at most 32 pieces and one king a side
+    bool is_valid(const packed_position &p);
+
+    // the header of a file with the given number of records and segments
+    void fill_header(unsigned char *header, uint64_t records, uint64_t segments);
+
+    class dataset_writer {
+        public:
+            bool open(const std::string &path);
+            void add(const packed_position &p);
+            // closes the running segment, empty ones are skipped
+            void end_segment();
+            // writes the index and the header, false if anything failed
+            bool close();
+
+        private:
+            std::ofstream out;
+            uint64_t count = 0;
+            std::vector<uint64_t> segment_ends;
+    };
+
+    class dataset {
+        public:
+            dataset();
+            ~dataset();
+            dataset(const dataset &) = delete;
+            dataset &operator=(const dataset &) = delete;
+
+            bool open(const std::string &path);
+            void close();
+
+            size_t size() const { return count; }
+            const packed_position &operator[](size_t i) const { return records[i]; }
+            const packed_position *begin() const { return records; }
+            const packed_position *end() const { return records + count; }
+
+            size_t segments() const { return segment_count; }
+            // first and one past the last record of a segment
+            std::pair<size_t, size_t> segment(size_t i) const;
+
+        private:
+            const unsigned char *data;
+            size_t length;
+            const packed_position *records;
+            size_t count;
+            const unsigned char *index;
+            size_t segment_count;
+    };
+
+    int pack_command(const std::vector<std::string> &args);
+    int unpack_command(const std::vector<std::string> &args);
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef PAWNS_H
+#define PAWNS_H
+
+#include <array>
+#include <string>
+#include <vector>
+
+// set-wise pawn structure analysis, everything is derived from the two pawn
+// bitboards alone so the results can be cached under the pawn-only key
+namespace pawns {
+    unsigned long long north_fill(unsigned long long bb);
+    unsigned long long south_fill(unsigned long long bb);
+    unsigned long long file_fill(unsigned long long bb);
+    unsigned long long east(unsigned long long bb);
+    unsigned long long west(unsigned long long bb);
+
+    // side 0 is white, 1 is black, "front" is towards the side's promotion rank
+    unsigned long long front_span(unsigned long long own, int side);
+    unsigned long long rear_span(unsigned long long own, int side);
+    unsigned long long attacks(unsigned long long own, int side);
+    unsigned long long attack_span(unsigned long long own, int side);
+
+    unsigned long long passed(unsigned long long own, unsigned long long enemy, int side);
+    unsigned long long isolated(unsigned long long own);
+    unsigned long long doubled(unsigned long long own, int side);
+    unsigned long long backward(unsigned long long own, unsigned long long enemy, int side);
+
+    // own pawns on the king's file and its neighbours, one or two ranks in front of the back rank
+    unsigned long long shelter_mask(unsigned long long own, int king_file, int side);
+
+    struct entry {
+        unsigned long long key;
+        std::array<unsigned long long, 2> passed;
+        std::array<unsigned long long, 2> isolated;
+        std::array<unsigned long long, 2> doubled;
+        std::array<unsigned long long, 2> backward;
+        std::array<unsigned long long, 2> attack_spans;
+        // structure score from white's point of view
+        int mg;
+        int eg;
+        // middlegame shelter bonus for a king of each side standing on each file
+        std::array<std::array<short, 8>, 2> shelter;
+    };
+
+    void analyse(entry &res, unsigned long long white, unsigned long long black);
+
+    class table {
+        public:
+            // size in entries, rounded down to a power of two
+            explicit table(int size = 1 << 14);
+
+            const entry &probe(unsigned long long key, unsigned long long white, unsigned long long black);
+
+            long long hits() const { return hit_count; }
+            long long misses() const { return miss_count; }
+
+        private:
+            std::vector<entry> entries;
+            unsigned long long mask;
+            long long hit_count;
+            long long miss_count;
+    };
+
+    int bench_command(const std::vector<std::string> &args);
+}
+
+#endif
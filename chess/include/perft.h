@@ -0,0 +1,72 @@
+#ifndef PERFT_H
+#define PERFT_H
+
+#include "board.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// move path enumeration, the usual check of the move generator and a
+// benchmark of it. Both commands take --counters to run under hardware
+// performance counters and report per node ratios
+namespace perft {
+    // leaves of the legal move tree depth plies deep
+    uint64_t count(const board &pos, int depth);
+    // the same, but the last ply is the size of each move list and is never made
+    uint64_t count_bulk(const board &pos, int depth);
+
+    // deep runs are cut into the distinct positions split plies below the
+    // root, each with the number of paths reaching it, and kept in a
+    // checkpoint file with the leaves of every finished one. Any number of
+    // processes can work through the same file, a sub-position is claimed
+    // with a lock on its byte of <file>.lock that the kernel drops when the
+    // process dies, and results are merged in by rewriting the file aside
+    // and renaming it over, so a crash loses only the uncheckpointed work
+    struct deep_options {
+        std::string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        int depth = 0;   // 0 to resume whatever the file holds
+        int split = 0;   // 0 picks one
+        int threads = 0; // 0 for one per core
+    };
+
+    // leaves_done counts every finished sub-position, whoever counted it. True
+    // once the whole tree is counted, false on errors or while other processes
+    // still hold sub-positions
+    bool deep(const std::string &path, const deep_options &opts, uint64_t &leaves_done);
+
+    // distinct positions at every ply down to depth, found by inserting
+    // position keys salted with the ply into one lock free hash set shared
+    // by all threads. A position already in the set at that ply is not
+    // searched again unless all_paths is set, which also counts the paths
+    // and so gives the transposition rate at the cost of a full perft
+    struct unique_options {
+        std::string fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+        int depth = 4;
+        int threads = 0;   // 0 for one per core
+        int memory_mb = 256;
+        bool all_paths = false;
+    };
+
+    struct unique_stats {
+        std::vector<uint64_t> distinct; // per ply, the root is ply 0
+        std::vector<uint64_t> paths;    // per ply, only with all_paths
+        double load;                    // of the hash set at the end
+        double seconds;
+    };
+
+    // false if the set filled up, the counts are then too low
+    bool unique(const unique_options &opts, unique_stats &res);
+
+    int perft_command(const std::vector<std::string> &args);
+    int deep_command(const std::vector<std::string> &args);
+    int unique_command(const std::vector<std::string> &args);
+    // checks board::is_pseudo_legal and board::is_legal on every move of random positions
+    int legality_command(const std::vector<std::string> &args);
+    // runs the const queries of many threads on the same positions at once
+    int shared_command(const std::vector<std::string> &args);
+    // times gen_pseudo_moves, gen_legal_moves and gen_moves on a few positions
+    int movegen_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,76 @@
+#ifndef PGN_H
+#define PGN_H
+
+#include "board.h"
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// PGN reading for bulk replay. A file is mapped into memory and split into
+// games, tags and movetext tokens that are views into the mapping, so reading
+// allocates nothing per token
+namespace pgn {
+    struct tag {
+        std::string_view name;
+        std::string_view value; // escapes are left as they are
+    };
+
+    struct game {
+        std::vector<tag> tags; // cleared, not freed, between games
+        std::string_view movetext;
+
+        std::string_view find(std::string_view name) const;
+    };
+
+    class reader {
+        public:
+            reader();
+            ~reader();
+            reader(const reader &) = delete;
+            reader &operator=(const reader &) = delete;
+
+            bool open(const std::string &path);
+            void close();
+
+            // false once the file holds no further game
+            bool next(game &g);
+
+        private:
+            const char *data;
+            size_t length;
+            size_t offset;
+    };
+
+    // the moves of the main line, comments, variations, NAGs and move numbers skipped
+    class move_tokens {
+        public:
+            explicit move_tokens(std::string_view movetext) : text(movetext), at(0) {}
+
+            bool next(std::string_view &san);
+            // the termination marker, empty if the movetext had none
+            std::string_view result() const { return ending; }
+
+        private:
+            std::string_view text;
+            size_t at;
+            std::string_view ending;
+    };
+
+    struct replay_stats {
+        long long games;
+        long long moves;
+        long long errors; // games abandoned at a move that did not parse
+        double seconds;
+    };
+
+    // replays every game of every file, the files spread over the threads
+    replay_stats replay(const std::vector<std::string> &paths, int threads = 0);
+
+    int pgn_command(const std::vector<std::string> &args);
+    int selftest_command(const std::vector<std::string> &args);
+}
+
+#endif
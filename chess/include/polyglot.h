@@ -0,0 +1,64 @@
+#ifndef POLYGLOT_H
+#define POLYGLOT_H
+
+#include "board.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// reader for Polyglot .bin opening books. The book is mapped into memory and
+// probed in place by binary search, opening it costs the same for any size
+namespace polyglot {
+    // one 16 byte record, stored big-endian on disk
+    struct entry {
+        uint64_t key;
+        uint16_t move;
+        uint16_t weight;
+        uint32_t learn;
+    };
+
+    // the book format's position key, from the Random64 table of the specification
+    uint64_t key(const board &pos);
+
+    // polyglot move bits to the board's encoding, castling is stored as the king taking its rook
+    std::pair<int, int> decode_move(const board &pos, uint16_t move);
+    uint16_t encode_move(const board &pos, const std::pair<int, int> &move);
+
+    class book {
+        public:
+            book();
+            ~book();
+            book(const book &) = delete;
+            book &operator=(const book &) = delete;
+
+            bool open(const std::string &path);
+            void close();
+            bool is_open() const { return data != nullptr; }
+            size_t size() const { return count; }
+
+            // number of entries for key, first points at the first of them
+            int probe(uint64_t key, size_t &first) const;
+            entry at(size_t i) const;
+
+            // weighted choice among the position's book moves, random is any uniformly
+            // distributed number. no_move when the position is not in the book. The move
+            // is not checked for legality, a corrupt book can hold anything
+            std::pair<int, int> pick(const board &pos, uint64_t random) const;
+
+        private:
+            const unsigned char *data;
+            size_t length;
+            size_t count;
+    };
+
+    // sorts the entries by key and writes them in book format
+    bool write_book(const std::string &path, std::vector<entry> entries);
+
+    int book_command(const std::vector<std::string> &args);
+    int selftest_command(const std::vector<std::string> &args);
+}
+
+#endif
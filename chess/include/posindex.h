@@ -0,0 +1,71 @@
+#ifndef POSINDEX_H
+#define POSINDEX_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// which stored games pass through a position. Building replays every game of
+// a set of PGN files, sorts one (position key, game, ply) entry per position in
+// runs that fit a memory budget and merges them into a file of page sized
+// blocks. The first key of every block, the fence pointers, sits at the end
+// of the file and is read at open, so a lookup reads the one or two blocks
+// its key can be in
+namespace posindex {
+    constexpr size_t page_bytes = 4096;
+
+    struct entry {
+        uint64_t key;
+        uint32_t game; // games are numbered across the files in the order given
+        uint32_t ply;  // half moves from the game's start position
+
+        bool operator<(const entry &other) const {
+            if(key != other.key) return key < other.key;
+            if(game != other.game) return game < other.game;
+            return ply < other.ply;
+        }
+    };
+
+    struct build_stats {
+        size_t games;
+        size_t entries;
+        size_t runs;
+        size_t errors; // games cut short at a move that did not parse
+        size_t file_bytes;
+        double seconds;
+    };
+
+    bool build(const std::vector<std::string> &pgn_paths, const std::string &path, size_t memory_bytes,
+               build_stats *stats = nullptr);
+
+    class index {
+        public:
+            index();
+            ~index();
+            index(const index &) = delete;
+            index &operator=(const index &) = delete;
+
+            bool open(const std::string &path);
+            void close();
+
+            size_t size() const { return count; }
+            size_t games() const { return game_count; }
+            // in key order
+            entry operator[](size_t i) const;
+
+            // appends every game and ply reaching the key, returns the blocks read
+            size_t find(uint64_t key, std::vector<entry> &res) const;
+
+        private:
+            const unsigned char *data;
+            size_t length;
+            size_t count;
+            size_t game_count;
+            std::vector<uint64_t> fences;
+    };
+
+    int posindex_command(const std::vector<std::string> &args);
+}
+
+#endif
@@ -0,0 +1,19 @@
+#ifndef PSQT_H
+#define PSQT_H
+
+#include <array>
+
+// material plus piece-square values, tuned as in the PeSTO evaluation,
+// indexed by the board's piece index (0-5 white, 6-11 black) and square.
+// values are from white's point of view, black pieces are negative
+namespace psqt {
+    int mg(int piece, int square);
+    int eg(int piece, int square);
+
+    // contribution of a piece to the game phase, 24 on a full board
+    int phase(int piece);
+
+    constexpr int max_phase = 24;
+}
+
+#endif
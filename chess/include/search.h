@@ -0,0 +1,67 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include "board.h"
+#include "pawns.h"
+#include "tt.h"
+
+#include <array>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+struct search_limits {
+    int depth = 64;
+    long long nodes = 0; // 0 for no limit
+    int multipv = 1;
+};
+
+struct search_line {
+    vector<pair<int, int>> pv;
+    int score;
+};
+
+// iterative deepening alpha-beta, in multi-pv mode every root move is searched
+// in the same run and the best multipv lines are kept ranked at each depth
+class searcher {
+    public:
+        static constexpr int max_ply = 64;
+        static constexpr int mate_score = 30000;
+        static constexpr int infinity = 32000;
+
+        // called after every completed depth with the ranked lines
+        using report_fn = function<void(int depth, const vector<search_line> &lines)>;
+
+        explicit searcher(transposition_table &tt);
+
+        vector<search_line> search(const board &root, const search_limits &limits, const report_fn &report = {});
+
+        long long nodes() const { return node_count; }
+
+    private:
+        transposition_table &tt;
+        pawns::table pawn_cache;
+
+        array<array<pair<int, int>, 2>, max_ply> killers;
+        array<array<pair<int, int>, max_ply>, max_ply> pv_table;
+        array<int, max_ply> pv_length;
+
+        long long node_count;
+        long long node_limit;
+        bool stopped;
+
+        int alpha_beta(const board &pos, int depth, int alpha, int beta, int ply);
+        int quiescence(const board &pos, int alpha, int beta, int ply);
+        void update_pv(int ply, const pair<int, int> &move);
+        bool out_of_nodes();
+};
+
+string move_string(const pair<int, int> &move);
+string score_string(int score);
+
+int multipv_command(const vector<string> &args);
+
+#endif
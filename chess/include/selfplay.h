@@ -0,0 +1,44 @@
+#ifndef SELFPLAY_H
+#define SELFPLAY_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// self-play for tuning data. Games run side by side on a pool of threads, each
+// with its own board, search and buffer, and every position after the opening
+// lands in a packed position file labelled with the game result and the score
+// the search gave it. A game is one segment of the file. Threads claim their
+// ranges of the file without locking, so games land in the order they finish,
+// and a second file lists where each game went by game number. Read through
+// it, the games are the same for any thread count
+namespace selfplay {
+    struct options {
+        long long games = 100;
+        int threads = 0;        // 0 for one per core
+        long long nodes = 2000; // per move, 0 picks weighted random moves throughout
+        int random_plies = 8;   // opening moves picked at random and not written
+        int max_plies = 400;    // longer games are called drawn
+        uint64_t seed = 1;      // a game's moves only depend on the seed and its number
+    };
+
+    struct stats {
+        long long games;
+        long long positions;
+        long long white_wins, draws, black_wins;
+        // how the games ended
+        long long mates, stalemates, fifty_moves, repetitions, insufficient, too_long;
+        double seconds;
+    };
+
+    // next to the position file: each game's first and one past its last
+    // record as little endian uint64s, in the order of the game numbers
+    std::string games_path(const std::string &path);
+
+    // false with the stats left partial if the file could not be written
+    bool generate(const std::string &path, const options &opts, stats &res);
+
+    int selfplay_command(const std::vector<std::string> &args);
+}
+
+#endif
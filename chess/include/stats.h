@@ -0,0 +1,86 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// counters and timers on the hot paths, compiled in with -DCHESS_STATS=ON.
+// Without it CHESS_COUNT and CHESS_TIME expand to nothing and the hot paths
+// are the same instructions as before they were placed. Each thread counts
+// into its own block, so there is no sharing, and a snapshot adds up the live
+// threads and those that have finished. At exit, and whenever the process
+// gets SIGUSR1, the totals are written as JSON to the file named by
+// CHESS_STATS_FILE, or to stderr
+namespace stats {
+    enum counter {
+        gen_moves_calls, pseudo_moves, legal_moves, illegal_moves, gen_attacked_calls, make_move_calls,
+        is_legal_calls, tt_probes, tt_hits, pawn_probes, pawn_hits, counter_count
+    };
+    enum timer { gen_legal_time, gen_pseudo_time, gen_attacked_time, make_move_time, is_legal_time, timer_count };
+
+    // true in a CHESS_STATS build
+    bool enabled();
+    // the totals over every thread so far
+    void write_json(std::ostream &out);
+    bool dump(const std::string &path);
+    // starts the totals over. Only the owning thread writes a block, so a
+    // live block is not zeroed but gets its current values as a base that
+    // later snapshots subtract, which is safe while its thread keeps counting
+    void reset();
+
+#ifdef CHESS_STATS
+    struct block {
+        // one writer, so a relaxed load and store is a plain add
+        std::atomic<uint64_t> counts[counter_count];
+        std::atomic<uint64_t> ticks[timer_count];
+        std::atomic<uint64_t> timed[timer_count];
+        // the values at the last reset, only touched under the registry lock
+        uint64_t base_counts[counter_count] = {};
+        uint64_t base_ticks[timer_count] = {};
+        uint64_t base_timed[timer_count] = {};
+
+        // joins the list of live blocks, and leaves it adding into the finished totals
+        block();
+        ~block();
+    };
+
+    inline thread_local block local;
+
+    inline void bump(std::atomic<uint64_t> &c, uint64_t n) {
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    inline void count(counter c, uint64_t n = 1) {
+        bump(local.counts[c], n);
+    }
+
+    // time stamp counter ticks where there is one, else steady clock nanoseconds
+    uint64_t now();
+
+    // inclusive, a timed call that makes timed calls counts their time too
+    class scoped_timer {
+        public:
+            explicit scoped_timer(timer t) : which(t), start(now()) {}
+            ~scoped_timer() {
+                bump(local.ticks[which], now() - start);
+                bump(local.timed[which], 1);
+            }
+
+        private:
+            timer which;
+            uint64_t start;
+    };
+#endif
+}
+
+#ifdef CHESS_STATS
+#define CHESS_COUNT(c, n) stats::count(stats::c, n)
+#define CHESS_TIME(t) stats::scoped_timer chess_timer_##t(stats::t)
+#else
+#define CHESS_COUNT(c, n) ((void)0)
+#define CHESS_TIME(t) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef TT_H
+#define TT_H
+
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+class transposition_table {
+    public:
+        enum bound : unsigned char { no_bound, upper_bound, lower_bound, exact_bound };
+
+        struct entry {
+            unsigned long long key;
+            pair<int, int> move;
+            int score;
+            short depth;
+            bound flag;
+        };
+
+        explicit transposition_table(int megabytes = 16);
+
+        bool probe(unsigned long long key, entry &res) const;
+        void store(unsigned long long key, const pair<int, int> &move, int score, int depth, bound flag);
+        void clear();
+
+    private:
+        vector<entry> entries;
+        unsigned long long mask;
+};
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef ZOBRIST_H
+#define ZOBRIST_H
+
+// random keys for hashing positions, the same on every run and every machine
+namespace zobrist {
+    unsigned long long piece(int piece, int square);
+    unsigned long long side();
+    // indexed by the four castling rights packed as bits: K Q k q
+    unsigned long long castling(int rights);
+    unsigned long long en_passant(int file);
+}
+
+#endif
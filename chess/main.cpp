@@ -1,5 +1,25 @@
 #include <iostream> 
+#include <string>
+#include <vector>
+#include "allocs.h"
+#include "attacks.h"
+#include "batch.h"
 #include "board.h"  
+#include "dedup.h"
+#include "egtb.h"
+#include "kpk.h"
+#include "movepack.h"
+#include "movecache.h"
+#include "nnue.h"
+#include "notation.h"
+#include "packed.h"
+#include "pawns.h"
+#include "perft.h"
+#include "pgn.h"
+#include "polyglot.h"
+#include "posindex.h"
+#include "search.h"
+#include "selfplay.h"
 
 void clearConsole() {
 #ifdef _WIN32 
@@ -9,7 +29,44 @@ void clearConsole() {
 #endif
 }
 
-int main() {
+int run_command(const std::string &command, const std::vector<std::string> &args) {
+    if(command == "alloc-audit") return allocs::audit_command(args);
+    if(command == "attacks-bench") return attacks::bench_command(args);
+    if(command == "batch-bench") return batch::bench_command(args);
+    if(command == "nnue-init") return nnue::init_command(args);
+    if(command == "nnue-bench") return nnue::bench_command(args);
+    if(command == "pawn-bench") return pawns::bench_command(args);
+    if(command == "perft") return perft::perft_command(args);
+    if(command == "perft-deep") return perft::deep_command(args);
+    if(command == "perft-unique") return perft::unique_command(args);
+    if(command == "legality-selftest") return perft::legality_command(args);
+    if(command == "shared-read-selftest") return perft::shared_command(args);
+    if(command == "movegen-bench") return perft::movegen_command(args);
+    if(command == "multipv") return multipv_command(args);
+    if(command == "book") return polyglot::book_command(args);
+    if(command == "book-selftest") return polyglot::selftest_command(args);
+    if(command == "kpk") return kpk::kpk_command(args);
+    if(command == "dedup") return dedup::dedup_command(args);
+    if(command == "egtb") return egtb::egtb_command(args);
+    if(command == "notation-bench") return notation::bench_command(args);
+    if(command == "pack") return packed::pack_command(args);
+    if(command == "unpack") return packed::unpack_command(args);
+    if(command == "pack-bench") return packed::bench_command(args);
+    if(command == "pgn") return pgn::pgn_command(args);
+    if(command == "pgn-selftest") return pgn::selftest_command(args);
+    if(command == "movepack") return movepack::bench_command(args);
+    if(command == "movecache-bench") return movecache::bench_command(args);
+    if(command == "posindex") return posindex::posindex_command(args);
+    if(command == "selfplay") return selfplay::selfplay_command(args);
+
+    std::cerr << "unknown command: " << command << '\n';
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if(argc > 1)
+        return run_command(argv[1], std::vector<std::string>(argv + 2, argv + argc));
+
     clearConsole();
     board start("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
     auto legal = start.print_moves();
@@ -0,0 +1,190 @@
+#include "allocs.h"
+#include "board.h"
+#include "perft.h"
+
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <stdexcept>
+
+using namespace std;
+
+#ifdef CHESS_ALLOCS
+namespace {
+    // plain data, so reaching it costs no initialisation check
+    thread_local uint64_t allocations = 0;
+
+    void *allocate(size_t size) {
+        allocations++;
+        if(void *p = malloc(size ? size : 1))
+            return p;
+        throw bad_alloc();
+    }
+
+#ifndef _WIN32
+    void *allocate_aligned(size_t size, align_val_t align) {
+        allocations++;
+        size_t alignment = size_t(align);
+        if(void *p = aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+            return p;
+        throw bad_alloc();
+    }
+#endif
+}
+
+void *operator new(size_t size) { return allocate(size); }
+void *operator new[](size_t size) { return allocate(size); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+
+#ifndef _WIN32
+void *operator new(size_t size, align_val_t align) { return allocate_aligned(size, align); }
+void *operator new[](size_t size, align_val_t align) { return allocate_aligned(size, align); }
+void operator delete(void *p, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, align_val_t) noexcept { free(p); }
+void operator delete(void *p, size_t, align_val_t) noexcept { free(p); }
+void operator delete[](void *p, size_t, align_val_t) noexcept { free(p); }
+#endif
+#endif
+
+namespace allocs {
+
+bool enabled() {
+#ifdef CHESS_ALLOCS
+    return true;
+#else
+    return false;
+#endif
+}
+
+uint64_t count() {
+#ifdef CHESS_ALLOCS
+    return allocations;
+#else
+    return 0;
+#endif
+}
+
+// the positions are the perft ones and everything two plies below them, set
+// up before counting starts. Each operation runs over all of them, perft from
+// the roots only, and has to come back with no allocation at all
+int audit_command(const vector<string> &args) {
+    if(!enabled()) {
+        cerr << "allocs: counting is compiled out, configure with -DCHESS_ALLOCS=ON\n";
+        return 1;
+    }
+    int depth;
+    try {
+        depth = args.size() > 0 ? stoi(args[0]) : 3;
+    } catch(const logic_error &) {
+        cerr << "usage: chess alloc-audit [depth]\n";
+        return 1;
+    }
+
+    vector<board> roots, positions;
+    for(const char *fen : {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                           "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                           "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                           "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8"}) {
+        board root(fen);
+        roots.push_back(root);
+        positions.push_back(root);
+        move_list first, second;
+        root.gen_legal_moves(first);
+        for(auto &a : first) {
+            board child(root);
+            child.make_move(a);
+            positions.push_back(child);
+            child.gen_legal_moves(second);
+            for(auto &b : second) {
+                board grandchild(child);
+                grandchild.make_move(b);
+                positions.push_back(grandchild);
+            }
+        }
+    }
+
+    int failures = 0;
+    auto audit = [&](const char *name, vector<board> &over, auto operation) {
+        uint64_t nodes = 0, sink = 0;
+        uint64_t before = count();
+        for(auto &pos : over)
+            nodes += operation(pos, sink);
+        uint64_t made = count() - before;
+        cout << name << ": " << made << " allocations over " << nodes << " nodes, " << double(made) / nodes
+             << " per node (" << (sink & 1) << ")\n";
+        failures += made != 0;
+    };
+
+    pawns::table pawn_cache;
+    move_list moves;
+    audit("gen_pseudo_moves", positions, [&](board &pos, uint64_t &sink) {
+        moves.clear();
+        pos.gen_pseudo_moves(moves, board::all_moves);
+        sink += moves.size();
+        return 1;
+    });
+    audit("gen_legal_moves", positions, [&](board &pos, uint64_t &sink) {
+        pos.gen_legal_moves(moves);
+        sink += moves.size();
+        return 1;
+    });
+    audit("gen_moves", positions, [&](board &pos, uint64_t &sink) {
+        sink += pos.gen_moves().size();
+        return 1;
+    });
+    audit("gen_attacked", positions, [&](board &pos, uint64_t &sink) {
+        sink += (unsigned long long)pos.gen_attacked(0) ^ (unsigned long long)pos.gen_attacked(1);
+        return 2;
+    });
+    audit("make_move", positions, [&](board &pos, uint64_t &sink) {
+        pos.gen_legal_moves(moves);
+        for(auto &move : moves) {
+            board child(pos);
+            child.make_move(move);
+            sink += child.hash();
+        }
+        return moves.size();
+    });
+    audit("is_legal", positions, [&](board &pos, uint64_t &sink) {
+        sink += pos.is_legal() + pos.in_check();
+        return 1;
+    });
+    // the moves of the position and those of the one before it in the list,
+    // so both answers of each check are taken
+    move_list own, foreign;
+    auto gather = [&](board &pos) {
+        own.clear();
+        foreign.clear();
+        pos.gen_pseudo_moves(own, board::all_moves);
+        (&pos == &positions[0] ? pos : (&pos)[-1]).gen_pseudo_moves(foreign, board::all_moves);
+        return own.size() + foreign.size();
+    };
+    audit("is_pseudo_legal", positions, [&](board &pos, uint64_t &sink) {
+        int checked = gather(pos);
+        for(auto *list : {&own, &foreign})
+            for(auto &move : *list)
+                sink += pos.is_pseudo_legal(move);
+        return checked;
+    });
+    audit("is_legal(move)", positions, [&](board &pos, uint64_t &sink) {
+        int checked = gather(pos);
+        for(auto *list : {&own, &foreign})
+            for(auto &move : *list)
+                sink += pos.is_legal(move);
+        return checked;
+    });
+    audit("evaluate", positions, [&](board &pos, uint64_t &sink) {
+        sink += pos.evaluate() + pos.evaluate(pawn_cache);
+        return 1;
+    });
+    audit("perft", roots, [&](board &pos, uint64_t &) { return perft::count(pos, depth); });
+
+    cout << (failures ? "allocations on the hot path\n" : "no allocations\n");
+    return failures ? 1 : 0;
+}
+
+}
@@ -0,0 +1,371 @@
+#include "attacks.h"
+#include "board.h"
+#include "move_list.h"
+
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ATTACKS_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace attacks {
+
+namespace {
+    constexpr int bishop_steps[4][2] = {{1, 1}, {1, -1}, {-1, 1}, {-1, -1}};
+    constexpr int rook_steps[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+    constexpr bool on_board(int row, int column) {
+        return row >= 0 && row < 8 && column >= 0 && column < 8;
+    }
+
+    // rays until the edge or the first occupied square, which is included.
+    // inner_only leaves out the last square of each ray, for the relevant
+    // occupancy masks of the tables
+    constexpr uint64_t walk(int square, uint64_t occupied, const int (&steps)[4][2], bool inner_only = false) {
+        uint64_t res = 0;
+        for(auto &step : steps) {
+            int row = square / 8 + step[0], column = square % 8 + step[1];
+            for(; on_board(row, column); row += step[0], column += step[1]) {
+                if(inner_only && !on_board(row + step[0], column + step[1]))
+                    break;
+                res |= 1ULL << (row * 8 + column);
+                if(occupied >> (row * 8 + column) & 1)
+                    break;
+            }
+        }
+        return res;
+    }
+
+    template<size_t n>
+    constexpr array<uint64_t, 64> leaper_table(const int (&steps)[n][2]) {
+        array<uint64_t, 64> res{};
+        for(int square=0; square<64; square++)
+            for(auto &step : steps)
+                if(on_board(square / 8 + step[0], square % 8 + step[1]))
+                    res[square] |= 1ULL << (square + 8 * step[0] + step[1]);
+        return res;
+    }
+
+    constexpr int knight_steps[8][2] = {{2, 1}, {2, -1}, {-2, 1}, {-2, -1}, {1, 2}, {1, -2}, {-1, 2}, {-1, -2}};
+    constexpr int king_steps[8][2] = {{1, 1}, {1, 0}, {1, -1}, {0, 1}, {0, -1}, {-1, 1}, {-1, 0}, {-1, -1}};
+    constexpr int white_pawn_steps[2][2] = {{1, -1}, {1, 1}};
+    constexpr int black_pawn_steps[2][2] = {{-1, -1}, {-1, 1}};
+
+    constexpr array<uint64_t, 64> knight_table = leaper_table(knight_steps);
+    constexpr array<uint64_t, 64> king_table = leaper_table(king_steps);
+    constexpr array<array<uint64_t, 64>, 2> pawn_table = {leaper_table(white_pawn_steps), leaper_table(black_pawn_steps)};
+
+    // found once by trying sparse random numbers until no two occupancies
+    // with different attacks collide
+    constexpr array<uint64_t, 64> bishop_magics = {
+        0x0020A41002102022ULL, 0x0282880800908409ULL, 0x0004040082080800ULL, 0x02020A0200001240ULL,
+        0x00D4504003029000ULL, 0x000A0242601A820CULL, 0x0012060220645030ULL, 0x8002004052082004ULL,
+        0x0001A0A00210A120ULL, 0x2170200400808104ULL, 0x2210044102020001ULL, 0x0000910400800000ULL,
+        0x0000040308100481ULL, 0x5200008220200098ULL, 0x8000040402280680ULL, 0x1000010108210400ULL,
+        0x0042542102320201ULL, 0x00101A0202081100ULL, 0x001003460402400CULL, 0x0200820802024000ULL,
+        0xA404008202111080ULL, 0x2104082E10040400ULL, 0x1000820400982820ULL, 0x41210080C06E1010ULL,
+        0x20020A0840280828ULL, 0x2002228C60080600ULL, 0x00718A4028020400ULL, 0x0220104118004040ULL,
+        0x0800840208802001ULL, 0x000880810B006004ULL, 0x0009240889008800ULL, 0x0003014002004C20ULL,
+        0x084202A000106018ULL, 0x0002214420202800ULL, 0x0020141002220480ULL, 0x8020020080280080ULL,
+        0x0830020200072008ULL, 0x0000902081210082ULL, 0x0004241080041080ULL, 0x2028D20080014400ULL,
+        0x0004100805402A10ULL, 0x0006082402000408ULL, 0x0011001586081000ULL, 0x2088084200820802ULL,
+        0x8101021204110600ULL, 0x0A01220804408200ULL, 0x0050100210488080ULL, 0x8001022A02002041ULL,
+        0x0044460854400081ULL, 0x0208420090082001ULL, 0x10005A0084040831ULL, 0x0220802908480000ULL,
+        0x0040009002020402ULL, 0x0020040950010100ULL, 0x088A101008890004ULL, 0x0011020204002000ULL,
+        0x001A608048203080ULL, 0x0008020100921100ULL, 0x0410000024020808ULL, 0x12400C4080411080ULL,
+        0x0200000209102400ULL, 0x0800000470820A00ULL, 0x0208C00318421084ULL, 0x100220A80A004040ULL,
+    };
+    constexpr array<uint64_t, 64> rook_magics = {
+        0xA080081080204002ULL, 0x0040004020001000ULL, 0x0480100020018008ULL, 0x4080080080100004ULL,
+        0x0200090200208410ULL, 0x050008190014000AULL, 0x0100019442000700ULL, 0x0900002080420100ULL,
+        0x0400802040008001ULL, 0x0202002100420081ULL, 0x0206001080244200ULL, 0x0801002008100100ULL,
+        0x2081000412080100ULL, 0x0812000810040200ULL, 0x0004001021881A04ULL, 0x2002000100440082ULL,
+        0xA90020800080401AULL, 0x0000818040002002ULL, 0x0508820016004022ULL, 0x0200808008001000ULL,
+        0x0888010004100900ULL, 0x0022010100080400ULL, 0x0000040011321008ULL, 0x000002000140A419ULL,
+        0x8004400480008020ULL, 0x00C0500840002000ULL, 0x8400200280100080ULL, 0x0001002100081000ULL,
+        0x0002000A00041020ULL, 0x0000020080040080ULL, 0x0005000101040200ULL, 0x0000A14200029405ULL,
+        0x2084804008800860ULL, 0x0050022001404004ULL, 0x0061001041002000ULL, 0x2000401202002008ULL,
+        0x8001000801000410ULL, 0x0104800400800200ULL, 0x0101106204005801ULL, 0x020400690200008CULL,
+        0x0040082042818000ULL, 0x8100201000404000ULL, 0x0000120080220040ULL, 0x449040100A020020ULL,
+        0x0000050008010011ULL, 0x4902040002008080ULL, 0x24801032080C0003ULL, 0x1401C04081020004ULL,
+        0x0088C30C80220600ULL, 0x0004320042810200ULL, 0x4120022080100380ULL, 0x0010080010048080ULL,
+        0x4804008008000480ULL, 0x2081000400080300ULL, 0x8322488210010400ULL, 0x1A10040084410E00ULL,
+        0x180B650040108001ULL, 0x1409044001201181ULL, 0x00641300A0010841ULL, 0x0000100020040901ULL,
+        0x0103000402100801ULL, 0xC022000104100802ULL, 0x8008080082500104ULL, 0xC80100020020804DULL,
+    };
+
+    struct entry {
+        uint64_t mask;
+        uint64_t magic;
+        const uint64_t *attacks;
+        int shift;
+    };
+
+    // one entry per square over attacks laid out square after square
+    struct slider_table {
+        array<entry, 64> squares;
+        vector<uint64_t> attacks;
+    };
+
+    slider_table bishop_magic_table, rook_magic_table, bishop_pext_table, rook_pext_table;
+
+    // what the BMI2 instruction does, for building the tables on any machine
+    uint64_t soft_pext(uint64_t value, uint64_t mask) {
+        uint64_t res = 0;
+        for(uint64_t bit = 1; mask; mask &= mask - 1, bit <<= 1)
+            if(value & mask & -mask)
+                res |= bit;
+        return res;
+    }
+
+    void build(slider_table &table, const int (&steps)[4][2], const array<uint64_t, 64> &magics, bool by_pext) {
+        array<size_t, 64> offsets;
+        size_t total = 0;
+        for(int square=0; square<64; square++) {
+            uint64_t mask = walk(square, 0, steps, true);
+            table.squares[square] = {mask, magics[square], nullptr, 64 - popcount(mask)};
+            offsets[square] = total;
+            total += size_t(1) << popcount(mask);
+        }
+        table.attacks.assign(total, 0);
+        for(int square=0; square<64; square++) {
+            entry &e = table.squares[square];
+            e.attacks = table.attacks.data() + offsets[square];
+            // every subset of the mask, carry-rippler style
+            uint64_t subset = 0;
+            do {
+                size_t index = by_pext ? soft_pext(subset, e.mask) : (subset * e.magic) >> e.shift;
+                table.attacks[offsets[square] + index] = walk(square, subset, steps);
+                subset = (subset - e.mask) & e.mask;
+            } while(subset);
+        }
+    }
+
+    uint64_t bishop_portable(int square, uint64_t occupied) { return walk(square, occupied, bishop_steps); }
+    uint64_t rook_portable(int square, uint64_t occupied) { return walk(square, occupied, rook_steps); }
+
+    uint64_t bishop_magic(int square, uint64_t occupied) {
+        const entry &e = bishop_magic_table.squares[square];
+        return e.attacks[((occupied & e.mask) * e.magic) >> e.shift];
+    }
+
+    uint64_t rook_magic(int square, uint64_t occupied) {
+        const entry &e = rook_magic_table.squares[square];
+        return e.attacks[((occupied & e.mask) * e.magic) >> e.shift];
+    }
+
+#ifdef ATTACKS_X86
+    __attribute__((target("bmi2")))
+    uint64_t bishop_pext(int square, uint64_t occupied) {
+        const entry &e = bishop_pext_table.squares[square];
+        return e.attacks[_pext_u64(occupied, e.mask)];
+    }
+
+    __attribute__((target("bmi2")))
+    uint64_t rook_pext(int square, uint64_t occupied) {
+        const entry &e = rook_pext_table.squares[square];
+        return e.attacks[_pext_u64(occupied, e.mask)];
+    }
+#endif
+
+    backend current = portable;
+    bool overridden = false;
+
+    // the environment's choice if it names a backend this CPU runs, else the host's
+    backend startup_choice() {
+        const char *text = getenv("CHESS_ATTACKS");
+        backend res;
+        if(text && *text) {
+            if(!parse(text, res))
+                cerr << "attacks: unknown backend " << text << ", using " << name(host_choice()) << '\n';
+            else if(!supported(res))
+                cerr << "attacks: " << text << " is not supported here, using " << name(host_choice()) << '\n';
+            else {
+                overridden = true;
+                return res;
+            }
+        }
+        return host_choice();
+    }
+
+    const bool selected_at_startup = (select(startup_choice()), true);
+}
+
+slider_fn bishop_fn = bishop_portable;
+slider_fn rook_fn = rook_portable;
+
+uint64_t knight(int square) { return knight_table[square]; }
+uint64_t king(int square) { return king_table[square]; }
+uint64_t pawn(int colour, int square) { return pawn_table[colour][square]; }
+
+const char *name(backend b) {
+    switch(b) {
+        case portable: return "portable";
+        case magic: return "magic";
+        case pext: return "pext";
+    }
+    return "?";
+}
+
+bool parse(const string &text, backend &res) {
+    for(backend b : {portable, magic, pext})
+        if(text == name(b)) {
+            res = b;
+            return true;
+        }
+    return false;
+}
+
+bool supported(backend b) {
+    if(b != pext)
+        return true;
+#ifdef ATTACKS_X86
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("bmi2");
+#else
+    return false;
+#endif
+}
+
+backend host_choice() {
+    if(!supported(pext))
+        return magic;
+#ifdef ATTACKS_X86
+    unsigned eax, ebx, ecx, edx;
+    char vendor[13] = {};
+    if(__get_cpuid(0, &eax, &ebx, &ecx, &edx)) {
+        memcpy(vendor, &ebx, 4);
+        memcpy(vendor + 4, &edx, 4);
+        memcpy(vendor + 8, &ecx, 4);
+    }
+    if(string(vendor) == "AuthenticAMD" && __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        int family = (eax >> 8) & 15;
+        if(family == 15)
+            family += (eax >> 20) & 255;
+        if(family < 0x19)
+            return magic;
+    }
+#endif
+    return pext;
+}
+
+backend selected() {
+    return current;
+}
+
+void select(backend b) {
+    if(!supported(b))
+        return;
+    if(b == magic) {
+        if(bishop_magic_table.attacks.empty()) {
+            build(bishop_magic_table, bishop_steps, bishop_magics, false);
+            build(rook_magic_table, rook_steps, rook_magics, false);
+        }
+        bishop_fn = bishop_magic;
+        rook_fn = rook_magic;
+    } else if(b == pext) {
+#ifdef ATTACKS_X86
+        if(bishop_pext_table.attacks.empty()) {
+            build(bishop_pext_table, bishop_steps, bishop_magics, true);
+            build(rook_pext_table, rook_steps, rook_magics, true);
+        }
+        bishop_fn = bishop_pext;
+        rook_fn = rook_pext;
+#endif
+    } else {
+        bishop_fn = bishop_portable;
+        rook_fn = rook_portable;
+    }
+    current = b;
+}
+
+// every backend is checked against the ray walk, then timed on raw lookups,
+// which decide the winner, and on move generation. The one chosen at startup
+// is restored afterwards
+int bench_command(const vector<string> &args) {
+    double budget;
+    try {
+        budget = args.size() > 0 ? stod(args[0]) : 0.5;
+    } catch(const logic_error &) {
+        cerr << "usage: chess attacks-bench [seconds]\n";
+        return 1;
+    }
+    backend startup = current;
+
+    mt19937_64 rng(1);
+    vector<pair<int, uint64_t>> queries(1 << 16);
+    for(auto &q : queries)
+        q = {int(rng() % 64), rng() & rng()};
+
+    vector<board> positions;
+    for(const char *fen : {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                           "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                           "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                           "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"})
+        positions.emplace_back(fen);
+
+    int failures = 0;
+    backend fastest = startup;
+    double best = 0;
+    for(backend b : {portable, magic, pext}) {
+        if(!supported(b)) {
+            cout << name(b) << ": not supported here\n";
+            continue;
+        }
+        select(b);
+        for(auto &[square, occupied] : queries)
+            if(bishop(square, occupied) != bishop_portable(square, occupied) ||
+               rook(square, occupied) != rook_portable(square, occupied)) {
+                failures++;
+                break;
+            }
+
+        uint64_t sink = 0;
+        long long lookups = 0, generations = 0;
+        double lookup_seconds = 0, generation_seconds = 0;
+        move_list moves;
+        while(lookup_seconds + generation_seconds < budget) {
+            auto start = chrono::steady_clock::now();
+            for(auto &[square, occupied] : queries)
+                sink += bishop(square, occupied) ^ rook(square, occupied);
+            auto middle = chrono::steady_clock::now();
+            for(int repeat=0; repeat<256; repeat++)
+                for(auto &pos : positions) {
+                    moves.clear();
+                    pos.gen_pseudo_moves(moves, board::all_moves);
+                    sink += moves.size() + (unsigned long long)pos.gen_attacked(!pos.side_to_move());
+                }
+            auto end = chrono::steady_clock::now();
+            lookups += 2 * queries.size();
+            generations += 256 * positions.size();
+            lookup_seconds += chrono::duration<double>(middle - start).count();
+            generation_seconds += chrono::duration<double>(end - middle).count();
+        }
+        double rate = lookups / lookup_seconds;
+        cout << name(b) << ": " << rate / 1e6 << " M slider lookups/s, " << generations / generation_seconds / 1e6
+             << " M move generations/s (" << (sink & 1) << ")\n";
+        if(rate > best) {
+            best = rate;
+            fastest = b;
+        }
+    }
+    select(startup);
+
+    cout << "in use: " << name(startup) << (overridden ? " (CHESS_ATTACKS)" : " (cpuid)")
+         << ", fastest here: " << name(fastest) << ", mismatches: " << failures << '\n';
+    return failures ? 1 : 0;
+}
+
+}
@@ -0,0 +1,502 @@
+#include "batch.h"
+
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <type_traits>
+
+using namespace std;
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define BATCH_X86 1
+#endif
+
+#define BATCH_INLINE [[gnu::always_inline]] inline
+
+// the vector helpers are always inlined into kernels built for their width,
+// so the warning about passing wide vectors to plain functions does not apply
+#ifdef __GNUC__
+#pragma GCC diagnostic ignored "-Wpsabi"
+#endif
+
+namespace batch {
+
+namespace {
+    constexpr uint64_t not_a = 0xFEFEFEFEFEFEFEFEULL, not_h = 0x7F7F7F7F7F7F7F7FULL;
+    constexpr uint64_t not_ab = 0xFCFCFCFCFCFCFCFCULL, not_gh = 0x3F3F3F3F3F3F3F3FULL;
+    constexpr uint64_t rank_1 = 0xFFULL, rank_3 = 0xFF0000ULL, rank_6 = 0xFF0000000000ULL, rank_8 = 0xFFULL << 56;
+
+    typedef uint64_t lanes4 __attribute__((vector_size(32)));
+    typedef uint64_t lanes8 __attribute__((vector_size(64)));
+
+    template<class V>
+    constexpr size_t width = sizeof(V) / sizeof(uint64_t);
+
+    // all ones in every lane that is not zero
+    template<class V>
+    BATCH_INLINE V nonzero(V x) {
+        if constexpr(is_same_v<V, uint64_t>)
+            return -uint64_t(x != 0);
+        else
+            return (V)(x != 0);
+    }
+
+    template<class V>
+    BATCH_INLINE bool any(V x) {
+        if constexpr(is_same_v<V, uint64_t>) {
+            return x != 0;
+        } else {
+            uint64_t res = 0;
+            for(size_t i=0; i<width<V>; i++)
+                res |= x[i];
+            return res != 0;
+        }
+    }
+
+    // b where the mask is set, a elsewhere
+    template<class V>
+    BATCH_INLINE V blend(V mask, V a, V b) {
+        return (a & ~mask) | (b & mask);
+    }
+
+    template<class V>
+    BATCH_INLINE V count(V x) {
+        if constexpr(is_same_v<V, uint64_t>) {
+            return popcount(x);
+        } else {
+            x = x - ((x >> 1) & 0x5555555555555555ULL);
+            x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+            x = (x + (x >> 4)) & 0x0F0F0F0F0F0F0F0FULL;
+            x += x >> 8;
+            x += x >> 16;
+            x += x >> 32;
+            return x & 127;
+        }
+    }
+
+    template<class V>
+    BATCH_INLINE V splat(uint64_t x) {
+        if constexpr(is_same_v<V, uint64_t>)
+            return x;
+        else
+            return V{} + x;
+    }
+
+    template<class V>
+    BATCH_INLINE V load(const vector<uint64_t> &v, size_t at) {
+        V res;
+        memcpy(&res, v.data() + at, sizeof(V));
+        return res;
+    }
+
+    template<int shift, class V>
+    BATCH_INLINE V shifted(V x) {
+        if constexpr(shift > 0)
+            return x << shift;
+        else
+            return x >> -shift;
+    }
+
+    // the squares a slider reaches from gen in one direction, the first
+    // occupied square included. wrap clears what crossed the board's edge
+    template<int shift, uint64_t wrap, class V>
+    BATCH_INLINE V slide(V gen, V empty) {
+        V pro = empty & wrap;
+        gen |= pro & shifted<shift>(gen);
+        pro &= shifted<shift>(pro);
+        gen |= pro & shifted<2 * shift>(gen);
+        pro &= shifted<2 * shift>(pro);
+        gen |= pro & shifted<4 * shift>(gen);
+        return shifted<shift>(gen) & wrap;
+    }
+
+    template<class V> BATCH_INLINE V north(V g, V e) { return slide<8, ~0ULL>(g, e); }
+    template<class V> BATCH_INLINE V south(V g, V e) { return slide<-8, ~0ULL>(g, e); }
+    template<class V> BATCH_INLINE V east(V g, V e) { return slide<1, not_a>(g, e); }
+    template<class V> BATCH_INLINE V west(V g, V e) { return slide<-1, not_h>(g, e); }
+    template<class V> BATCH_INLINE V north_east(V g, V e) { return slide<9, not_a>(g, e); }
+    template<class V> BATCH_INLINE V north_west(V g, V e) { return slide<7, not_h>(g, e); }
+    template<class V> BATCH_INLINE V south_east(V g, V e) { return slide<-7, not_a>(g, e); }
+    template<class V> BATCH_INLINE V south_west(V g, V e) { return slide<-9, not_h>(g, e); }
+
+    template<class V>
+    BATCH_INLINE V diagonal_attacks(V g, V e) {
+        return north_east(g, e) | north_west(g, e) | south_east(g, e) | south_west(g, e);
+    }
+
+    template<class V>
+    BATCH_INLINE V straight_attacks(V g, V e) {
+        return north(g, e) | south(g, e) | east(g, e) | west(g, e);
+    }
+
+    template<class V>
+    BATCH_INLINE V knight_attacks(V n) {
+        V l1 = (n >> 1) & not_h, l2 = (n >> 2) & not_gh;
+        V r1 = (n << 1) & not_a, r2 = (n << 2) & not_ab;
+        V h1 = l1 | r1, h2 = l2 | r2;
+        return (h1 << 16) | (h1 >> 16) | (h2 << 8) | (h2 >> 8);
+    }
+
+    template<class V>
+    BATCH_INLINE V king_attacks(V k) {
+        V row = k | ((k << 1) & not_a) | ((k >> 1) & not_h);
+        return (row | (row << 8) | (row >> 8)) & ~k;
+    }
+
+    // black selects the black pawn direction lane by lane
+    template<class V>
+    BATCH_INLINE V pawn_attacks(V p, V black) {
+        V white_side = ((p << 7) & not_h) | ((p << 9) & not_a);
+        V black_side = ((p >> 9) & not_h) | ((p >> 7) & not_a);
+        return blend(black, white_side, black_side);
+    }
+
+    // one colour's pieces
+    template<class V>
+    struct army {
+        V pawns, knights, diagonal, straight, king, all;
+    };
+
+    template<class V>
+    BATCH_INLINE army<V> gather(const positions &in, size_t at, V black) {
+        army<V> res;
+        V p[6];
+        for(int piece=0; piece<6; piece++)
+            p[piece] = blend(black, load<V>(in.pieces[piece], at), load<V>(in.pieces[piece + 6], at));
+        res.pawns = p[0];
+        res.knights = p[1];
+        res.diagonal = p[2] | p[4];
+        res.straight = p[3] | p[4];
+        res.king = p[5];
+        res.all = p[0] | p[1] | p[2] | p[3] | p[4] | p[5];
+        return res;
+    }
+
+    template<class V>
+    BATCH_INLINE V attacks_of(const army<V> &a, V black, V empty) {
+        return pawn_attacks(a.pawns, black) | knight_attacks(a.knights) | king_attacks(a.king) |
+               diagonal_attacks(a.diagonal, empty) | straight_attacks(a.straight, empty);
+    }
+
+    template<class V>
+    BATCH_INLINE V pawn_moves(V pawns, V black, V empty, V enemy, V targets) {
+        V white_push = (pawns << 8) & empty, black_push = (pawns >> 8) & empty;
+        V single = blend(black, white_push, black_push);
+        V twice = blend(black, ((white_push & rank_3) << 8) & empty, ((black_push & rank_6) >> 8) & empty);
+        V left = blend(black, (pawns << 7) & not_h, (pawns >> 9) & not_h) & enemy;
+        V right = blend(black, (pawns << 9) & not_a, (pawns >> 7) & not_a) & enemy;
+        V promotion = blend(black, splat<V>(rank_8), splat<V>(rank_1));
+
+        V res{};
+        for(V to : {single, twice, left, right}) {
+            to &= targets;
+            res += count(to & ~promotion) + 4 * count(to & promotion);
+        }
+        return res;
+    }
+
+    // what the rays out of the king meet, lines and pins by axis: vertical,
+    // horizontal, then the two diagonals
+    template<class V>
+    struct king_lines {
+        V checkers, blocks, pinned;
+        V lines[4], pinned_on[4];
+    };
+
+    template<int shift, uint64_t wrap, class V>
+    BATCH_INLINE void look(king_lines<V> &res, V king, V own, V empty, V sliders, int axis) {
+        V out = slide<shift, wrap>(king, empty);
+        V hit = out & sliders;
+        res.checkers |= hit;
+        res.blocks |= out & nonzero(hit);
+        V blocker = out & own;
+        V pin = blocker & nonzero(slide<shift, wrap>(blocker, empty) & sliders);
+        res.pinned_on[axis] |= pin;
+        res.pinned |= pin;
+        res.lines[axis] |= slide<shift, wrap>(king, ~empty | empty);
+    }
+
+    // a pinned piece keeps to the line through its king
+    template<class V>
+    BATCH_INLINE V allowed(const king_lines<V> &lines, V piece) {
+        V res = ~piece | piece;
+        for(int axis=0; axis<4; axis++)
+            res &= ~nonzero(piece & lines.pinned_on[axis]) | lines.lines[axis];
+        return res;
+    }
+
+    template<class V>
+    BATCH_INLINE void kernel(const positions &in, results &out, size_t at) {
+        V all = splat<V>(~0ULL);
+        V black = load<V>(in.side, at);
+        army<V> white_army = gather<V>(in, at, V{}), black_army = gather<V>(in, at, all);
+        V occupied = white_army.all | black_army.all, empty = ~occupied;
+
+        V white_attacks = attacks_of(white_army, V{}, empty);
+        V black_attacks = attacks_of(black_army, all, empty);
+
+        army<V> us = gather<V>(in, at, black), them = gather<V>(in, at, ~black);
+        V attacked = blend(black, black_attacks, white_attacks);
+        V king = us.king;
+        V check = nonzero(king & attacked);
+
+        // the king steps out of a slider's line only if the line is seen through it
+        V attacked_past_king = attacks_of(them, ~black, empty | king);
+        V moves = count(king_attacks(king) & ~us.all & ~attacked_past_king);
+
+        // checkers, the squares that block or capture a single one, and pins
+        king_lines<V> lines{};
+        lines.checkers = (knight_attacks(king) & them.knights) | (pawn_attacks(king, black) & them.pawns);
+        look<8, ~0ULL>(lines, king, us.all, empty, them.straight, 0);
+        look<-8, ~0ULL>(lines, king, us.all, empty, them.straight, 0);
+        look<1, not_a>(lines, king, us.all, empty, them.straight, 1);
+        look<-1, not_h>(lines, king, us.all, empty, them.straight, 1);
+        look<9, not_a>(lines, king, us.all, empty, them.diagonal, 2);
+        look<-9, not_h>(lines, king, us.all, empty, them.diagonal, 2);
+        look<7, not_h>(lines, king, us.all, empty, them.diagonal, 3);
+        look<-7, not_a>(lines, king, us.all, empty, them.diagonal, 3);
+
+        V checkers = lines.checkers, pinned = lines.pinned;
+        V double_check = nonzero(checkers & (checkers - 1));
+        V targets = ~us.all & blend(nonzero(checkers), all, checkers | lines.blocks);
+
+        V others{};
+        for(V left = us.knights & ~pinned; any(left); ) {
+            V piece = left & -left;
+            left ^= piece;
+            others += count(knight_attacks(piece) & targets);
+        }
+        for(V left = us.diagonal; any(left); ) {
+            V piece = left & -left;
+            left ^= piece;
+            others += count(diagonal_attacks(piece, empty) & targets & allowed(lines, piece));
+        }
+        for(V left = us.straight; any(left); ) {
+            V piece = left & -left;
+            left ^= piece;
+            others += count(straight_attacks(piece, empty) & targets & allowed(lines, piece));
+        }
+        others += pawn_moves(us.pawns & ~pinned, black, empty, them.all, targets);
+        for(V left = us.pawns & pinned; any(left); ) {
+            V piece = left & -left;
+            left ^= piece;
+            others += pawn_moves(piece, black, empty, them.all, targets & allowed(lines, piece));
+        }
+
+        // en passant lifts two pawns off a line at once, so the king is checked afresh
+        V ep = load<V>(in.ep, at);
+        V captured = blend(black, ep >> 8, ep << 8);
+        V knight_checks = nonzero(knight_attacks(king) & them.knights);
+        for(V left = pawn_attacks(ep, ~black) & us.pawns; any(left); ) {
+            V piece = left & -left;
+            left ^= piece;
+            V after = ~((occupied ^ piece ^ captured) | ep);
+            V exposed = (diagonal_attacks(king, after) & them.diagonal) | (straight_attacks(king, after) & them.straight) |
+                        (pawn_attacks(king, black) & them.pawns & ~captured);
+            others += nonzero(piece) & ~nonzero(exposed) & ~knight_checks & 1;
+        }
+
+        // the rook has to stand in its corner, b1 only has to be empty
+        V castling = load<V>(in.castling, at);
+        V home = blend(black, splat<V>(0x10), splat<V>(0x10ULL << 56));
+        V short_right = blend(black, castling & 1, castling >> 2 & 1);
+        V long_right = blend(black, castling >> 1 & 1, castling >> 3 & 1);
+        V on_home = nonzero(king & home);
+        V short_ok = nonzero(short_right) & on_home & nonzero(us.straight & ~us.diagonal & (home << 3)) &
+                     ~nonzero(occupied & (home * 6)) & ~nonzero(attacked & (home * 7));
+        V long_ok = nonzero(long_right) & on_home & nonzero(us.straight & ~us.diagonal & (home >> 4)) &
+                    ~nonzero(occupied & (home >> 3) * 7) & ~nonzero(attacked & (home >> 2) * 7);
+        others += (short_ok & 1) + (long_ok & 1);
+
+        moves += others & ~double_check;
+
+        for(size_t i=0; i<width<V>; i++) {
+            uint64_t w, b, c, m;
+            if constexpr(is_same_v<V, uint64_t>) {
+                w = white_attacks, b = black_attacks, c = check, m = moves;
+            } else {
+                w = white_attacks[i], b = black_attacks[i], c = check[i], m = moves[i];
+            }
+            out.attacks[0][at + i] = w;
+            out.attacks[1][at + i] = b;
+            out.in_check[at + i] = c & 1;
+            out.legal_moves[at + i] = m;
+        }
+    }
+
+    void run_scalar(const positions &in, results &out, size_t first, size_t last) {
+        for(size_t at=first; at<last; at++)
+            kernel<uint64_t>(in, out, at);
+    }
+
+#ifdef BATCH_X86
+    __attribute__((target("avx2")))
+    size_t run_avx2(const positions &in, results &out) {
+        size_t at = 0;
+        for(; at + width<lanes4> <= in.size(); at += width<lanes4>)
+            kernel<lanes4>(in, out, at);
+        return at;
+    }
+
+    __attribute__((target("avx512f")))
+    size_t run_avx512(const positions &in, results &out) {
+        size_t at = 0;
+        for(; at + width<lanes8> <= in.size(); at += width<lanes8>)
+            kernel<lanes8>(in, out, at);
+        return at;
+    }
+#endif
+}
+
+void positions::clear() {
+    for(auto &p : pieces)
+        p.clear();
+    side.clear();
+    castling.clear();
+    ep.clear();
+}
+
+void positions::add(const board &pos) {
+    for(int piece=0; piece<12; piece++)
+        pieces[piece].push_back(pos.pieces()[piece]);
+    side.push_back(pos.side_to_move() ? ~0ULL : 0);
+    castling.push_back(pos.castling_rights());
+    int square = pos.en_passant_square();
+    ep.push_back(square < 0 ? 0 : 1ULL << square);
+}
+
+void positions::add(const packed_position &p) {
+    array<uint64_t, 12> bits{};
+    int n = 0;
+    for(uint64_t left = p.occupancy(); left; left &= left - 1)
+        bits[p.piece(n++)] |= left & -left;
+    for(int piece=0; piece<12; piece++)
+        pieces[piece].push_back(bits[piece]);
+    int state = p.bytes[packed_position::state_at], square = p.bytes[packed_position::state_at + 1];
+    side.push_back(state & 1 ? ~0ULL : 0);
+    castling.push_back(state >> 1);
+    ep.push_back(square == packed_position::no_square ? 0 : 1ULL << square);
+}
+
+const char *isa_name(isa kernel) {
+    switch(kernel) {
+        case scalar: return "scalar";
+        case avx2: return "avx2";
+        case avx512: return "avx512";
+    }
+    return "?";
+}
+
+bool supported(isa kernel) {
+#ifdef BATCH_X86
+    if(kernel == avx2) return __builtin_cpu_supports("avx2");
+    if(kernel == avx512) return __builtin_cpu_supports("avx512f");
+#endif
+    return kernel == scalar;
+}
+
+void run(const positions &in, results &out, isa kernel) {
+    size_t n = in.size();
+    for(auto &a : out.attacks)
+        a.resize(n);
+    out.in_check.resize(n);
+    out.legal_moves.resize(n);
+
+    size_t done = 0;
+#ifdef BATCH_X86
+    if(kernel == avx2 && supported(avx2)) done = run_avx2(in, out);
+    if(kernel == avx512 && supported(avx512)) done = run_avx512(in, out);
+#endif
+    run_scalar(in, out, done, n);
+}
+
+// compares the scalar kernel with the board on every position, then each
+// instruction set with the scalar kernel, and reports positions per second.
+// Without a file the positions are the usual perft ones and their children
+int bench_command(const vector<string> &args) {
+    positions in;
+    vector<board> boards;
+    if(!args.empty()) {
+        packed::dataset file;
+        if(!file.open(args[0]))
+            return 1;
+        for(auto &p : file) {
+            in.add(p);
+            boards.push_back(board::from_packed(p));
+        }
+    } else {
+        const vector<string> fens = {
+            "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+            "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+            "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+            "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+            "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+            "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        };
+        for(auto &fen : fens) {
+            board root(fen);
+            move_list first;
+            root.gen_legal_moves(first);
+            boards.push_back(root);
+            for(auto &a : first) {
+                board child(root);
+                child.make_move(a);
+                boards.push_back(child);
+                move_list second;
+                child.gen_legal_moves(second);
+                for(auto &b : second) {
+                    board grandchild(child);
+                    grandchild.make_move(b);
+                    boards.push_back(grandchild);
+                }
+            }
+        }
+        for(auto &pos : boards)
+            in.add(pos);
+    }
+    int passes;
+    try {
+        passes = args.size() > 1 ? stoi(args[1]) : 5;
+    } catch(const logic_error &) {
+        cerr << "usage: chess batch-bench [position file] [passes]\n";
+        return 1;
+    }
+
+    results reference;
+    run(in, reference, scalar);
+    size_t mismatches = 0;
+    move_list legal;
+    for(size_t i=0; i<boards.size(); i++) {
+        legal.clear();
+        boards[i].gen_legal_moves(legal);
+        bool same = reference.attacks[0][i] == (unsigned long long)boards[i].gen_attacked(0) &&
+                    reference.attacks[1][i] == (unsigned long long)boards[i].gen_attacked(1) &&
+                    reference.in_check[i] == boards[i].in_check() && reference.legal_moves[i] == legal.size();
+        if(!same && mismatches++ < 5)
+            cerr << "batch: " << boards[i].to_fen() << " gives " << reference.legal_moves[i] << " moves, the board "
+                 << legal.size() << '\n';
+    }
+    cout << "positions: " << in.size() << ", mismatches against the board: " << mismatches << '\n';
+
+    for(isa kernel : {scalar, avx2, avx512}) {
+        if(!supported(kernel)) {
+            cout << isa_name(kernel) << ": not supported here\n";
+            continue;
+        }
+        results res;
+        auto start = chrono::steady_clock::now();
+        for(int pass=0; pass<passes; pass++)
+            run(in, res, kernel);
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        bool same = res.attacks == reference.attacks && res.in_check == reference.in_check &&
+                    res.legal_moves == reference.legal_moves;
+        mismatches += !same;
+        cout << isa_name(kernel) << ": " << passes * in.size() / seconds / 1e6 << " M positions/s"
+             << (same ? "" : ", differs from scalar") << '\n';
+    }
+    return mismatches ? 1 : 0;
+}
+
+}
@@ -1,15 +1,20 @@
 #include "board.h"
+#include "attacks.h"
+#include "stats.h"
 #include "board_utils.h"
+#include "notation.h"
+#include "psqt.h"
+#include "zobrist.h"
 
-#include <stack>
+#include <algorithm>
 #include <map>
 #include <vector>
-#include <functional>
 #include <array>
 #include <bit>
 #include <iostream>
 #include <cmath> 
-#include <set>
+#include <cassert>
+#include <cstring>
 
 using namespace std;
 using namespace board_utils;
@@ -32,7 +37,11 @@ board::board()
       is_color{0, 0},
       is_white(is_color[0]), 
       is_black(is_color[1]),
-      current_state(undecided)
+      mg_score(0),
+      eg_score(0),
+      game_phase(0),
+      pawn_key(0),
+      hash_key(0)
 {
     white_short_castle = true;
     white_long_castle  = true;
@@ -62,7 +71,12 @@ board::board(const board& to_copy)
       is_color(to_copy.is_color),
       is_white(is_color[0]),
       is_black(is_color[1]),
-      current_state(to_copy.current_state)
+      mg_score(to_copy.mg_score),
+      eg_score(to_copy.eg_score),
+      game_phase(to_copy.game_phase),
+      pawn_key(to_copy.pawn_key),
+      hash_key(to_copy.hash_key),
+      acc(to_copy.acc)
 {
     white_short_castle = to_copy.white_short_castle;
     white_long_castle = to_copy.white_long_castle;
@@ -88,92 +102,185 @@ void board::update_is_anything_color() {
     is_anything = is_white | is_black;
 }
 
-bitboard board::gen_attacked(int gen_turn) {
-    stack<pair<int, int>> S;
+void board::put_piece(int piece, int square) {
+    is_piece[piece].set_val(true, square);
+    mg_score += psqt::mg(piece, square);
+    eg_score += psqt::eg(piece, square);
+    game_phase += psqt::phase(piece);
+    hash_key ^= zobrist::piece(piece, square);
+    if(piece % 6 == 0) pawn_key ^= zobrist::piece(piece, square);
+    update_accumulator(piece, square, true);
+}
 
-    if(gen_turn == 0) {
-        for(int i=0; i<64; i++)
-            if(white_pawn[i]) {
-                auto [row, column] = gen_coordinate(i);
+void board::remove_piece(int piece, int square) {
+    is_piece[piece].set_val(false, square);
+    mg_score -= psqt::mg(piece, square);
+    eg_score -= psqt::eg(piece, square);
+    game_phase -= psqt::phase(piece);
+    hash_key ^= zobrist::piece(piece, square);
+    if(piece % 6 == 0) pawn_key ^= zobrist::piece(piece, square);
+    update_accumulator(piece, square, false);
+}
 
-                S.push({row+1, column-1});
-                S.push({row+1, column+1});
-            }
-    } else {
-        for(int i=0; i<64; i++)
-            if(black_pawn[i]) {
-                auto [row, column] = gen_coordinate(i);
+void board::update_accumulator(int piece, int square, bool add) {
+    if(!nnue::loaded())
+        return;
 
-                S.push({row-1, column-1});
-                S.push({row-1, column+1});
-            }
+    // every feature of a perspective hangs off its king, moving it means a full refresh
+    if(piece % 6 == 5) {
+        acc.computed[piece / 6] = false;
+        return;
     }
 
-    bitboard &turn_knight = is_piece[1 + 6 * gen_turn];
-    bitboard &turn_bishop = is_piece[2 + 6 * gen_turn];
-    bitboard &turn_rook   = is_piece[3 + 6 * gen_turn];
-    bitboard &turn_queen  = is_piece[4 + 6 * gen_turn];
-    bitboard &turn_king   = is_piece[5 + 6 * gen_turn];
-
-    for(int i=0; i<64; i++) 
-        if(turn_knight[i]) {
-                auto [row, column] = gen_coordinate(i);
-
-                for(int dir1=-1; dir1<2; dir1+=2)
-                    for(int dir2=-1; dir2<2; dir2+=2) {
-                        S.push({row + 2 * dir1, column + 1 * dir2});
-                        S.push({row + 1 * dir1, column + 2 * dir2});
-                    }
-        }
+    for(int perspective=0; perspective<2; perspective++) {
+        if(!acc.computed[perspective])
+            continue;
+        int king_square = countr_zero((unsigned long long)is_piece[5 + 6 * perspective]);
+        int index = nnue::feature_index(perspective, king_square, piece, square);
+        if(add) nnue::add_feature(acc, perspective, index);
+        else nnue::sub_feature(acc, perspective, index);
+    }
+}
 
-    pair<int, int> direction;
-    function<void(pair<int, int>)> go_into = [&](pair<int, int> coordinate) {
-        coordinate.first += direction.first;
-        coordinate.second += direction.second;
-        if(coordinate_is_legal(coordinate)){
-            S.push(coordinate);
-            if(!((is_anything >> ind_from_coordinate(coordinate))&1))
-                go_into(coordinate);
-        }
-    };
+void board::refresh_accumulators() {
+    if(!nnue::loaded())
+        return;
+    for(int perspective=0; perspective<2; perspective++)
+        if(!acc.computed[perspective])
+            nnue::refresh(acc, perspective, is_piece);
+}
 
-    for(int i=0; i<64; i++) {
+bool board::accumulator_is_consistent() const {
+    if(!nnue::loaded())
+        return true;
+    nnue::accumulator fresh;
+    for(int perspective=0; perspective<2; perspective++) {
+        nnue::refresh(fresh, perspective, is_piece);
+        if(acc.computed[perspective] && fresh.values[perspective] != acc.values[perspective])
+            return false;
+    }
+    return true;
+}
 
-        if(turn_bishop[i]) {
-            for(direction.first = -1; direction.first<2; direction.first+=2)
-                for(direction.second = -1; direction.second<2; direction.second+=2)
-                    go_into(gen_coordinate(i));
+void board::refresh_eval() {
+    mg_score = eg_score = game_phase = 0;
+    for(int piece=0; piece<12; piece++)
+        for(unsigned long long left = is_piece[piece]; left; left &= left - 1) {
+            int square = countr_zero(left);
+            mg_score += psqt::mg(piece, square);
+            eg_score += psqt::eg(piece, square);
+            game_phase += psqt::phase(piece);
         }
+}
 
-        if(turn_rook[i]) {
-            for(direction.first = -1; direction.first<2; direction.first++)
-                for(direction.second = -1; direction.second<2; direction.second++)
-                    if(((bool)direction.first) ^ ((bool)direction.second))
-                        go_into(gen_coordinate(i));
-        }
+unsigned long long board::state_key() const {
+    unsigned long long key = zobrist::castling(castling_rights());
+    if(en_pessant.first != -1) key ^= zobrist::en_passant(en_pessant.second);
+    if(turn) key ^= zobrist::side();
+    return key;
+}
+
+unsigned long long board::position_key() const {
+    int ep = en_passant_square();
+    if(ep == -1)
+        return hash_key;
+    // a pawn next to the double push may still be pinned
+    for(unsigned long long takers = attacks::pawn(!turn, ep) & is_piece[6 * turn]; takers; takers &= takers - 1)
+        if(is_legal({countr_zero(takers), ep}))
+            return hash_key;
+    return hash_key ^ zobrist::en_passant(ep % 8);
+}
 
-        if(turn_queen[i]) {
-            for(direction.first = -1; direction.first<2; direction.first++)
-                for(direction.second = -1; direction.second<2; direction.second++)
-                    if(direction.first != 0 || direction.second != 0)
-                        go_into(gen_coordinate(i));
+void board::refresh_keys() {
+    pawn_key = 0;
+    hash_key = state_key();
+    for(int piece=0; piece<12; piece++)
+        for(unsigned long long left = is_piece[piece]; left; left &= left - 1) {
+            int square = countr_zero(left);
+            hash_key ^= zobrist::piece(piece, square);
+            if(piece % 6 == 0) pawn_key ^= zobrist::piece(piece, square);
         }
-    }
+}
 
-    bitboard res = 0;
+bool board::keys_are_consistent() const {
+    board fresh(*this);
+    fresh.refresh_keys();
+    return fresh.pawn_key == pawn_key && fresh.hash_key == hash_key;
+}
 
-    while(S.size()) {
-        if(coordinate_is_legal(S.top())) {
-            int i = ind_from_coordinate(S.top());
-            res.set_val(true, i);
-        }
-        S.pop();
+bool board::in_check() const {
+    return is_piece[5 + 6 * turn] & gen_attacked(!turn);
+}
+
+bool board::eval_is_consistent() const {
+    board fresh(*this);
+    fresh.refresh_eval();
+    return fresh.mg_score == mg_score && fresh.eg_score == eg_score && fresh.game_phase == game_phase;
+}
+
+// configure with -DCHESS_VALIDATE=ON to check every incremental update
+void board::check_incremental() const {
+#ifdef CHESS_VALIDATE
+    assert(eval_is_consistent());
+    assert(accumulator_is_consistent());
+    assert(keys_are_consistent());
+#endif
+}
+
+int board::evaluate() const {
+    if(nnue::loaded()) {
+        if(acc.computed[0] && acc.computed[1])
+            return nnue::evaluate(acc, turn);
+        nnue::accumulator fresh;
+        nnue::refresh(fresh, 0, is_piece);
+        nnue::refresh(fresh, 1, is_piece);
+        return nnue::evaluate(fresh, turn);
     }
 
+    return tapered(mg_score, eg_score);
+}
+
+int board::evaluate(pawns::table &pawn_cache) const {
+    if(nnue::loaded())
+        return evaluate();
+
+    const pawns::entry &structure = pawn_cache.probe(pawn_key, white_pawn, black_pawn);
+    int white_king_file = countr_zero((unsigned long long)white_king) % 8;
+    int black_king_file = countr_zero((unsigned long long)black_king) % 8;
+    int mg = mg_score + structure.mg + structure.shelter[0][white_king_file] - structure.shelter[1][black_king_file];
+    int eg = eg_score + structure.eg;
+    return tapered(mg, eg);
+}
+
+int board::tapered(int mg, int eg) const {
+    int phase = min(game_phase, psqt::max_phase); // early promotions can push it past 24
+    int score = (mg * phase + eg * (psqt::max_phase - phase)) / psqt::max_phase;
+    return turn ? -score : score;
+}
+
+bitboard board::gen_attacked(int gen_turn) const {
+    CHESS_COUNT(gen_attacked_calls, 1);
+    CHESS_TIME(gen_attacked_time);
+    unsigned long long res = 0, occupied = is_anything;
+    const bitboard *own = &is_piece[6 * gen_turn];
+
+    for(unsigned long long left = own[0]; left; left &= left - 1)
+        res |= attacks::pawn(gen_turn, countr_zero(left));
+    for(unsigned long long left = own[1]; left; left &= left - 1)
+        res |= attacks::knight(countr_zero(left));
+    if(own[5])
+        res |= attacks::king(countr_zero((unsigned long long)own[5]));
+    for(unsigned long long left = own[2] | own[4]; left; left &= left - 1)
+        res |= attacks::bishop(countr_zero(left), occupied);
+    for(unsigned long long left = own[3] | own[4]; left; left &= left - 1)
+        res |= attacks::rook(countr_zero(left), occupied);
+
     return res;
 }
 
-bool board::is_legal(){
+bool board::is_legal() const {
+    CHESS_COUNT(is_legal_calls, 1);
+    CHESS_TIME(is_legal_time);
     //1st check - is every square occupied by exactly zero or one piece
     bitboard current = 0;
     for(auto &elem : is_piece){
@@ -199,198 +306,263 @@ bool board::is_legal(){
     return true;
 };
 
-stack<pair<int, int>> board::gen_moves() {
-    stack<pair<int, int>> S;
-
-    auto pawn_push = [&](int start, int end){
-        if(end/8 == 0 || end/8 == 7){
-            end<<=2;
-            S.push({-start, end});
-            S.push({-start, end+1});
-            S.push({-start, end+2});
-            S.push({-start, end+3});
-            //negative start to signify pawn promotion, last two bits of end representing
-            //the new piece 0 - knight, 1 - bishop, 2 - rook, 3 - queen
-        } else {
-            S.push({start, end});
-        }
+void board::gen_pseudo_moves(move_list &res, int kinds, unsigned long long from) const {
+    CHESS_TIME(gen_pseudo_time);
+    const bitboard &own = is_color[turn];
+    const bitboard &enemy = is_color[!turn];
+    int forward = turn ? -1 : 1;
+    int ep_square = en_pessant.first == -1 ? -1 : ind_from_coordinate(en_pessant);
+
+    auto add_promotions = [&](int start, int end){
+        //negative start to signify pawn promotion, last two bits of end representing
+        //the new piece 0 - knight, 1 - bishop, 2 - rook, 3 - queen
+        for(int piece = 3; piece >= 0; piece--)
+            res.push({-start, (end << 2) + piece});
+    };
+
+    // captures first, the squares come in rising order
+    auto add_targets = [&](int start, unsigned long long targets) {
+        targets &= ~(unsigned long long)own;
+        if(kinds & captures)
+            for(unsigned long long left = targets & enemy; left; left &= left - 1)
+                res.push({start, countr_zero(left)});
+        if(kinds & quiets)
+            for(unsigned long long left = targets & ~(unsigned long long)enemy; left; left &= left - 1)
+                res.push({start, countr_zero(left)});
     };
 
-    if(turn == 0) {
-        for(int i=0; i<64; i++)
-            if(white_pawn[i]) {
-                auto [row, column] = gen_coordinate(i);
-                if(coordinate_is_legal({row+1, column-1}) && 
-                    (is_black[ind_from_coordinate({row+1, column-1})]) || (en_pessant.first == row+1 && en_pessant.second == column-1))
-                        pawn_push(i, ind_from_coordinate({row+1, column-1}));
-                if(coordinate_is_legal({row+1, column+1}) && 
-                    (is_black[ind_from_coordinate({row+1, column+1})] || (en_pessant.first == row+1 && en_pessant.second == column+1)))
-                        pawn_push(i, ind_from_coordinate({row+1, column+1}));
-                
-                if(!is_anything[i+8]) {
-                    pawn_push(i, i+8);
-                    if(row==1 && !is_anything[i+16])
-                        S.push({i, i+16}); // pawn push useless, thus omited
-                }
-
-                
+    const bitboard &turn_pawn   = is_piece[0 + 6 * turn];
+    const bitboard &turn_knight = is_piece[1 + 6 * turn];
+    const bitboard &turn_bishop = is_piece[2 + 6 * turn];
+    const bitboard &turn_rook   = is_piece[3 + 6 * turn];
+    const bitboard &turn_king   = is_piece[5 + 6 * turn];
+
+    for(unsigned long long left = from & own; left; left &= left - 1) {
+        int i = countr_zero(left);
+        auto [row, column] = gen_coordinate(i);
+
+        if(turn_pawn[i]) {
+            bool promotes = (row + forward == 0 || row + forward == 7);
+
+            for(int side=-1; side<2; side+=2) {
+                if(!coordinate_is_legal({row + forward, column + side}))
+                    continue;
+                int end = ind_from_coordinate({row + forward, column + side});
+                if(!enemy[end] && end != ep_square)
+                    continue;
+                if(promotes) {
+                    if(kinds & promotions) add_promotions(i, end);
+                } else if(kinds & captures) res.push({i, end});
             }
-    } else {
-        for(int i=0; i<64; i++)
-            if(black_pawn[i]) {
-                auto [row, column] = gen_coordinate(i);
-                if(coordinate_is_legal({row-1, column-1}) && 
-                    (is_white[ind_from_coordinate({row-1, column-1})] || (en_pessant.first == row-1 && en_pessant.second == column-1)))
-                        pawn_push(i, ind_from_coordinate({row-1, column-1}));
-                if(coordinate_is_legal({row-1, column+1}) && 
-                    (is_white[ind_from_coordinate({row-1, column+1})] || (en_pessant.first == row-1 && en_pessant.second == column+1)))
-                        pawn_push(i, ind_from_coordinate({row-1, column+1}));
-                
-                if(!is_anything[i-8]) {
-                    pawn_push(i, ind_from_coordinate({row-1, column}));
-                    if(row==6 && !is_anything[i-16])
-                        S.push({i, i-16}); // pawn push useless, thus omited
-                }
+
+            int end = i + 8 * forward;
+            if(is_anything[end])
+                continue;
+            if(promotes) {
+                if(kinds & promotions) add_promotions(i, end);
+                continue;
+            }
+            if(kinds & quiets) {
+                res.push({i, end});
+                if(row == (turn ? 6 : 1) && !is_anything[end + 8 * forward])
+                    res.push({i, end + 8 * forward});
             }
+            continue;
+        }
+
+        if(turn_knight[i]) add_targets(i, attacks::knight(i));
+        else if(turn_king[i]) add_targets(i, attacks::king(i));
+        else if(turn_bishop[i]) add_targets(i, attacks::bishop(i, is_anything));
+        else if(turn_rook[i]) add_targets(i, attacks::rook(i, is_anything));
+        else add_targets(i, attacks::queen(i, is_anything));
     }
 
-    bitboard &turn_knight = is_piece[1 + 6 * turn];
-    bitboard &turn_bishop = is_piece[2 + 6 * turn];
-    bitboard &turn_rook   = is_piece[3 + 6 * turn];
-    bitboard &turn_queen  = is_piece[4 + 6 * turn];
-    bitboard &turn_king   = is_piece[5 + 6 * turn];
-
-    for(int i=0; i<64; i++) 
-        if(turn_knight[i]) {
-                auto [row, column] = gen_coordinate(i);
-
-                for(int ska1=-1; ska1<2; ska1+=2)
-                    for(int ska2=-1; ska2<2; ska2+=2) {
-                        if(coordinate_is_legal({row + 2 * ska1, column + 1 * ska2}) && 
-                            !is_color[turn][ind_from_coordinate({row + 2 * ska1, column + 1 * ska2})])
-                                S.push({i, ind_from_coordinate({row + 2 * ska1, column + 1 * ska2})});
-                        if(coordinate_is_legal({row + 1 * ska1, column + 2 * ska2}) && 
-                            !is_color[turn][ind_from_coordinate({row + 1 * ska1, column + 2 * ska2})])
-                                S.push({i, ind_from_coordinate({row + 1 * ska1, column + 2 * ska2})});
-                    }
-        }
+    if(!(kinds & quiets))
+        return;
 
-    for(int i=0; i<64; i++){
-        if(turn_king[i]){
-            auto [row, column] = gen_coordinate(i);
-            for(int dirx=-1; dirx<2; dirx++)
-                for(int diry=-1; diry<2; diry++)
-                    if(coordinate_is_legal({row + diry, column + dirx}) && 
-                        !is_color[turn][ind_from_coordinate({row + diry, column + dirx})])
-                            S.push({i, ind_from_coordinate({row + diry, column + dirx})});
+    int king_square = 4 + 56 * turn;
+    bool short_castle = turn ? black_short_castle : white_short_castle;
+    bool long_castle  = turn ? black_long_castle  : white_long_castle;
+    if(!((from >> king_square) & 1) || !turn_king[king_square])
+        return;
 
-            break;
-        }
-    }
-    int i;
-    pair<int, int> direction;
-    function<void(pair<int, int>)> go_into = [&](pair<int, int> coordinate) {
-        coordinate.first += direction.first;
-        coordinate.second += direction.second;
-        if(coordinate_is_legal(coordinate) && !is_color[turn][ind_from_coordinate(coordinate)]){
-            S.push({i, ind_from_coordinate(coordinate)});
-            if(!is_anything[ind_from_coordinate(coordinate)])
-                go_into(coordinate);
-        }
-    };
+    // e1 and the squares the king crosses must not be attacked, b1 only has to be empty
+    unsigned long long short_path = 0x60ULL << (56 * turn), short_safe = 0x70ULL << (56 * turn);
+    unsigned long long long_path  = 0x0EULL << (56 * turn), long_safe  = 0x1CULL << (56 * turn);
 
-    for(i=0; i<64; i++) {
+    short_castle = short_castle && turn_rook[king_square + 3] && !(is_anything & short_path);
+    long_castle  = long_castle  && turn_rook[king_square - 4] && !(is_anything & long_path);
+    if(!short_castle && !long_castle)
+        return;
 
-        if(turn_bishop[i]) {
-            for(direction.first = -1; direction.first<2; direction.first+=2)
-                for(direction.second = -1; direction.second<2; direction.second+=2)
-                    go_into(gen_coordinate(i));
-        }
+    bitboard attacked = gen_attacked(!turn);
+    if(short_castle && !(attacked & short_safe))
+        res.push({0 + 2 * turn, 0 + 2 * turn});
+    if(long_castle && !(attacked & long_safe))
+        res.push({1 + 2 * turn, 1 + 2 * turn});
+}
 
-        if(turn_rook[i]) {
-            for(direction.first = -1; direction.first<2; direction.first++)
-                for(direction.second = -1; direction.second<2; direction.second++)
-                    if(((bool) direction.first) ^ ((bool)direction.second))
-                        go_into(gen_coordinate(i));
-        }
+unsigned long long board::attackers(int square, int by, unsigned long long occupied) const {
+    const bitboard *p = &is_piece[6 * by];
+    return (attacks::pawn(!by, square) & p[0]) | (attacks::knight(square) & p[1]) | (attacks::king(square) & p[5]) |
+           (attacks::bishop(square, occupied) & (p[2] | p[4])) | (attacks::rook(square, occupied) & (p[3] | p[4]));
+}
 
-        if(turn_queen[i]) {
-            for(direction.first = -1; direction.first<2; direction.first++)
-                for(direction.second = -1; direction.second<2; direction.second++)
-                    if(direction.first != 0 || direction.second != 0)
-                        go_into(gen_coordinate(i));
-        }
+bool board::is_pseudo_legal(const pair<int, int> &move) const {
+    auto [first, second] = move;
+    int forward = turn ? -8 : 8;
+
+    // castling, the rights, an empty path and no attacked square on the king's way
+    if(first == second) {
+        if(first / 2 != turn || first < 0 || first > 3)
+            return false;
+        bool long_side = first % 2;
+        bool right = long_side ? (turn ? black_long_castle : white_long_castle)
+                               : (turn ? black_short_castle : white_short_castle);
+        int king_square = 4 + 56 * turn;
+        unsigned long long path = (long_side ? 0x0EULL : 0x60ULL) << (56 * turn);
+        unsigned long long safe = (long_side ? 0x1CULL : 0x70ULL) << (56 * turn);
+        if(!right || !is_piece[5 + 6 * turn][king_square] || !is_piece[3 + 6 * turn][long_side ? king_square - 4 : king_square + 3] ||
+           (is_anything & path))
+            return false;
+        for(unsigned long long left = safe; left; left &= left - 1)
+            if(attackers(countr_zero(left), !turn, is_anything))
+                return false;
+        return true;
     }
 
-    stack<pair<int, int>> res;
+    // promotions, a push to an empty square or a capture from the seventh rank
+    if(first < 0) {
+        int from = -first, to = second >> 2;
+        if(from >= 64 || second < 0 || to >= 64 || !is_piece[6 * turn][from] || from / 8 != (turn ? 1 : 6))
+            return false;
+        if(to == from + forward)
+            return !is_anything[to];
+        return (attacks::pawn(turn, from) >> to & 1) && is_color[!turn][to];
+    }
 
-    if(turn == 0) {
-        if(white_short_castle && !((is_anything | gen_attacked(!turn)) & (96ULL))){
-            res.push({0, 0});
-        }
-        if(white_long_castle && !((is_anything | gen_attacked(!turn)) & (14ULL))){
-            res.push({1, 1});
-        }
-    } else {
-        if(black_short_castle && !((is_anything | gen_attacked(!turn)) & (0x6000000000000000ULL))){
-            res.push({2, 2});
-        }
-        if(black_long_castle && !((is_anything | gen_attacked(!turn)) & (0xE00000000000000ULL))){
-            res.push({3, 3});
-        }
+    int from = first, to = second;
+    if(from >= 64 || to < 0 || to >= 64 || !is_color[turn][from] || is_color[turn][to])
+        return false;
+    if(is_piece[6 * turn][from]) {
+        if(to / 8 == (turn ? 0 : 7))
+            return false;
+        if(to == from + forward)
+            return !is_anything[to];
+        if(to == from + 2 * forward)
+            return from / 8 == (turn ? 6 : 1) && !is_anything[from + forward] && !is_anything[to];
+        return (attacks::pawn(turn, from) >> to & 1) && (is_color[!turn][to] || to == en_passant_square());
     }
+    unsigned long long reach;
+    if(is_piece[1 + 6 * turn][from]) reach = attacks::knight(from);
+    else if(is_piece[2 + 6 * turn][from]) reach = attacks::bishop(from, is_anything);
+    else if(is_piece[3 + 6 * turn][from]) reach = attacks::rook(from, is_anything);
+    else if(is_piece[4 + 6 * turn][from]) reach = attacks::queen(from, is_anything);
+    else reach = attacks::king(from);
+    return reach >> to & 1;
+}
 
-    while(S.size()){
-        auto top = S.top(); S.pop();
-        board copy(*this);
-        copy.make_move(top);
-        if(copy.is_legal()) res.push(top);
+// the attackers of the king are looked up on the board as it will be, with the
+// mover gone from its square, the target taken and an en passant victim removed.
+// Boards without one king a side or with pawns on the back ranks have no legal
+// moves, and taking the king is not one either, as is_legal() has it
+bool board::keeps_king_safe(const pair<int, int> &move) const {
+    if(popcount(white_king) != 1 || popcount(black_king) != 1 || (0xFF000000000000FFULL & (white_pawn | black_pawn)))
+        return false;
+    auto [first, second] = move;
+    if(first == second)
+        return true;
+
+    int from = first < 0 ? -first : first, to = first < 0 ? second >> 2 : second;
+    if(is_piece[11 - 6 * turn][to])
+        return false;
+    unsigned long long target = 1ULL << to;
+    unsigned long long occupied = (is_anything & ~(1ULL << from)) | target;
+    unsigned long long enemy = is_color[!turn] & ~target;
+    if(first >= 0 && to == en_passant_square() && is_piece[6 * turn][from]) {
+        unsigned long long victim = 1ULL << (to + (turn ? 8 : -8));
+        occupied &= ~victim;
+        enemy &= ~victim;
     }
+    int own_king = countr_zero((unsigned long long)is_piece[5 + 6 * turn]);
+    return !(attackers(from == own_king ? to : own_king, !turn, occupied) & enemy);
+}
 
-    if(ply_100 == 100) {current_state = draw_50_rule; return {};}
-    if(turn == 0 && res.empty()) {if(white_king & gen_attacked(!turn)) {current_state = black_won; return {};}}
-    if(turn == 1 && res.empty()) {if(black_king & gen_attacked(!turn)) {current_state = white_won; return {};}}
-    if(res.empty()) {current_state == draw_stalemate; return {};}
+bool board::is_legal(const pair<int, int> &move) const {
+    return is_pseudo_legal(move) && keeps_king_safe(move);
+}
 
+void board::gen_legal_moves(move_list &res) const {
+    CHESS_TIME(gen_legal_time);
+    move_list pseudo;
+    gen_pseudo_moves(pseudo, all_moves);
+
+    res.clear();
+    for(auto &move : pseudo)
+        if(keeps_king_safe(move)) res.push(move);
+    CHESS_COUNT(pseudo_moves, pseudo.size());
+    CHESS_COUNT(legal_moves, res.size());
+    CHESS_COUNT(illegal_moves, pseudo.size() - res.size());
+}
+
+move_list board::gen_moves() const {
+    CHESS_COUNT(gen_moves_calls, 1);
+    move_list res;
+    if(ply_100 < 100)
+        gen_legal_moves(res);
     return res;
 }
 
+board::game_state board::state() const {
+    return state(gen_moves());
+}
+
+board::game_state board::state(const move_list &moves) const {
+    if(ply_100 >= 100) return draw_50_rule;
+    if(!moves.empty()) return undecided;
+    if(in_check()) return turn ? white_won : black_won;
+    return draw_stalemate;
+}
+
 void board::make_move(const pair<int, int> &move){
+    CHESS_COUNT(make_move_calls, 1);
+    CHESS_TIME(make_move_time);
+    hash_key ^= state_key(); // finish_move adds back the updated castling, en passant and side
     auto [start, end] = move;
     if(start == 0 && end == 0) {
-        white_king.set_val(false, ind_from_coordinate({0, 4}));
-        white_king.set_val(true, ind_from_coordinate({0, 6}));
-        white_rook.set_val(false, ind_from_coordinate({0, 7}));
-        white_rook.set_val(true, ind_from_coordinate({0, 5}));
-        white_short_castle = false;
+        remove_piece(5, ind_from_coordinate({0, 4}));
+        put_piece(5, ind_from_coordinate({0, 6}));
+        remove_piece(3, ind_from_coordinate({0, 7}));
+        put_piece(3, ind_from_coordinate({0, 5}));
+        white_short_castle = white_long_castle = false;
     }
     if(start == 1 && end == 1) {
-        white_king.set_val(false, ind_from_coordinate({0, 4}));
-        white_king.set_val(true, ind_from_coordinate({0, 2}));
-        white_rook.set_val(false, ind_from_coordinate({0, 0}));
-        white_rook.set_val(true, ind_from_coordinate({0, 3}));
-        white_long_castle = false;
+        remove_piece(5, ind_from_coordinate({0, 4}));
+        put_piece(5, ind_from_coordinate({0, 2}));
+        remove_piece(3, ind_from_coordinate({0, 0}));
+        put_piece(3, ind_from_coordinate({0, 3}));
+        white_short_castle = white_long_castle = false;
     }
     if(start == 2 && end == 2) {
-        black_king.set_val(false, ind_from_coordinate({7, 4}));
-        black_king.set_val(true, ind_from_coordinate({7, 6}));
-        black_rook.set_val(false, ind_from_coordinate({7, 7}));
-        black_rook.set_val(true, ind_from_coordinate({7, 5}));
-        black_short_castle = false;
+        remove_piece(11, ind_from_coordinate({7, 4}));
+        put_piece(11, ind_from_coordinate({7, 6}));
+        remove_piece(9, ind_from_coordinate({7, 7}));
+        put_piece(9, ind_from_coordinate({7, 5}));
+        black_short_castle = black_long_castle = false;
     }
     if(start == 3 && end == 3) {
-        black_king.set_val(false, ind_from_coordinate({7, 4}));
-        black_king.set_val(true, ind_from_coordinate({7, 2}));
-        black_rook.set_val(false, ind_from_coordinate({7, 0}));
-        black_rook.set_val(true, ind_from_coordinate({7, 3}));
-        black_long_castle = false;
+        remove_piece(11, ind_from_coordinate({7, 4}));
+        put_piece(11, ind_from_coordinate({7, 2}));
+        remove_piece(9, ind_from_coordinate({7, 0}));
+        put_piece(9, ind_from_coordinate({7, 3}));
+        black_short_castle = black_long_castle = false;
     }
     if(start == end) {
-        ply_100 = 0;
+        ply_100++;
         ply++;
         turn ^= 1;
         en_pessant = {-1, -1};
-        update_is_anything_color();
+        finish_move();
         return;
     }
 
@@ -403,22 +575,20 @@ void board::make_move(const pair<int, int> &move){
         auto [start_row, start_col] = gen_coordinate(start);
         auto [end_row, end_col] = gen_coordinate(end);
 
-        if(end == 4) white_short_castle = white_long_castle = false;
-        if(end == 60) black_short_castle = black_long_castle = false;
-        if(end == 0) white_short_castle = false;
-        if(end == 7) white_long_castle = false;
-        if(end == 56) black_short_castle = false;
-        if(end == 63) black_long_castle = false;
+        if(end == 0) white_long_castle = false;
+        if(end == 7) white_short_castle = false;
+        if(end == 56) black_long_castle = false;
+        if(end == 63) black_short_castle = false;
 
         en_pessant = {-1, -1};
 
-        is_piece[turn*6].set_val(false, start);
-        for(auto &elem : is_piece) if(elem[end]) { elem.set_val(false, end); ply_100 = -1; }
-        is_piece[turn*6 + 1 + prom_type].set_val(1, end);
+        remove_piece(turn*6, start);
+        for(int i=0; i<12; i++) if(is_piece[i][end]) remove_piece(i, end);
+        put_piece(turn*6 + 1 + prom_type, end);
         ply_100 = 0;
         ply++;
         turn^=1;
-        update_is_anything_color();
+        finish_move();
         return;
     }
 
@@ -433,134 +603,82 @@ void board::make_move(const pair<int, int> &move){
 
     if(end_pos == 12 && start_col != end_col && is_piece[6*turn][start]) { // en pessant
         pair<int, int> sec_end_pos = {start_row, end_col};
-        for(auto &elem : is_piece) 
-            elem.set_val(false, ind_from_coordinate(sec_end_pos));
+        remove_piece(6*(!turn), ind_from_coordinate(sec_end_pos));
         
-        is_piece[start_pos].set_val(false, start);
-        is_piece[start_pos].set_val(true, end);
+        remove_piece(start_pos, start);
+        put_piece(start_pos, end);
         ply_100 = 0;
         ply++;
         turn ^= 1;
         en_pessant = {-1, -1};
     } else {
-        end_pos = 0;
-        if(start == 4 || end==4) white_short_castle = white_long_castle = false;
-        if(start == 60 ||end==4) black_short_castle = black_long_castle = false;
-        if(start == 0 || end==4) white_short_castle = false;
-        if(start == 7 || end==4) white_long_castle = false;
-        if(start == 56 || end==4) black_short_castle = false;
-        if(start == 63 || end==4) black_long_castle = false;
-
-        if(is_piece[6*turn][start] && abs(start-end) == 16) en_pessant == gen_coordinate((start+end)/2);
+        if(start == 4) white_short_castle = white_long_castle = false;
+        if(start == 60) black_short_castle = black_long_castle = false;
+        if(start == 0 || end == 0) white_long_castle = false;
+        if(start == 7 || end == 7) white_short_castle = false;
+        if(start == 56 || end == 56) black_long_castle = false;
+        if(start == 63 || end == 63) black_short_castle = false;
+
+        if(is_piece[6*turn][start] && abs(start-end) == 16) en_pessant = gen_coordinate((start+end)/2);
         else en_pessant = {-1, -1};
 
-        is_piece[start_pos].set_val(false, start);
-        for(auto &elem : is_piece) if(elem[end]) { elem.set_val(false, end); ply_100 = -1; }
-        is_piece[start_pos].set_val(true, end);
+        if(is_piece[6*turn][start]) ply_100 = -1;
+        remove_piece(start_pos, start);
+        if(end_pos < 12) { remove_piece(end_pos, end); ply_100 = -1; }
+        put_piece(start_pos, end);
         ply_100++;
         ply++;
         turn^=1;
     }
+    finish_move();
+}
+
+void board::finish_move() {
+    hash_key ^= state_key();
     update_is_anything_color();
+    refresh_accumulators();
+    check_incremental();
 }
 
 void board::make_move(const pair<int, int> &start, const pair<int, int> &end){
     make_move({ind_from_coordinate(start), ind_from_coordinate(end)});
 }
 
-void board::update_state(){
-    if(ply_100 == 100) {current_state = draw_50_rule; return;}
-    if(turn == 0) {if(black_king & gen_attacked(turn)) {current_state = white_won; return;}}
-    if(turn == 1) {if(white_king & gen_attacked(turn)) {current_state = black_won; return;}}
-    if(gen_moves().size() == 0) {current_state == draw_stalemate; return;}
-}
-
-set<string> board::print_moves(){
+move_list board::print_moves() const {
     cout << "Avalaible moves";
-    auto tmp = gen_moves();
-    set<string> res;
-    if(tmp.size() == 0) {
+    move_list res = gen_moves();
+    if(res.empty()) {
         cout << ": none!\n";
-        switch (current_state) {
+        switch (state(res)) {
             case white_won : cout << "White won!\n"; break;
             case draw_3_fold : cout << "Draw! (a 3-fold repetition)\n"; break;
             case draw_50_rule : cout << "Draw! (50-move rule)\n"; break;
             case draw_stalemate : cout << "Draw by stalemate!\n"; break;
             case black_won : cout << "Black won!\n"; break;
+            case undecided : break;
         }
-        return {};
+        return res;
     }
 
-    cout << " (" << tmp.size() << ")\n";
-    while(tmp.size()) {
-        auto top = tmp.top(); tmp.pop();
-        if(top.first == top.second){
-            cout << (top.first % 2 ? "o-o-o\n" : "o-o\n");
-            (top.first % 2 ? res.insert("o-o-o") : res.insert("o-o"));
-            continue;
-        }
-        if(top.first<0) {
-            string without_prom = (std::string(1, char(gen_coordinate(-top.first).second + 'a')) + 
-                      std::to_string(gen_coordinate(-top.first).first + 1) + '-' +
-                      std::string(1, char(gen_coordinate(top.second >> 2).second + 'a')) + 
-                      std::to_string(gen_coordinate(top.second >> 2).first + 1) + '=');
-                      
-            if(top.second%4 == 0){
-                without_prom+=("N");
-                cout << without_prom << '\n';
-                res.insert(without_prom);
-                continue;
-            }
-            if(top.second%4 == 1){
-                without_prom+=("B");
-                cout << without_prom << '\n';
-                res.insert(without_prom);
-                continue;
-            }
-            if(top.second%4 == 2){
-                without_prom+=("R");
-                cout << without_prom << '\n';
-                res.insert(without_prom);
-                continue;
-            }
-            if(top.second%4 == 3){
-                without_prom+=("Q");
-                cout << without_prom << '\n';
-                res.insert(without_prom);
-                continue;
-            }
-        }
-        string move = (std::string(1, char(gen_coordinate(top.first).second + 'a')) + 
-                      std::to_string(gen_coordinate(top.first).first + 1) + '-' +
-                      std::string(1, char(gen_coordinate(top.second).second + 'a')) + 
-                      std::to_string(gen_coordinate(top.second).first + 1));
-
-        cout << move << '\n';
-        res.insert(move);
+    cout << " (" << res.size() << ")\n";
+    char text[notation::max_length];
+    for(auto &move : res) {
+        notation::write_long(text, move);
+        cout << text << '\n';
     }
     return res;
 }
 
-void board::user_move(set<string> legal){
+void board::user_move(const move_list &legal){
     cout << "input move: ";
     string s; cin >> s;
-    while(legal.count(s) == 0) {
+    auto move = notation::parse_long(legal, s);
+    while(move == notation::no_move) {
         cout << "Illegal move! Try again.\ninput move: ";
         cin >> s;
+        move = notation::parse_long(legal, s);
     }
-
-    if(s == "o-o") {make_move({0 + 2*turn, 0 + 2*turn}); return;}
-    if(s == "o-o-o") {make_move({1 + 2*turn, 1 + 2*turn}); return;}
-    if(s.size()==7) {
-        int piece;
-        if(s.back() == 'N') piece = 0;
-        if(s.back() == 'B') piece = 1;
-        if(s.back() == 'R') piece = 2;
-        if(s.back() == 'Q') piece = 3;
-        make_move({-ind_from_coordinate({s[1]-'1', s[0]-'a'}), (ind_from_coordinate({s[4]-'1', s[3]-'a'})<<2) + piece});
-        return;
-    } 
-    make_move({s[1]-'1', s[0]-'a'}, {s[4]-'1', s[3]-'a'});
+    make_move(move);
 }
 
 board::board (const string &fen) 
@@ -581,8 +699,20 @@ board::board (const string &fen)
       is_color{0, 0},
       is_white(is_color[0]), 
       is_black(is_color[1]),
-      current_state(undecided)
+      mg_score(0),
+      eg_score(0),
+      game_phase(0),
+      pawn_key(0),
+      hash_key(0)
 {
+    white_short_castle = false;
+    white_long_castle  = false;
+    black_short_castle = false;
+    black_long_castle  = false;
+    ply_100 = 0;
+    ply = 0;
+    en_pessant = {-1, -1};
+
     constexpr array<int, 128> parse = []() {
         array<int, 128> map{};
         
@@ -643,10 +773,13 @@ board::board (const string &fen)
     
     fen_pos++;
 
-    while(fen.size() > fen_pos){
-        ply *= 10;
-        ply += (fen[fen_pos++] - '0');
+    // ply counts half moves from the start of the game, fen gives full moves
+    int full_moves = 0;
+    while(fen_pos < (int)fen.size() && fen[fen_pos] >= '0' && fen[fen_pos] <= '9'){
+        full_moves *= 10;
+        full_moves += (fen[fen_pos++] - '0');
     }
+    ply = 2 * (max(full_moves, 1) - 1) + turn;
 
     white_pawn    = is_piece[0];
     white_knight  = is_piece[1];
@@ -664,9 +797,140 @@ board::board (const string &fen)
     is_black      = is_color[1];
 
     update_is_anything_color();
+    refresh_eval();
+    refresh_keys();
+    refresh_accumulators();
+}
+
+bool board::is_valid_fen(const string &fen) {
+    vector<string> fields(1);
+    for(char c : fen) {
+        if(c == ' ') fields.emplace_back();
+        else fields.back() += c;
+    }
+    if(fields.size() != 6)
+        return false;
+    auto digits = [](const string &field) {
+        return !field.empty() && field.size() <= 5 && all_of(field.begin(), field.end(), [](char c) { return c >= '0' && c <= '9'; });
+    };
+
+    int rows = 1, squares = 0, kings[2] = {0, 0};
+    for(char c : fields[0]) {
+        if(c == '/') {
+            if(squares != 8) return false;
+            rows++;
+            squares = 0;
+        } else if(c >= '1' && c <= '8') {
+            squares += c - '0';
+        } else if(const char *at = strchr("PNBRQKpnbrqk", c); c && at) {
+            squares++;
+            if(at[0] == 'K' || at[0] == 'k') kings[at[0] == 'k']++;
+        } else {
+            return false;
+        }
+        if(squares > 8) return false;
+    }
+    if(rows != 8 || squares != 8 || kings[0] != 1 || kings[1] != 1)
+        return false;
+
+    const string &side = fields[1], &castling = fields[2], &ep = fields[3];
+    if(side != "w" && side != "b")
+        return false;
+    if(castling != "-" && (castling.empty() || castling.find_first_not_of("KQkq") != string::npos))
+        return false;
+    if(ep != "-" && (ep.size() != 2 || ep[0] < 'a' || ep[0] > 'h' || ep[1] != (side == "w" ? '6' : '3')))
+        return false;
+    return digits(fields[4]) && digits(fields[5]);
+}
+
+string board::to_fen() const {
+    const char *letters = "PNBRQKpnbrqk";
+    string res;
+    for(int row = 7; row >= 0; row--) {
+        int empty = 0;
+        for(int column = 0; column < 8; column++) {
+            int square = ind_from_coordinate({row, column});
+            int piece = 0;
+            while(piece < 12 && !is_piece[piece][square])
+                piece++;
+            if(piece == 12) {
+                empty++;
+                continue;
+            }
+            if(empty) res += char('0' + empty);
+            empty = 0;
+            res += letters[piece];
+        }
+        if(empty) res += char('0' + empty);
+        if(row) res += '/';
+    }
+
+    res += turn ? " b " : " w ";
+    if(white_short_castle) res += 'K';
+    if(white_long_castle)  res += 'Q';
+    if(black_short_castle) res += 'k';
+    if(black_long_castle)  res += 'q';
+    if(!castling_rights()) res += '-';
+
+    res += ' ';
+    if(en_pessant.first == -1) res += '-';
+    else {
+        res += char('a' + en_pessant.second);
+        res += char('1' + en_pessant.first);
+    }
+    return res + ' ' + to_string(ply_100) + ' ' + to_string(ply / 2 + 1);
+}
+
+packed_position board::pack() const {
+    packed_position res{};
+    unsigned long long occupied = is_anything;
+    for(int i=0; i<8; i++)
+        res.bytes[i] = occupied >> (8 * i);
+
+    // the nibble of a square sits at its rank among the occupied squares
+    for(int piece=0; piece<12; piece++)
+        for(unsigned long long left = is_piece[piece]; left; left &= left - 1) {
+            int n = popcount(occupied & ((1ULL << countr_zero(left)) - 1));
+            if(n < 32)
+                res.bytes[packed_position::pieces_at + n / 2] |= piece << (4 * (n % 2));
+        }
+
+    int full_moves = min(ply / 2 + 1, 65535);
+    int ep = en_passant_square();
+    res.bytes[packed_position::state_at] = turn | castling_rights() << 1;
+    res.bytes[packed_position::state_at + 1] = ep < 0 ? packed_position::no_square : ep;
+    res.bytes[packed_position::state_at + 2] = min(ply_100, 255);
+    res.bytes[packed_position::state_at + 3] = full_moves & 255;
+    res.bytes[packed_position::state_at + 4] = full_moves >> 8;
+    return res;
+}
+
+board board::from_packed(const packed_position &packed) {
+    board res;
+    int n = 0;
+    for(unsigned long long left = packed.occupancy(); left; left &= left - 1)
+        res.is_piece[packed.piece(n++)].set_val(true, countr_zero(left));
+
+    int state = packed.bytes[packed_position::state_at];
+    int ep = packed.bytes[packed_position::state_at + 1];
+    int full_moves = packed.bytes[packed_position::state_at + 3] | packed.bytes[packed_position::state_at + 4] << 8;
+    res.turn = state & 1;
+    res.white_short_castle = state >> 1 & 1;
+    res.white_long_castle  = state >> 2 & 1;
+    res.black_short_castle = state >> 3 & 1;
+    res.black_long_castle  = state >> 4 & 1;
+    res.en_pessant = ep == packed_position::no_square ? make_pair(-1, -1) : gen_coordinate(ep);
+    res.ply_100 = packed.bytes[packed_position::state_at + 2];
+    res.ply = 2 * (max(full_moves, 1) - 1) + res.turn;
+
+    res.update_is_anything_color();
+    res.refresh_eval();
+    res.refresh_keys();
+    res.refresh_accumulators();
+    return res;
 }
 
-void board::print_board() {
+void board::print_board() const {
     constexpr std::array<char, 13> parse = {
         'P', 'N', 'B', 'R', 'Q', 'K', 'p', 'n', 'b', 'r', 'q', 'k', ';'
     };
@@ -0,0 +1,175 @@
+#include "counters.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace counters {
+
+namespace {
+    const char *names[event_count] = {"cycles", "instructions", "branches", "branch misses",
+                                      "l1d misses", "llc misses", "page faults"};
+
+#ifdef __linux__
+    struct event_code {
+        uint32_t type;
+        uint64_t config;
+    };
+
+    constexpr uint64_t cache_read_miss(uint64_t cache) {
+        return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    }
+
+    const event_code codes[event_count] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_L1D)},
+        {PERF_TYPE_HW_CACHE, cache_read_miss(PERF_COUNT_HW_CACHE_LL)},
+        {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+    };
+
+    int open_event(const event_code &code) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = code.type;
+        attr.config = code.config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+
+    const char *reason(int error) {
+        switch(error) {
+            case EACCES:
+            case EPERM: return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+            case ENOSYS: return "the kernel has no perf_event_open";
+            case ENOENT:
+            case EOPNOTSUPP:
+            case EINVAL: return "not counted by this cpu or virtual machine";
+            default: return strerror(error);
+        }
+    }
+#endif
+
+    double ratio(const reading &r, event a, event b) {
+        return r.value[b] ? double(r.value[a]) / r.value[b] : 0;
+    }
+}
+
+const char *name(event e) {
+    return names[e];
+}
+
+group::group() {
+    fds.fill(-1);
+#ifdef __linux__
+    // names of the missing events grouped by the reason they are missing
+    string missing, last_reason;
+    for(int e=0; e<event_count; e++) {
+        fds[e] = open_event(codes[e]);
+        if(fds[e] != -1)
+            continue;
+        string now = reason(errno);
+        if(now != last_reason && !last_reason.empty())
+            missing += " (" + last_reason + "), ";
+        else if(!missing.empty())
+            missing += ", ";
+        missing += names[e];
+        last_reason = now;
+    }
+    if(!missing.empty())
+        why = missing + " (" + last_reason + ")";
+#else
+    why = "performance counters need Linux";
+#endif
+}
+
+group::~group() {
+#ifdef __linux__
+    for(int fd : fds)
+        if(fd != -1)
+            close(fd);
+#endif
+}
+
+bool group::available() const {
+    for(int fd : fds)
+        if(fd != -1)
+            return true;
+    return false;
+}
+
+void group::start() {
+#ifdef __linux__
+    for(int fd : fds)
+        if(fd != -1) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+}
+
+reading group::stop() {
+    reading res;
+#ifdef __linux__
+    for(int fd : fds)
+        if(fd != -1)
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    for(int e=0; e<event_count; e++) {
+        // the count, then the time enabled and the time running
+        uint64_t values[3];
+        if(fds[e] == -1 || read(fds[e], values, sizeof(values)) != sizeof(values) || !values[2])
+            continue;
+        double scale = double(values[1]) / values[2];
+        res.value[e] = uint64_t(values[0] * scale);
+        res.valid[e] = true;
+        res.multiplexing = max(res.multiplexing, scale);
+    }
+#endif
+    return res;
+}
+
+void report(ostream &out, const reading &r, double nodes) {
+    bool any = false;
+    for(int e=0; e<event_count; e++) {
+        if(!r.valid[e])
+            continue;
+        out << "  " << names[e] << ": " << r.value[e] << ", " << r.value[e] / max(nodes, 1.0) << " per node\n";
+        any = true;
+    }
+    if(!any) {
+        out << "  no counters\n";
+        return;
+    }
+
+    string derived;
+    auto add = [&](const string &text) { derived += (derived.empty() ? "  " : ", ") + text; };
+    if(r.has(cycles) && r.has(instructions))
+        add("ipc " + to_string(ratio(r, instructions, cycles)));
+    if(r.has(branches) && r.has(branch_misses))
+        add("branch miss rate " + to_string(100 * ratio(r, branch_misses, branches)) + "%");
+    if(r.has(instructions) && r.has(l1d_misses))
+        add("l1d misses per 1000 instructions " + to_string(1000 * ratio(r, l1d_misses, instructions)));
+    if(r.has(instructions) && r.has(llc_misses))
+        add("llc misses per 1000 instructions " + to_string(1000 * ratio(r, llc_misses, instructions)));
+    if(r.multiplexing > 1.01)
+        add("scaled up " + to_string(r.multiplexing) + "x for multiplexing");
+    if(!derived.empty())
+        out << derived << '\n';
+}
+
+}
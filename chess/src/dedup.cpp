@@ -0,0 +1,327 @@
+#include "dedup.h"
+#include "board.h"
+#include "extsort.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace dedup {
+
+namespace {
+    constexpr int state_at = packed_position::state_at;
+
+    // a position with a piece number or -1 on every square
+    struct layout {
+        array<signed char, 64> squares;
+        int state, ep;
+    };
+
+    layout unpack(const packed_position &p) {
+        layout res;
+        res.squares.fill(-1);
+        int n = 0;
+        for(uint64_t left = p.occupancy(); left; left &= left - 1)
+            res.squares[countr_zero(left)] = p.piece(n++);
+        res.state = p.bytes[state_at];
+        res.ep = p.bytes[state_at + 1];
+        return res;
+    }
+
+    // the counters and the label are taken from the original
+    packed_position repack(const layout &l, const packed_position &original) {
+        packed_position res = original;
+        uint64_t occupied = 0;
+        for(int square=0; square<64; square++)
+            if(l.squares[square] >= 0)
+                occupied |= 1ULL << square;
+        for(int i=0; i<8; i++)
+            res.bytes[i] = occupied >> (8 * i);
+        fill(res.bytes.begin() + packed_position::pieces_at, res.bytes.begin() + state_at, 0);
+        int n = 0;
+        for(uint64_t left = occupied; left; left &= left - 1, n++)
+            res.bytes[packed_position::pieces_at + n / 2] |= l.squares[countr_zero(left)] << (4 * (n % 2));
+        res.bytes[state_at] = l.state;
+        res.bytes[state_at + 1] = l.ep;
+        return res;
+    }
+
+    // files mirrored by bit 0, ranks by bit 1, the board transposed by bit 2
+    int transform(int square, int symmetry) {
+        int row = square / 8, col = square % 8;
+        if(symmetry & 1) col = 7 - col;
+        if(symmetry & 2) row = 7 - row;
+        if(symmetry & 4) swap(row, col);
+        return row * 8 + col;
+    }
+
+    layout flip_colours(const layout &l) {
+        layout res;
+        for(int square=0; square<64; square++) {
+            int piece = l.squares[square ^ 56];
+            res.squares[square] = piece < 0 ? -1 : (piece + 6) % 12;
+        }
+        int castling = l.state >> 1;
+        castling = (castling & 3) << 2 | (castling >> 2 & 3);
+        res.state = ((l.state & 1) ^ 1) | castling << 1;
+        res.ep = l.ep == packed_position::no_square ? l.ep : l.ep ^ 56;
+        return res;
+    }
+
+    uint64_t mix(uint64_t x) {
+        x ^= x >> 30;
+        x *= 0xBF58476D1CE4E5B9ULL;
+        x ^= x >> 27;
+        x *= 0x94D049BB133111EBULL;
+        return x ^ x >> 31;
+    }
+
+    uint64_t load(const packed_position &p, int at) {
+        uint64_t res;
+        memcpy(&res, p.bytes.data() + at, 8);
+        return res;
+    }
+
+    struct keyed {
+        uint64_t key;
+        packed_position position;
+    };
+
+    // linear probing over a power of two table, 0 marks an empty slot. The
+    // table doubles at half load until it reaches its largest size
+    class key_set {
+        public:
+            explicit key_set(size_t largest) : slots(min<size_t>(largest, 1 << 16), 0), count(0), largest(largest) {}
+
+            bool insert(uint64_t key) {
+                if(2 * count >= slots.size() && slots.size() < largest)
+                    grow();
+                if(!place(slots, key))
+                    return false;
+                count++;
+                return true;
+            }
+
+            void clear() {
+                fill(slots.begin(), slots.end(), 0);
+                count = 0;
+            }
+
+        private:
+            vector<uint64_t> slots;
+            size_t count;
+            size_t largest;
+
+            static bool place(vector<uint64_t> &table, uint64_t key) {
+                size_t mask = table.size() - 1;
+                for(size_t i=key & mask; ; i=(i + 1) & mask) {
+                    if(table[i] == key)
+                        return false;
+                    if(!table[i]) {
+                        table[i] = key;
+                        return true;
+                    }
+                }
+            }
+
+            void grow() {
+                vector<uint64_t> bigger(2 * slots.size(), 0);
+                for(uint64_t key : slots)
+                    if(key)
+                        place(bigger, key);
+                slots.swap(bigger);
+            }
+    };
+
+    // packed position files are told apart from FEN text by their magic
+    bool is_packed_file(const string &path) {
+        char head[8] = {};
+        ifstream in(path, ios::binary);
+        in.read(head, 8);
+        return in && !memcmp(head, "PACKPOS1", 8);
+    }
+}
+
+packed_position canonical(const packed_position &p, const options &opts) {
+    bool flip = opts.flip && (p.bytes[state_at] & 1);
+    uint64_t occupied = p.occupancy();
+    bool pawnless = true;
+    for(int n=0; n<popcount(occupied); n++)
+        pawnless &= p.piece(n) % 6 != 0;
+    bool mirror = opts.mirror && pawnless && !(p.bytes[state_at] >> 1);
+    if(!flip && !mirror)
+        return p;
+
+    layout l = unpack(p);
+    if(flip)
+        l = flip_colours(l);
+    packed_position res = repack(l, p);
+    if(flip && p.has_label())
+        res.set_label(-p.result(), p.score());
+    if(!mirror)
+        return res;
+
+    // the symmetry giving the smallest key stands for all of them
+    packed_position best = res;
+    uint64_t best_key = key(res);
+    for(int symmetry=1; symmetry<8; symmetry++) {
+        layout t = l;
+        for(int square=0; square<64; square++)
+            t.squares[transform(square, symmetry)] = l.squares[square];
+        packed_position candidate = repack(t, res);
+        uint64_t candidate_key = key(candidate);
+        if(candidate_key < best_key) {
+            best = candidate;
+            best_key = candidate_key;
+        }
+    }
+    return best;
+}
+
+uint64_t key(const packed_position &p) {
+    // occupancy, pieces, then the side to move, castling and en passant bytes
+    uint64_t state = p.bytes[state_at] | p.bytes[state_at + 1] << 8;
+    uint64_t res = mix(load(p, 0) ^ mix(load(p, 8) ^ mix(load(p, 16) ^ mix(state + 0x9E3779B97F4A7C15ULL))));
+    return res ? res : 1;
+}
+
+bool run(const vector<string> &inputs, const string &output, const options &opts, stats &res) {
+    auto start = chrono::steady_clock::now();
+    res = {};
+
+    // the set at its largest, the pending records filling it to half load and
+    // the half sized table it grows out of must all fit the budget together
+    constexpr size_t slot_bytes = sizeof(uint64_t) + sizeof(uint64_t) / 2 + sizeof(keyed) / 2;
+    size_t slots = max<size_t>(2048, bit_floor(opts.memory_bytes / slot_bytes));
+    size_t limit = slots / 2;
+    key_set seen(slots);
+    vector<keyed> pending;
+    pending.reserve(limit);
+    auto by_key = [](const keyed &a, const keyed &b) { return a.key < b.key; };
+    extsort::sorter<keyed, decltype(by_key)> runs(output, opts.memory_bytes / sizeof(keyed), by_key);
+    bool ok = true;
+
+    auto spill = [&]() {
+        ok = runs.spill(pending) && ok;
+        seen.clear();
+    };
+    auto add = [&](const packed_position &p) {
+        res.inputs++;
+        packed_position c = canonical(p, opts);
+        uint64_t k = key(c);
+        if(!seen.insert(k))
+            return;
+        pending.push_back({k, c});
+        if(pending.size() == limit)
+            spill();
+    };
+
+    // a bad record or line is counted and left out, the first few are named
+    auto skip = [&](const string &path, size_t at, const string &what) {
+        if(res.skipped++ < 10)
+            cerr << "dedup: skipping " << path << ':' << at << (what.empty() ? "" : ": ") << what << '\n';
+    };
+    for(auto &path : inputs) {
+        if(is_packed_file(path)) {
+            packed::dataset positions;
+            if(!positions.open(path))
+                return false;
+            for(size_t i=0; i<positions.size(); i++) {
+                if(packed::is_valid(positions[i])) add(positions[i]);
+                else skip(path, i, "");
+            }
+        } else {
+            ifstream in(path);
+            if(!in) {
+                cerr << "dedup: cannot open " << path << '\n';
+                return false;
+            }
+            size_t line_number = 0;
+            for(string line; getline(in, line); ) {
+                line_number++;
+                while(!line.empty() && (line.back() == '\r' || line.back() == ' '))
+                    line.pop_back();
+                if(line.empty())
+                    continue;
+                packed_position p;
+                if(board::is_valid_fen(line) && packed::is_valid(p = board(line).pack())) add(p);
+                else skip(path, line_number, line);
+            }
+        }
+    }
+
+    packed::dataset_writer out;
+    if(!out.open(output)) {
+        cerr << "dedup: cannot write " << output << '\n';
+        return false;
+    }
+    if(!runs.runs()) {
+        for(auto &k : pending)
+            out.add(k.position);
+        res.unique = pending.size();
+        res.runs = 1;
+    } else {
+        if(!pending.empty())
+            spill();
+        res.runs = runs.runs();
+        pending = vector<keyed>();
+        seen = key_set(1);
+
+        // a key in several runs is written once, from the earliest run
+        uint64_t last = 0;
+        ok = runs.merge([&](const keyed &k) {
+            if(k.key != last) {
+                out.add(k.position);
+                res.unique++;
+                last = k.key;
+            }
+        }) && ok;
+    }
+
+    if(!out.close() || !ok) {
+        cerr << "dedup: cannot write " << output << '\n';
+        return false;
+    }
+    res.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+int dedup_command(const vector<string> &args) {
+    options opts;
+    string output;
+    vector<string> inputs;
+    const char *usage = "usage: chess dedup <position file> [--memory mb] [--flip] [--mirror] <fen or position file>...\n";
+    try {
+        for(size_t i=0; i<args.size(); i++) {
+            if(args[i] == "--memory" && i + 1 < args.size()) opts.memory_bytes = stoull(args[++i]) << 20;
+            else if(args[i] == "--flip") opts.flip = true;
+            else if(args[i] == "--mirror") opts.mirror = true;
+            else if(output.empty()) output = args[i];
+            else inputs.push_back(args[i]);
+        }
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(inputs.empty()) {
+        cerr << usage;
+        return 1;
+    }
+
+    stats s;
+    if(!run(inputs, output, opts, s))
+        return 1;
+    cout << "inputs: " << s.inputs << ", skipped: " << s.skipped << ", unique: " << s.unique << " ("
+         << 100.0 * s.unique / max<size_t>(s.inputs, 1) << "%), sorted runs: " << s.runs << '\n'
+         << "time: " << s.seconds << " s, " << s.inputs / s.seconds / 1e6 << " M positions/s\n";
+    return 0;
+}
+
+}
@@ -0,0 +1,798 @@
+#include "egtb.h"
+#include "attacks.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace egtb {
+
+namespace {
+    // one byte per position: 0 draw (or not decided yet), odd n a win in n plies,
+    // even n a loss in n - 2 plies, so mated is 2
+    enum : unsigned char { unknown = 0, illegal = 255 };
+    constexpr int max_plies = 252;
+
+    unsigned char win_in(int plies) { return plies; }
+    unsigned char loss_in(int plies) { return plies + 2; }
+    bool is_win(unsigned char v) { return v != illegal && (v & 1); }
+    bool is_loss(unsigned char v) { return v != unknown && v != illegal && !(v & 1); }
+    int plies_of(unsigned char v) { return v & 1 ? v : v - 2; }
+
+    const char magic[4] = {'E', 'G', 'T', 'B'};
+    constexpr uint32_t version = 1;
+    constexpr size_t header_bytes = 40;
+
+    int piece_value(int piece) {
+        static const int values[] = {1, 3, 3, 5, 9};
+        return values[piece];
+    }
+
+    // piece types as in the board, 1 knight up to 5 king
+    uint64_t piece_attacks(int type, int square, uint64_t occupied) {
+        switch(type) {
+            case 1: return attacks::knight(square);
+            case 2: return attacks::bishop(square, occupied);
+            case 3: return attacks::rook(square, occupied);
+            case 4: return attacks::queen(square, occupied);
+            default: return attacks::king(square);
+        }
+    }
+
+    int transform(int square, int t) {
+        if(t & 1) square ^= 7;
+        if(t & 2) square ^= 56;
+        if(t & 4) square = (square >> 3) | ((square & 7) << 3);
+        return square;
+    }
+
+    // the symmetry that takes the white king into a1-d1-d4 and, with the white
+    // king on the diagonal, the black king on or below it
+    int canonical_transform(int white_king, int black_king) {
+        int t = 0;
+        if(white_king % 8 > 3) t |= 1;
+        if(white_king / 8 > 3) t |= 2;
+        int king = transform(white_king, t);
+        int other = transform(black_king, t);
+        if(king / 8 > king % 8 || (king / 8 == king % 8 && other / 8 > other % 8))
+            t |= 4;
+        return t;
+    }
+
+    struct king_pairs {
+        array<int, 64 * 64> index;
+        vector<pair<int, int>> squares;
+
+        king_pairs() {
+            index.fill(-1);
+            for(int white_king=0; white_king<64; white_king++)
+                for(int black_king=0; black_king<64; black_king++)
+                    if(white_king != black_king && !(attacks::king(white_king) >> black_king & 1) &&
+                       canonical_transform(white_king, black_king) == 0) {
+                        index[white_king * 64 + black_king] = squares.size();
+                        squares.push_back({white_king, black_king});
+                    }
+        }
+    };
+
+    const king_pairs kings;
+
+    struct placement {
+        array<int, max_pieces> square;
+        int side_to_move;
+    };
+
+    // slot 0 is the white king, slot 1 the black king, then white's pieces and black's
+    struct layout {
+        material mat;
+        int n;
+        array<int, max_pieces> type;
+        array<int, max_pieces> colour;
+        array<array<int, 5>, 2> count; // per colour and piece type, the kings left out
+        size_t per_side;
+
+        explicit layout(const material &m) : mat(m), n(m.pieces()), type{}, colour{}, count{} {
+            type[0] = type[1] = 5;
+            colour[1] = 1;
+            int slot = 2;
+            for(int piece : mat.white)
+                type[slot++] = piece;
+            for(int piece : mat.black) {
+                colour[slot] = 1;
+                type[slot++] = piece;
+            }
+            per_side = kings.squares.size();
+            for(int i=2; i<n; i++) {
+                per_side *= 64;
+                count[colour[i]][type[i]]++;
+            }
+        }
+
+        size_t entries() const { return 2 * per_side; }
+
+        size_t index(const placement &p) const {
+            return index(p, canonical_transform(p.square[0], p.square[1]));
+        }
+
+        size_t index(const placement &p, int t) const {
+            size_t res = kings.index[transform(p.square[0], t) * 64 + transform(p.square[1], t)];
+            for(int i=2; i<n; i++)
+                res = res * 64 + transform(p.square[i], t);
+            return p.side_to_move * per_side + res;
+        }
+
+        // with both kings on the long diagonal a position and its mirror image
+        // across it are stored apart, this is the index of the other one
+        size_t twin(const placement &p) const {
+            int t = canonical_transform(p.square[0], p.square[1]);
+            int white_king = transform(p.square[0], t), black_king = transform(p.square[1], t);
+            if(white_king / 8 != white_king % 8 || black_king / 8 != black_king % 8)
+                return index(p, t);
+            return index(p, t ^ 4);
+        }
+
+        placement decode(size_t idx) const {
+            placement p{};
+            p.side_to_move = idx / per_side;
+            idx %= per_side;
+            for(int i=n-1; i>=2; i--, idx /= 64)
+                p.square[i] = idx % 64;
+            tie(p.square[0], p.square[1]) = kings.squares[idx];
+            return p;
+        }
+
+        uint64_t occupied(const placement &p) const {
+            uint64_t res = 0;
+            for(int i=0; i<n; i++)
+                res |= 1ULL << p.square[i];
+            return res;
+        }
+
+        bool attacked(const placement &p, int square, int by, uint64_t occupied, int skip = -1) const {
+            for(int i=0; i<n; i++)
+                if(colour[i] == by && i != skip && (piece_attacks(type[i], p.square[i], occupied) >> square & 1))
+                    return true;
+            return false;
+        }
+
+        bool in_check(const placement &p) const {
+            return attacked(p, p.square[p.side_to_move], !p.side_to_move, occupied(p));
+        }
+
+        // no two pieces on a square and the side that just moved is not in check
+        bool fits(const placement &p) const {
+            uint64_t occ = occupied(p);
+            return popcount(occ) == n && !attacked(p, p.square[!p.side_to_move], p.side_to_move, occ);
+        }
+    };
+
+    // maps a pawnless board onto the slots of a layout, false if it does not fit.
+    // Counts the pieces rather than building a material, probes stay off the heap
+    bool placement_from_board(const board &pos, const layout &lay, placement &res) {
+        if(pos.castling_rights())
+            return false;
+        auto &pieces = pos.pieces();
+        if(pieces[0] | pieces[6])
+            return false;
+
+        // the layout has the stronger side white, as material::canonical leaves it
+        array<array<int, 5>, 2> count{};
+        for(int piece=1; piece<=4; piece++) {
+            count[0][piece] = popcount((uint64_t)pieces[piece]);
+            count[1][piece] = popcount((uint64_t)pieces[piece + 6]);
+        }
+        bool swapped = count != lay.count;
+        if(swapped && (count[0] != lay.count[1] || count[1] != lay.count[0]))
+            return false;
+
+        array<bool, max_pieces> used{};
+        for(int piece=1; piece<12; piece++)
+            for(uint64_t left = pieces[piece]; left; left &= left - 1) {
+                int colour = (piece >= 6) != swapped;
+                int type = piece % 6;
+                int slot = 0;
+                while(used[slot] || lay.colour[slot] != colour || lay.type[slot] != type)
+                    slot++;
+                used[slot] = true;
+                res.square[slot] = countr_zero(left);
+            }
+        res.side_to_move = pos.side_to_move() != swapped;
+        return true;
+    }
+
+    template<class F>
+    void parallel_for(size_t count, int threads, F &&body) {
+        const size_t chunk = 1 << 14;
+        atomic<size_t> next{0};
+        auto worker = [&]() {
+            for(size_t begin; (begin = next.fetch_add(chunk)) < count; )
+                body(begin, min(count, begin + chunk));
+        };
+        vector<thread> pool;
+        for(int i=1; i<threads; i++)
+            pool.emplace_back(worker);
+        worker();
+        for(auto &t : pool)
+            t.join();
+    }
+
+    void raise(atomic<int> &target, int value) {
+        for(int seen = target.load(); seen < value && !target.compare_exchange_weak(seen, value); );
+    }
+
+    class generator;
+    using table_cache = map<string, unique_ptr<generator>>;
+
+    class generator {
+        public:
+            layout lay;
+            vector<unsigned char> values;
+            int passes = 0;
+
+            generator(const material &m, int threads, table_cache &cache);
+
+            unsigned char get(size_t idx) { return atomic_ref<unsigned char>(values[idx]).load(memory_order_relaxed); }
+            void set(size_t idx, unsigned char v) { atomic_ref<unsigned char>(values[idx]).store(v, memory_order_relaxed); }
+
+            // the value of a child after a capture, looked up in the smaller table
+            unsigned char capture_value(const placement &child, int taken);
+
+            // calls visit(value of the child, was it a capture) for each legal move until
+            // visit returns false, returns the number of moves visited
+            template<class F> int for_each_move(const placement &p, F &&visit);
+
+            // calls visit(index) for each position the last move could have come from
+            template<class F> void for_each_unmove(const placement &p, F &&visit);
+
+        private:
+            struct capture_target {
+                generator *sub;
+                bool swapped;
+                array<int, max_pieces> slot;
+            };
+            array<capture_target, max_pieces> captures{};
+
+            void classify_initial(int threads, atomic<int> &deepest);
+    };
+
+    generator *build(const material &m, int threads, table_cache &cache) {
+        bool swapped;
+        material key = m.canonical(swapped);
+        auto &slot = cache[key.name()];
+        if(!slot)
+            slot = make_unique<generator>(key, threads, cache);
+        return slot.get();
+    }
+
+    unsigned char generator::capture_value(const placement &child, int taken) {
+        capture_target &target = captures[taken];
+        placement sub{};
+        for(int i=0; i<lay.n; i++)
+            if(i != taken)
+                sub.square[target.slot[i]] = child.square[i];
+        sub.side_to_move = child.side_to_move != target.swapped;
+        return target.sub->values[target.sub->lay.index(sub)];
+    }
+
+    template<class F>
+    int generator::for_each_move(const placement &p, F &&visit) {
+        uint64_t occ = lay.occupied(p), own = 0;
+        for(int i=0; i<lay.n; i++)
+            if(lay.colour[i] == p.side_to_move)
+                own |= 1ULL << p.square[i];
+
+        int count = 0;
+        for(int i=0; i<lay.n; i++) {
+            if(lay.colour[i] != p.side_to_move)
+                continue;
+            int from = p.square[i];
+            for(uint64_t targets = piece_attacks(lay.type[i], from, occ) & ~own; targets; targets &= targets - 1) {
+                int to = countr_zero(targets);
+                int taken = -1;
+                for(int j=2; j<lay.n; j++)
+                    if(p.square[j] == to)
+                        taken = j;
+
+                placement child = p;
+                child.square[i] = to;
+                child.side_to_move = !p.side_to_move;
+                uint64_t child_occ = occ ^ (1ULL << from) ^ (taken < 0 ? 1ULL << to : 0);
+                if(lay.attacked(child, child.square[p.side_to_move], child.side_to_move, child_occ, taken))
+                    continue;
+
+                count++;
+                unsigned char v = taken < 0 ? get(lay.index(child)) : capture_value(child, taken);
+                if(!visit(v, taken >= 0))
+                    return count;
+            }
+        }
+        return count;
+    }
+
+    template<class F>
+    void generator::for_each_unmove(const placement &p, F &&visit) {
+        uint64_t occ = lay.occupied(p);
+        for(int i=0; i<lay.n; i++) {
+            if(lay.colour[i] == p.side_to_move)
+                continue;
+            // pawnless pieces retrace their moves, captures came from the smaller tables
+            uint64_t origins = piece_attacks(lay.type[i], p.square[i], occ) & ~occ;
+            if(i < 2)
+                origins &= ~attacks::king(p.square[!i]);
+            for(; origins; origins &= origins - 1) {
+                placement before = p;
+                before.square[i] = countr_zero(origins);
+                before.side_to_move = !p.side_to_move;
+                size_t idx = lay.index(before), other = lay.twin(before);
+                visit(idx);
+                if(other != idx)
+                    visit(other);
+            }
+        }
+    }
+
+    generator::generator(const material &m, int threads, table_cache &cache) : lay(m), values(lay.entries()) {
+        for(int taken=2; taken<lay.n; taken++) {
+            material rest = lay.mat;
+            auto &pieces = lay.colour[taken] ? rest.black : rest.white;
+            pieces.erase(pieces.begin() + (taken - 2 - (lay.colour[taken] ? lay.mat.white.size() : 0)));
+
+            capture_target &target = captures[taken];
+            target.sub = build(rest, threads, cache);
+            rest.canonical(target.swapped);
+
+            array<bool, max_pieces> used{};
+            for(int i=0; i<lay.n; i++) {
+                if(i == taken)
+                    continue;
+                int colour = lay.colour[i] != target.swapped;
+                int slot = 0;
+                while(used[slot] || target.sub->lay.colour[slot] != colour || target.sub->lay.type[slot] != lay.type[i])
+                    slot++;
+                used[slot] = true;
+                target.slot[i] = slot;
+            }
+        }
+
+        atomic<int> deepest{0};
+        classify_initial(threads, deepest);
+
+        // wins one ply further than the losses of the level before, then the losses
+        // of positions whose last move has just been refuted
+        for(int ply=0; ply<=deepest.load(); ply+=2, passes++) {
+            if(ply + 1 > max_plies) {
+                cerr << "egtb: " << lay.mat.name() << " has mates longer than " << max_plies << " plies\n";
+                break;
+            }
+
+            parallel_for(values.size(), threads, [&](size_t begin, size_t end) {
+                for(size_t idx=begin; idx<end; idx++) {
+                    if(get(idx) != loss_in(ply))
+                        continue;
+                    for_each_unmove(lay.decode(idx), [&](size_t before) {
+                        unsigned char v = get(before);
+                        if(v == unknown || (is_win(v) && plies_of(v) > ply + 1)) {
+                            set(before, win_in(ply + 1));
+                            raise(deepest, ply + 1);
+                        }
+                    });
+                }
+            });
+
+            parallel_for(values.size(), threads, [&](size_t begin, size_t end) {
+                for(size_t idx=begin; idx<end; idx++) {
+                    if(get(idx) != win_in(ply + 1))
+                        continue;
+                    for_each_unmove(lay.decode(idx), [&](size_t before) {
+                        if(get(before) != unknown)
+                            return;
+                        // every move has to lose, quiet ones to wins that are already final
+                        int longest = 0;
+                        bool lost = true;
+                        for_each_move(lay.decode(before), [&](unsigned char v, bool capture) {
+                            lost = is_win(v) && (capture || plies_of(v) <= ply + 1);
+                            longest = max(longest, plies_of(v));
+                            return lost;
+                        });
+                        if(lost && longest + 1 <= max_plies) {
+                            set(before, loss_in(longest + 1));
+                            raise(deepest, longest + 1);
+                        }
+                    });
+                }
+            });
+        }
+    }
+
+    void generator::classify_initial(int threads, atomic<int> &deepest) {
+        parallel_for(values.size(), threads, [&](size_t begin, size_t end) {
+            for(size_t idx=begin; idx<end; idx++) {
+                placement p = lay.decode(idx);
+                if(!lay.fits(p)) {
+                    set(idx, illegal);
+                    continue;
+                }
+
+                // captures are decided already, quiet moves are left to the retrograde passes
+                int best_win = max_plies + 1, longest_loss = 0;
+                bool quiet = false, captures_lose = true;
+                int moves = for_each_move(p, [&](unsigned char v, bool capture) {
+                    if(!capture) {
+                        quiet = true;
+                        return true;
+                    }
+                    if(is_loss(v))
+                        best_win = min(best_win, plies_of(v) + 1);
+                    captures_lose &= is_win(v);
+                    longest_loss = max(longest_loss, plies_of(v) + 1);
+                    return true;
+                });
+
+                unsigned char v = unknown;
+                if(!moves)
+                    v = lay.in_check(p) ? loss_in(0) : (unsigned char)unknown;
+                else if(best_win <= max_plies)
+                    v = win_in(best_win);
+                else if(!quiet && captures_lose && longest_loss <= max_plies)
+                    v = loss_in(longest_loss);
+                if(v != unknown) {
+                    set(idx, v);
+                    raise(deepest, plies_of(v));
+                }
+            }
+        });
+    }
+
+    string fen_of(const layout &lay, const placement &p) {
+        const string letters = "PNBRQKpnbrqk";
+        array<char, 64> squares;
+        squares.fill(0);
+        for(int i=0; i<lay.n; i++)
+            squares[p.square[i]] = letters[lay.type[i] + 6 * lay.colour[i]];
+
+        string res;
+        for(int row=7; row>=0; row--) {
+            int empty = 0;
+            for(int column=0; column<8; column++) {
+                char c = squares[row * 8 + column];
+                if(!c) {
+                    empty++;
+                    continue;
+                }
+                if(empty)
+                    res += char('0' + empty);
+                empty = 0;
+                res += c;
+            }
+            if(empty)
+                res += char('0' + empty);
+            if(row)
+                res += '/';
+        }
+        return res + (p.side_to_move ? " b" : " w") + " - - 0 1";
+    }
+
+    string describe(unsigned char v) {
+        if(is_win(v)) return "win in " + to_string(plies_of(v)) + " plies";
+        if(is_loss(v)) return "loss in " + to_string(plies_of(v)) + " plies";
+        return "draw";
+    }
+
+    void put32(ofstream &out, uint32_t v) {
+        for(int i=0; i<4; i++)
+            out.put(char(v >> (8 * i)));
+    }
+
+    uint64_t get_le(const unsigned char *p, int bytes) {
+        uint64_t res = 0;
+        for(int i=bytes-1; i>=0; i--)
+            res = res << 8 | p[i];
+        return res;
+    }
+
+    int default_threads(int threads) {
+        return threads > 0 ? threads : max(1u, thread::hardware_concurrency());
+    }
+}
+
+bool material::parse(const string &name, material &res) {
+    size_t split = name.find('v');
+    if(split == string::npos || name.size() < 3 || name[0] != 'K' || split + 1 >= name.size() || name[split + 1] != 'K')
+        return false;
+
+    res = material();
+    const string letters = "NBRQ";
+    for(size_t i=1; i<name.size(); i++) {
+        if(i == split || i == split + 1)
+            continue;
+        size_t piece = letters.find(name[i]);
+        if(piece == string::npos)
+            return false;
+        (i < split ? res.white : res.black).push_back(piece + 1);
+    }
+    return res.pieces() <= max_pieces;
+}
+
+string material::name() const {
+    const string letters = " NBRQ";
+    string res = "K";
+    for(int piece : white)
+        res += letters[piece];
+    res += "vK";
+    for(int piece : black)
+        res += letters[piece];
+    return res;
+}
+
+material material::canonical(bool &swapped) const {
+    material res = *this;
+    sort(res.white.rbegin(), res.white.rend());
+    sort(res.black.rbegin(), res.black.rend());
+
+    auto strength = [](const vector<int> &pieces) {
+        int sum = 0;
+        for(int piece : pieces)
+            sum += piece_value(piece);
+        return make_pair(sum, pieces);
+    };
+    swapped = strength(res.black) > strength(res.white);
+    if(swapped)
+        swap(res.white, res.black);
+    return res;
+}
+
+bool generate(const string &name, const string &path, int threads, generation_stats *stats) {
+    material m;
+    if(!material::parse(name, m)) {
+        cerr << "egtb: " << name << " is not a pawnless material signature of up to " << max_pieces << " pieces\n";
+        return false;
+    }
+    threads = default_threads(threads);
+
+    auto start = chrono::steady_clock::now();
+    table_cache cache;
+    generator *gen = build(m, threads, cache);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    ofstream out(path, ios::binary);
+    string signature = gen->lay.mat.name();
+    out.write(magic, 4);
+    put32(out, version);
+    char padded[16] = {};
+    signature.copy(padded, sizeof(padded) - 1);
+    out.write(padded, sizeof(padded));
+    put32(out, uint32_t(gen->values.size()));
+    put32(out, uint32_t(uint64_t(gen->values.size()) >> 32));
+    int longest = 0;
+    for(unsigned char v : gen->values)
+        if(v != illegal && v != unknown)
+            longest = max(longest, plies_of(v));
+    put32(out, longest);
+    put32(out, 0);
+    out.write((const char *)gen->values.data(), gen->values.size());
+    if(!out) {
+        cerr << "egtb: cannot write " << path << '\n';
+        return false;
+    }
+
+    if(stats) {
+        *stats = generation_stats{gen->values.size(), 0, 0, 0, 0, longest, gen->passes, seconds, header_bytes + gen->values.size()};
+        for(unsigned char v : gen->values) {
+            if(v == illegal)
+                continue;
+            stats->legal++;
+            if(is_win(v)) stats->wins++;
+            else if(is_loss(v)) stats->losses++;
+            else stats->draws++;
+        }
+    }
+    return true;
+}
+
+struct table::shape : layout {
+    using layout::layout;
+};
+
+table::table() : data(nullptr), values(nullptr), length(0) {}
+
+table::~table() {
+    close();
+}
+
+bool table::open(const string &path) {
+    close();
+#ifdef _WIN32
+    cerr << "egtb: memory mapped tables are not supported on this platform\n";
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        cerr << "egtb: cannot open " << path << '\n';
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1 || size_t(info.st_size) < header_bytes) {
+        cerr << "egtb: " << path << " is not a table\n";
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        cerr << "egtb: cannot map " << path << '\n';
+        return false;
+    }
+    madvise(mapped, info.st_size, MADV_RANDOM);
+
+    data = (const unsigned char *)mapped;
+    length = info.st_size;
+
+    material m;
+    string stored((const char *)data + 8, strnlen((const char *)data + 8, 16));
+    bool swapped;
+    if(memcmp(data, magic, 4) || get_le(data + 4, 4) != version || !material::parse(stored, m) ||
+       m.canonical(swapped).name() != stored || get_le(data + 24, 8) != layout(m).entries() ||
+       length != header_bytes + layout(m).entries()) {
+        cerr << "egtb: " << path << " is not a table\n";
+        close();
+        return false;
+    }
+    signature = stored;
+    values = data + header_bytes;
+    lay = make_unique<shape>(m);
+    return true;
+#endif
+}
+
+void table::close() {
+#ifndef _WIN32
+    if(data)
+        munmap((void *)data, length);
+#endif
+    data = values = nullptr;
+    length = 0;
+    signature.clear();
+    lay.reset();
+}
+
+bool table::probe(const board &pos, result &res) const {
+    if(!values)
+        return false;
+    placement p;
+    if(!placement_from_board(pos, *lay, p))
+        return false;
+    unsigned char v = values[lay->index(p)];
+    if(v == illegal)
+        return false;
+    res.wdl = is_win(v) ? 1 : is_loss(v) ? -1 : 0;
+    res.plies = v == unknown ? 0 : plies_of(v);
+    return true;
+}
+
+int egtb_command(const vector<string> &args) {
+    string mode = args.empty() ? "" : args[0];
+    const char *usage = "usage: chess egtb generate <material> <file> [threads] | probe <file> <fen>"
+                        " | verify <material> [samples] [threads]\n";
+
+    if(mode == "generate" && args.size() > 2) {
+        int threads;
+        try {
+            threads = args.size() > 3 ? stoi(args[3]) : 0;
+        } catch(const logic_error &) {
+            cerr << usage;
+            return 1;
+        }
+        generation_stats stats;
+        if(!generate(args[1], args[2], threads, &stats))
+            return 1;
+        cout << "positions: " << stats.positions << ", legal: " << stats.legal << '\n'
+             << "wins: " << stats.wins << ", draws: " << stats.draws << ", losses: " << stats.losses << '\n'
+             << "longest mate: " << stats.longest_mate << " plies, passes: " << stats.passes << '\n'
+             << "time: " << stats.seconds << " s, " << stats.positions / stats.seconds / 1e6
+             << " M positions/s including the smaller tables\n"
+             << "file: " << stats.file_bytes << " bytes\n";
+        return 0;
+    }
+
+    if(mode == "probe" && args.size() > 2) {
+        table tb;
+        if(!tb.open(args[1]))
+            return 1;
+        result res;
+        if(!tb.probe(board(args[2]), res)) {
+            cerr << "egtb: the position is not in " << tb.name() << '\n';
+            return 1;
+        }
+        cout << (res.wdl > 0 ? "win" : res.wdl < 0 ? "loss" : "draw");
+        if(res.wdl)
+            cout << " in " << res.plies << " plies";
+        cout << '\n';
+        return 0;
+    }
+
+    // replays sampled positions on the board and checks each value against its children
+    if(mode == "verify" && args.size() > 1) {
+        material m;
+        if(!material::parse(args[1], m)) {
+            cerr << "egtb: " << args[1] << " is not a pawnless material signature\n";
+            return 1;
+        }
+        int samples, threads;
+        try {
+            samples = args.size() > 2 ? stoi(args[2]) : 10000;
+            threads = args.size() > 3 ? stoi(args[3]) : 0;
+        } catch(const logic_error &) {
+            cerr << usage;
+            return 1;
+        }
+        table_cache cache;
+        generator *gen = build(m, default_threads(threads), cache);
+
+        auto value_of = [&](const board &pos) -> unsigned char {
+            for(auto &[name, sub] : cache) {
+                placement p;
+                if(placement_from_board(pos, sub->lay, p))
+                    return sub->values[sub->lay.index(p)];
+            }
+            return unknown;
+        };
+
+        mt19937_64 rng(1);
+        int checked = 0, mismatches = 0;
+        while(checked < samples) {
+            size_t idx = rng() % gen->values.size();
+            if(gen->values[idx] == illegal)
+                continue;
+            checked++;
+
+            board pos(fen_of(gen->lay, gen->lay.decode(idx)));
+            auto moves = pos.gen_moves();
+            int best_win = max_plies + 1, longest_loss = -1;
+            bool draw = false;
+            for(; moves.size(); moves.pop()) {
+                board child(pos);
+                child.make_move(moves.top());
+                unsigned char v = value_of(child);
+                if(is_loss(v)) best_win = min(best_win, plies_of(v) + 1);
+                else if(is_win(v)) longest_loss = max(longest_loss, plies_of(v) + 1);
+                else draw = true;
+            }
+
+            unsigned char expected = best_win <= max_plies ? win_in(best_win)
+                                   : draw ? (unsigned char)unknown
+                                   : longest_loss >= 0 ? loss_in(longest_loss)
+                                   : pos.in_check() ? loss_in(0) : (unsigned char)unknown;
+            if(expected != gen->values[idx]) {
+                mismatches++;
+                cerr << fen_of(gen->lay, gen->lay.decode(idx)) << ": stored " << describe(gen->values[idx])
+                     << ", moves give " << describe(expected) << '\n';
+            }
+        }
+        cout << "checked: " << checked << ", mismatches: " << mismatches << '\n';
+        return mismatches ? 1 : 0;
+    }
+
+    cerr << usage;
+    return 1;
+}
+
+}
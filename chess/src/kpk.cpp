@@ -0,0 +1,379 @@
+#include "kpk.h"
+#include "attacks.h"
+#include "board_utils.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#ifdef CHESS_KPK_EMBED
+#include CHESS_KPK_EMBED
+#endif
+
+using namespace std;
+using namespace board_utils;
+
+namespace kpk {
+
+namespace {
+    // results combine as flags while classifying
+    enum result : unsigned char { invalid = 0, unknown = 1, draw = 2, win = 4 };
+
+    array<unsigned char, positions / 8> table;
+    // set once the table is filled, probes from any thread may read it from then on
+    atomic<bool> table_ready{false};
+
+    unsigned long long pawn_attacks(int square) {
+        auto [row, column] = gen_coordinate(square);
+        unsigned long long res = 0;
+        for(int side=-1; side<2; side+=2)
+            if(coordinate_is_legal({row + 1, column + side}))
+                res |= 1ULL << ind_from_coordinate({row + 1, column + side});
+        return res;
+    }
+
+    // pawn files a-d and ranks 2-7, rank 7 first
+    int index(int side_to_move, int black_king, int white_king, int pawn) {
+        return white_king | (black_king << 6) | (side_to_move << 12) | ((pawn % 8) << 13) | ((6 - pawn / 8) << 15);
+    }
+
+    struct position {
+        int white_king, black_king, side_to_move, pawn;
+
+        explicit position(int idx)
+            : white_king(idx & 63),
+              black_king((idx >> 6) & 63),
+              side_to_move((idx >> 12) & 1),
+              pawn(ind_from_coordinate({6 - (idx >> 15), (idx >> 13) & 3}))
+        {
+        }
+
+        result initial() const {
+            unsigned long long white_covers = attacks::king(white_king) | pawn_attacks(pawn);
+            unsigned long long black_moves = attacks::king(black_king) & ~white_covers;
+
+            // two pieces on one square or a king that could be taken
+            if((attacks::king(white_king) >> black_king & 1) || white_king == black_king ||
+               white_king == pawn || black_king == pawn ||
+               (side_to_move == 0 && (pawn_attacks(pawn) >> black_king & 1)))
+                return invalid;
+
+            // the pawn promotes and the new queen cannot be taken
+            int stop = pawn + 8;
+            if(side_to_move == 0 && pawn / 8 == 6 && white_king != stop && black_king != stop &&
+               (!(attacks::king(black_king) >> stop & 1) || (attacks::king(white_king) >> stop & 1)))
+                return win;
+
+            if(side_to_move == 1) {
+                // the undefended pawn falls
+                if((attacks::king(black_king) >> pawn & 1) && !(attacks::king(white_king) >> pawn & 1))
+                    return draw;
+                if(!black_moves)
+                    return (pawn_attacks(pawn) >> black_king & 1) ? win : draw;
+            }
+            return unknown;
+        }
+
+        result classify(const vector<unsigned char> &db) const {
+            result good = side_to_move == 0 ? win : draw;
+            result bad  = side_to_move == 0 ? draw : win;
+
+            int r = invalid;
+            unsigned long long moves = attacks::king(side_to_move == 0 ? white_king : black_king);
+            for(; moves; moves &= moves - 1) {
+                int to = countr_zero(moves);
+                r |= side_to_move == 0 ? db[index(1, black_king, to, pawn)] : db[index(0, to, white_king, pawn)];
+            }
+
+            // a push onto a king lands on an invalid index and adds nothing
+            if(side_to_move == 0 && pawn / 8 < 6) {
+                r |= db[index(1, black_king, white_king, pawn + 8)];
+                if(pawn / 8 == 1 && pawn + 8 != white_king && pawn + 8 != black_king)
+                    r |= db[index(1, black_king, white_king, pawn + 16)];
+            }
+
+            return (r & good) ? good : (r & unknown) ? unknown : bad;
+        }
+    };
+
+    void normalise(int &white_king, int &white_pawn, int &black_king) {
+        if(white_pawn % 8 > 3) {
+            white_king ^= 7;
+            white_pawn ^= 7;
+            black_king ^= 7;
+        }
+    }
+
+    bool adjacent(int a, int b) {
+        auto [row_a, column_a] = gen_coordinate(a);
+        auto [row_b, column_b] = gen_coordinate(b);
+        return max(abs(row_a - row_b), abs(column_a - column_b)) <= 1;
+    }
+
+    bool pawn_takes(int pawn, int square) {
+        return square / 8 == pawn / 8 + 1 && abs(square % 8 - pawn % 8) == 1;
+    }
+
+    // decided results hold at any depth, open ones only up to the depth tried
+    struct forward_memo {
+        vector<unsigned char> decided = vector<unsigned char>(positions);
+        vector<unsigned char> open_depth = vector<unsigned char>(positions);
+    };
+
+    result forward(int white_king, int pawn, int black_king, int side_to_move, int depth, forward_memo &memo);
+
+    // plain depth limited minimax over the same rules, written square by square
+    // on purpose so that it shares nothing with the generator but the conventions
+    result forward_uncached(int white_king, int pawn, int black_king, int side_to_move, int depth, forward_memo &memo) {
+
+        bool open = false;
+        auto [row, column] = gen_coordinate(side_to_move == 0 ? white_king : black_king);
+
+        if(side_to_move == 0) {
+            for(int dirx=-1; dirx<2; dirx++)
+                for(int diry=-1; diry<2; diry++) {
+                    if((!dirx && !diry) || !coordinate_is_legal({row + diry, column + dirx}))
+                        continue;
+                    int to = ind_from_coordinate({row + diry, column + dirx});
+                    if(to == pawn || adjacent(to, black_king))
+                        continue;
+                    result r = forward(to, pawn, black_king, 1, depth - 1, memo);
+                    if(r == win) return win;
+                    open |= r == unknown;
+                }
+
+            int stop = pawn + 8;
+            if(stop != white_king && stop != black_king) {
+                if(stop / 8 == 7) {
+                    if(!adjacent(black_king, stop) || adjacent(white_king, stop))
+                        return win;
+                } else {
+                    result r = forward(white_king, stop, black_king, 1, depth - 1, memo);
+                    if(r == win) return win;
+                    open |= r == unknown;
+                    if(pawn / 8 == 1 && stop + 8 != white_king && stop + 8 != black_king) {
+                        r = forward(white_king, stop + 8, black_king, 1, depth - 1, memo);
+                        if(r == win) return win;
+                        open |= r == unknown;
+                    }
+                }
+            }
+            return open ? unknown : draw;
+        }
+
+        if(adjacent(black_king, pawn) && !adjacent(white_king, pawn))
+            return draw;
+
+        bool any = false;
+        for(int dirx=-1; dirx<2; dirx++)
+            for(int diry=-1; diry<2; diry++) {
+                if((!dirx && !diry) || !coordinate_is_legal({row + diry, column + dirx}))
+                    continue;
+                int to = ind_from_coordinate({row + diry, column + dirx});
+                if(to == pawn || adjacent(to, white_king) || pawn_takes(pawn, to))
+                    continue;
+                any = true;
+                result r = forward(white_king, pawn, to, 0, depth - 1, memo);
+                if(r == draw) return draw;
+                open |= r == unknown;
+            }
+        if(!any)
+            return pawn_takes(pawn, black_king) ? win : draw;
+        return open ? unknown : win;
+    }
+
+    result forward(int white_king, int pawn, int black_king, int side_to_move, int depth, forward_memo &memo) {
+        int idx = index(side_to_move, black_king, white_king, pawn);
+        if(memo.decided[idx])
+            return result(memo.decided[idx]);
+        if(depth <= memo.open_depth[idx])
+            return unknown;
+
+        result r = forward_uncached(white_king, pawn, black_king, side_to_move, depth, memo);
+        if(r == unknown)
+            memo.open_depth[idx] = depth;
+        else
+            memo.decided[idx] = r;
+        return r;
+    }
+}
+
+void generate(generation_stats *stats) {
+    auto start = chrono::steady_clock::now();
+    vector<unsigned char> db(positions);
+
+    for(int idx=0; idx<positions; idx++)
+        db[idx] = position(idx).initial();
+
+    int iterations = 0;
+    for(bool changed = true; changed; iterations++) {
+        changed = false;
+        for(int idx=0; idx<positions; idx++)
+            if(db[idx] == unknown) {
+                db[idx] = position(idx).classify(db);
+                changed |= db[idx] != unknown;
+            }
+    }
+
+    // whatever never resolved cannot be forced, so it is a draw
+    table.fill(0);
+    for(int idx=0; idx<positions; idx++)
+        if(db[idx] == win)
+            table[idx / 8] |= 1 << (idx % 8);
+    table_ready.store(true, memory_order_release);
+
+    if(stats) {
+        stats->iterations = iterations;
+        stats->milliseconds = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+        stats->work_bytes = db.size() + table.size();
+    }
+}
+
+bool load(const string &path) {
+    ifstream in(path, ios::binary);
+    if(!in.read((char *)table.data(), table.size()) || in.peek() != EOF) {
+        cerr << "kpk: " << path << " is not a KPK bitbase\n";
+        return false;
+    }
+    table_ready.store(true, memory_order_release);
+    return true;
+}
+
+bool save(const string &path) {
+    if(!ready())
+        return false;
+    ofstream out(path, ios::binary);
+    out.write((const char *)table.data(), table.size());
+    return bool(out);
+}
+
+// search threads can all probe first at the same moment, only one of them fills the table
+bool ready() {
+    static once_flag filled;
+    call_once(filled, [] {
+        if(table_ready.load(memory_order_acquire))
+            return;
+#ifdef CHESS_KPK_EMBED
+        copy(begin(kpk_embedded), end(kpk_embedded), table.begin());
+        table_ready.store(true, memory_order_release);
+#else
+        generate();
+#endif
+    });
+    return table_ready.load(memory_order_acquire);
+}
+
+bool probe_kpk(int white_king, int white_pawn, int black_king, int side_to_move) {
+    if(!table_ready.load(memory_order_acquire))
+        ready();
+    normalise(white_king, white_pawn, black_king);
+    int idx = index(side_to_move, black_king, white_king, white_pawn);
+    return table[idx / 8] >> (idx % 8) & 1;
+}
+
+int probe(const board &pos) {
+    auto &pieces = pos.pieces();
+    unsigned long long others = 0;
+    for(int piece : {1, 2, 3, 4, 7, 8, 9, 10})
+        others |= pieces[piece];
+    if(others || popcount((unsigned long long)(pieces[0] | pieces[6])) != 1)
+        return -1;
+
+    int strong = pieces[0] ? 0 : 1;
+    int pawn = countr_zero((unsigned long long)pieces[6 * strong]);
+    int strong_king = countr_zero((unsigned long long)pieces[5 + 6 * strong]);
+    int weak_king = countr_zero((unsigned long long)pieces[5 + 6 * !strong]);
+    int side_to_move = pos.side_to_move();
+
+    // seen from the pawn's side, black pawns get the board flipped
+    if(strong) {
+        pawn ^= 56;
+        strong_king ^= 56;
+        weak_king ^= 56;
+        side_to_move ^= 1;
+    }
+    return probe_kpk(strong_king, pawn, weak_king, side_to_move) ? 1 : 0;
+}
+
+int kpk_command(const vector<string> &args) {
+    string mode = args.empty() ? "" : args[0];
+    const char *usage = "usage: chess kpk generate <file> | embed <header> | verify [samples] [depth] [file]\n";
+
+    if(mode == "generate" && args.size() > 1) {
+        generation_stats stats;
+        generate(&stats);
+        int wins = 0;
+        for(auto byte : table) wins += popcount((unsigned)byte);
+        cout << "positions: " << positions << ", wins: " << wins << '\n'
+             << "iterations: " << stats.iterations << '\n'
+             << "time: " << stats.milliseconds << " ms\n"
+             << "memory: " << stats.work_bytes << " bytes while generating, " << table.size() << " bytes stored\n";
+        return save(args[1]) ? 0 : 1;
+    }
+
+    if(mode == "embed" && args.size() > 1) {
+        ready();
+        ofstream out(args[1]);
+        out << "// generated by chess kpk embed, configure with -DCHESS_KPK_EMBED=<this file>\n"
+            << "static const unsigned char kpk_embedded[" << table.size() << "] = {";
+        for(size_t i=0; i<table.size(); i++)
+            out << (i % 16 ? " " : "\n    ") << int(table[i]) << ',';
+        out << "\n};\n";
+        return out ? 0 : 1;
+    }
+
+    if(mode == "verify") {
+        int samples, depth;
+        try {
+            samples = args.size() > 1 ? stoi(args[1]) : 2000;
+            depth = min(args.size() > 2 ? stoi(args[2]) : 30, 255);
+        } catch(const logic_error &) {
+            cerr << usage;
+            return 1;
+        }
+        if(args.size() > 3 && !load(args[3]))
+            return 1;
+
+        generation_stats stats{0, 0, 0};
+        if(!table_ready)
+            generate(&stats);
+
+        forward_memo memo;
+        mt19937 gen(7);
+        int decided = 0, disagreements = 0;
+        for(int sample=0; sample<samples; ) {
+            int idx = gen() % positions;
+            position pos(idx);
+            if(pos.initial() == invalid)
+                continue;
+            sample++;
+
+            result expected = probe_kpk(pos.white_king, pos.pawn, pos.black_king, pos.side_to_move) ? win : draw;
+            result found = forward(pos.white_king, pos.pawn, pos.black_king, pos.side_to_move, depth, memo);
+            if(found == unknown)
+                continue;
+            decided++;
+            if(found != expected) {
+                disagreements++;
+                cerr << "disagreement at index " << idx << '\n';
+            }
+        }
+        cout << "samples: " << samples << ", decided by forward search: " << decided 
+             << ", disagreements: " << disagreements << '\n';
+        return disagreements ? 1 : 0;
+    }
+
+    cerr << usage;
+    return 1;
+}
+
+}
@@ -0,0 +1,196 @@
+#include "move_picker.h"
+#include "board_utils.h"
+
+#include <array>
+#include <utility>
+
+using namespace std;
+using namespace board_utils;
+
+namespace {
+    // pawn, knight, bishop, rook, queen, king
+    constexpr array<int, 6> piece_value = {100, 320, 330, 500, 900, 20000};
+}
+
+move_picker::move_picker(const board &pos, pair<int, int> hash_move, array<pair<int, int>, 2> killers, bool noisy_only)
+    : pos(pos),
+      current(hash_stage),
+      noisy_only(noisy_only),
+      hash_move(hash_move),
+      killers(killers),
+      killer_index(0),
+      index(0),
+      bad_index(0),
+      attacked_ready(false),
+      attacked(0)
+{
+    if(this->hash_move == no_move || !pos.is_pseudo_legal(this->hash_move)) {
+        this->hash_move = no_move;
+        current = gen_captures_stage;
+    }
+}
+
+bool move_picker::next(pair<int, int> &move) {
+    while(next_pseudo(move))
+        if(legal(move))
+            return true;
+    return false;
+}
+
+bool move_picker::next_pseudo(pair<int, int> &move) {
+    switch(current) {
+        case hash_stage:
+            current = gen_captures_stage;
+            move = hash_move;
+            return true;
+
+        case gen_captures_stage:
+            moves.clear();
+            index = 0;
+            pos.gen_pseudo_moves(moves, board::captures);
+            score_captures();
+            current = good_captures_stage;
+            [[fallthrough]];
+
+        case good_captures_stage:
+            while(pick_best(move))
+                if(move != hash_move)
+                    return true;
+            current = gen_promotions_stage;
+            [[fallthrough]];
+
+        case gen_promotions_stage:
+            moves.clear();
+            index = 0;
+            pos.gen_pseudo_moves(moves, board::promotions);
+            score_promotions();
+            current = promotions_stage;
+            [[fallthrough]];
+
+        case promotions_stage:
+            while(pick_best(move))
+                if(move != hash_move)
+                    return true;
+            if(noisy_only) {
+                current = done_stage;
+                return false;
+            }
+            current = killers_stage;
+            [[fallthrough]];
+
+        case killers_stage:
+            while(killer_index < 2) {
+                move = killers[killer_index++];
+                if(move == no_move || move == hash_move)
+                    continue;
+                if(killer_index == 2 && move == killers[0])
+                    continue;
+                if(is_quiet(pos, move) && pos.is_pseudo_legal(move))
+                    return true;
+            }
+            current = gen_quiets_stage;
+            [[fallthrough]];
+
+        case gen_quiets_stage:
+            moves.clear();
+            index = 0;
+            pos.gen_pseudo_moves(moves, board::quiets);
+            current = quiets_stage;
+            [[fallthrough]];
+
+        case quiets_stage:
+            while(index < moves.size()) {
+                move = moves[index++];
+                if(move != hash_move && move != killers[0] && move != killers[1])
+                    return true;
+            }
+            current = bad_captures_stage;
+            [[fallthrough]];
+
+        case bad_captures_stage:
+            while(bad_index < bad_captures.size()) {
+                move = bad_captures[bad_index++];
+                if(move != hash_move)
+                    return true;
+            }
+            current = done_stage;
+            [[fallthrough]];
+
+        case done_stage:
+            return false;
+    }
+    return false;
+}
+
+// selection sort one step at a time, we rarely get to look at more than a few moves
+bool move_picker::pick_best(pair<int, int> &move) {
+    if(index >= moves.size())
+        return false;
+
+    int best = index;
+    for(int i=index+1; i<moves.size(); i++)
+        if(scores[i] > scores[best])
+            best = i;
+
+    swap(moves[index], moves[best]);
+    swap(scores[index], scores[best]);
+    move = moves[index++];
+    return true;
+}
+
+bool move_picker::is_quiet(const board &pos, const pair<int, int> &move) {
+    if(move.first == move.second)
+        return move.first >= 0 && move.first < 4; // castling
+    if(move.first < 0 || !ind_is_legal(move.first) || !ind_is_legal(move.second))
+        return false;
+    if(pos.is_color[!pos.turn][move.second])
+        return false;
+    // a pawn changing files onto an empty square can only be en passant
+    return !(pos.is_piece[6 * pos.turn][move.first] && (move.first - move.second) % 8 != 0);
+}
+
+bool move_picker::legal(const pair<int, int> &move) const {
+    return pos.keeps_king_safe(move);
+}
+
+int move_picker::piece_on(int square) const {
+    for(int i=0; i<12; i++)
+        if(pos.is_piece[i][square])
+            return i % 6;
+    return -1;
+}
+
+// MVV-LVA, captures that give away material to a defended square are deferred to the end
+void move_picker::score_captures() {
+    int kept = 0;
+    for(int i=0; i<moves.size(); i++) {
+        auto [start, end] = moves[i];
+        int attacker = piece_on(start);
+        int victim = piece_on(end);
+        if(victim == -1) victim = 0; // en passant
+
+        if(piece_value[victim] < piece_value[attacker]) {
+            if(!attacked_ready) {
+                attacked = pos.gen_attacked(!pos.turn);
+                attacked_ready = true;
+            }
+            if(attacked[end]) {
+                bad_captures.push(moves[i]);
+                continue;
+            }
+        }
+
+        scores[kept] = piece_value[victim] * 8 - attacker;
+        moves[kept++] = moves[i];
+    }
+    moves.count = kept;
+}
+
+// queens first, then whatever the pawn captures on the way
+void move_picker::score_promotions() {
+    for(int i=0; i<moves.size(); i++) {
+        int end = moves[i].second >> 2;
+        int victim = piece_on(end);
+        scores[i] = (moves[i].second % 4) * 10000 + (victim == -1 ? 0 : piece_value[victim]);
+    }
+}
@@ -0,0 +1,295 @@
+#include "movecache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+using namespace std;
+
+namespace movecache {
+
+namespace {
+    // from and to in six bits each, then 0 for a plain move, 1 for castling
+    // with the side in from, 2 to 5 for a promotion to a knight up to a queen
+    uint16_t encode(const pair<int, int> &move) {
+        if(move.first == move.second)
+            return move.first | move.first << 6 | 1 << 12;
+        if(move.first < 0)
+            return -move.first | (move.second >> 2) << 6 | (2 + (move.second & 3)) << 12;
+        return move.first | move.second << 6;
+    }
+
+    pair<int, int> decode(uint16_t code) {
+        int from = code & 63, to = code >> 6 & 63, kind = code >> 12;
+        if(kind == 1)
+            return {from, from};
+        if(kind >= 2)
+            return {-from, (to << 2) + kind - 2};
+        return {from, to};
+    }
+
+    // gen_moves answers differently once the fifty move rule is reached
+    uint64_t key_of(const board &pos) {
+        return pos.hash() ^ (pos.halfmove_clock() >= 100 ? 0xD6E8FEB86659FD93ULL : 0);
+    }
+
+    uint64_t occupancy(const board &pos) {
+        uint64_t res = 0;
+        for(auto &pieces : pos.pieces())
+            res |= pieces;
+        return res;
+    }
+}
+
+cache::cache(size_t megabytes) {
+    size_t bytes = max<size_t>(megabytes, 1) << 20;
+    buckets_per_shard = max<size_t>(1, bytes / 8 * 7 / (sizeof(slot) * ways * shard_count));
+    spill_budget = bytes / 8 / shard_count;
+    shards.reset(new shard[shard_count]);
+    for(int i=0; i<shard_count; i++) {
+        shard &s = shards[i];
+        s.slots.reset(new slot[buckets_per_shard * ways]);
+        s.hands.reset(new unsigned char[buckets_per_shard]());
+        for(size_t j=0; j<buckets_per_shard * ways; j++) {
+            s.slots[j].state = empty;
+            s.slots[j].spilled = nullptr;
+            s.slots[j].referenced.store(0, memory_order_relaxed);
+        }
+    }
+}
+
+cache::~cache() {
+    clear();
+}
+
+void cache::release(shard &s, slot &e) {
+    if(e.spilled) {
+        delete[] e.spilled;
+        e.spilled = nullptr;
+        s.spilled_bytes -= e.count * sizeof(uint16_t);
+    }
+    if(e.state != empty)
+        s.entries--;
+    e.state = empty;
+}
+
+bool cache::find(const board &pos, move_list &res, board::game_state &state) {
+    uint64_t key = key_of(pos), occupied = occupancy(pos);
+    shard &s = shard_of(key);
+    slot *bucket = &s.slots[bucket_of(key) * ways];
+    shared_lock<shared_mutex> hold(s.lock);
+    for(int way=0; way<ways; way++) {
+        slot &e = bucket[way];
+        if(e.state == empty || e.key != key || e.occupied != occupied)
+            continue;
+        const uint16_t *moves = e.spilled ? e.spilled : e.moves.data();
+        res.clear();
+        for(int i=0; i<e.count; i++)
+            res.push(decode(moves[i]));
+        state = board::game_state(e.state);
+        // readers only ever set the mark, a plain load first keeps the line shared when it is set already
+        if(!e.referenced.load(memory_order_relaxed))
+            e.referenced.store(1, memory_order_relaxed);
+        s.hits.fetch_add(1, memory_order_relaxed);
+        return true;
+    }
+    s.misses.fetch_add(1, memory_order_relaxed);
+    return false;
+}
+
+void cache::insert(const board &pos, const move_list &moves, board::game_state state) {
+    uint64_t key = key_of(pos), occupied = occupancy(pos);
+    shard &s = shard_of(key);
+    size_t b = bucket_of(key);
+    slot *bucket = &s.slots[b * ways];
+    size_t spill = moves.size() > inline_moves ? moves.size() * sizeof(uint16_t) : 0;
+    unique_lock<shared_mutex> hold(s.lock);
+
+    // the same position again, a free slot, or whatever the hand settles on
+    slot *target = nullptr;
+    for(int way=0; way<ways && !target; way++)
+        if(bucket[way].state != empty && bucket[way].key == key && bucket[way].occupied == occupied)
+            target = &bucket[way];
+    for(int way=0; way<ways && !target; way++)
+        if(bucket[way].state == empty)
+            target = &bucket[way];
+    size_t freed = target && target->spilled ? target->count * sizeof(uint16_t) : 0;
+    if(s.spilled_bytes - freed + spill > spill_budget) {
+        s.uncached.fetch_add(1, memory_order_relaxed);
+        return;
+    }
+    if(!target) {
+        unsigned char &hand = s.hands[b];
+        while(bucket[hand].referenced.load(memory_order_relaxed)) {
+            bucket[hand].referenced.store(0, memory_order_relaxed);
+            hand = (hand + 1) % ways;
+        }
+        target = &bucket[hand];
+        hand = (hand + 1) % ways;
+        s.evictions.fetch_add(1, memory_order_relaxed);
+    }
+
+    release(s, *target);
+    target->key = key;
+    target->occupied = occupied;
+    target->count = moves.size();
+    target->state = state;
+    target->referenced.store(0, memory_order_relaxed);
+    uint16_t *out = target->moves.data();
+    if(spill) {
+        out = target->spilled = new uint16_t[moves.size()];
+        s.spilled_bytes += spill;
+    }
+    for(int i=0; i<moves.size(); i++)
+        out[i] = encode(moves[i]);
+    s.entries++;
+    s.insertions.fetch_add(1, memory_order_relaxed);
+}
+
+board::game_state cache::legal_moves(const board &pos, move_list &res) {
+    board::game_state state;
+    if(find(pos, res, state))
+        return state;
+    res = pos.gen_moves();
+    state = pos.state(res);
+    insert(pos, res, state);
+    return state;
+}
+
+stats cache::counters() const {
+    stats res = {};
+    for(int i=0; i<shard_count; i++) {
+        shard &s = shards[i];
+        res.hits += s.hits.load(memory_order_relaxed);
+        res.misses += s.misses.load(memory_order_relaxed);
+        res.insertions += s.insertions.load(memory_order_relaxed);
+        res.evictions += s.evictions.load(memory_order_relaxed);
+        res.uncached += s.uncached.load(memory_order_relaxed);
+        shared_lock<shared_mutex> hold(s.lock);
+        res.entries += s.entries;
+        res.bytes += buckets_per_shard * ways * sizeof(slot) + s.spilled_bytes;
+    }
+    return res;
+}
+
+void cache::clear() {
+    for(int i=0; i<shard_count; i++) {
+        shard &s = shards[i];
+        unique_lock<shared_mutex> hold(s.lock);
+        for(size_t j=0; j<buckets_per_shard * ways; j++)
+            release(s, s.slots[j]);
+    }
+}
+
+// positions from random games, looked up once to fill the cache and checked
+// against gen_moves, then timed cold and warm on one thread and warm on many.
+// A second, small cache browsed through shows eviction at work
+int bench_command(const vector<string> &args) {
+    int threads;
+    double budget;
+    size_t megabytes;
+    try {
+        threads = args.size() > 0 ? stoi(args[0]) : max(1u, thread::hardware_concurrency());
+        budget = args.size() > 1 ? stod(args[1]) : 0.5;
+        megabytes = args.size() > 2 ? stoull(args[2]) : 16;
+    } catch(const logic_error &) {
+        cerr << "usage: chess movecache-bench [threads] [seconds] [cache mb]\n";
+        return 1;
+    }
+
+    mt19937_64 rng(1);
+    vector<board> positions;
+    for(int game=0; game<200; game++) {
+        board pos("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+        for(int ply=0; ply<120; ply++) {
+            positions.push_back(pos);
+            move_list legal;
+            pos.gen_legal_moves(legal);
+            if(legal.empty())
+                break;
+            pos.make_move(legal[rng() % legal.size()]);
+        }
+    }
+    // 218 moves, more than a slot holds
+    positions.emplace_back("R6R/3Q4/1Q4Q1/4Q3/2Q4Q/Q4Q2/pp1Q4/kBNN1KB1 w - - 0 1");
+
+    cache moves(megabytes);
+    size_t mismatches = 0;
+    move_list cached;
+    for(int pass=0; pass<2; pass++)
+        for(auto &pos : positions) {
+            move_list generated = pos.gen_moves();
+            board::game_state state = moves.legal_moves(pos, cached);
+            bool same = cached.size() == generated.size() && equal(cached.begin(), cached.end(), generated.begin()) &&
+                        state == pos.state(generated);
+            mismatches += !same;
+        }
+
+    auto time_per_position = [&](auto lookup) {
+        long long done = 0;
+        double seconds = 0;
+        while(seconds < budget) {
+            auto start = chrono::steady_clock::now();
+            for(auto &pos : positions)
+                lookup(pos);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            done += positions.size();
+        }
+        return seconds / done * 1e9;
+    };
+    uint64_t sink = 0;
+    double cold = time_per_position([&](const board &pos) { sink += pos.gen_moves().size(); });
+    double warm = time_per_position([&](const board &pos) {
+        moves.legal_moves(pos, cached);
+        sink += cached.size();
+    });
+
+    // every thread walks the positions from its own offset
+    vector<long long> lookups(threads);
+    atomic<bool> stop{false};
+    auto reader = [&](int id) {
+        move_list res;
+        board::game_state state;
+        for(size_t i=id * positions.size() / threads; !stop.load(memory_order_relaxed); i = (i + 1) % positions.size()) {
+            moves.find(positions[i], res, state);
+            lookups[id]++;
+        }
+    };
+    vector<thread> pool;
+    auto start = chrono::steady_clock::now();
+    for(int i=0; i<threads; i++)
+        pool.emplace_back(reader, i);
+    this_thread::sleep_for(chrono::duration<double>(budget));
+    stop = true;
+    for(auto &t : pool)
+        t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    long long total = 0;
+    for(long long n : lookups)
+        total += n;
+
+    stats s = moves.counters();
+    cout << "positions: " << positions.size() << ", mismatches: " << mismatches << " (" << (sink & 1) << ")\n"
+         << "gen_moves: " << cold << " ns, cached: " << warm << " ns per position\n"
+         << threads << " readers: " << total / seconds / 1e6 << " M lookups/s\n"
+         << "entries: " << s.entries << ", " << s.bytes / 1024 << " KB, hits " << s.hits << ", misses " << s.misses
+         << ", evictions " << s.evictions << ", uncached " << s.uncached << '\n';
+
+    // browsing: a few plies back or forward at a time, now and then another game
+    cache small(1);
+    size_t at = 0;
+    for(int step=0; step<200000; step++) {
+        at = rng() % 64 ? (at + positions.size() + rng() % 7 - 3) % positions.size() : rng() % positions.size();
+        small.legal_moves(positions[at], cached);
+    }
+    s = small.counters();
+    cout << "1 MB cache while browsing: entries " << s.entries << ", hit rate " << 100.0 * s.hits / (s.hits + s.misses)
+         << "%, evictions " << s.evictions << '\n';
+    return mismatches ? 1 : 0;
+}
+
+}
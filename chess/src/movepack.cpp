@@ -0,0 +1,460 @@
+#include "movepack.h"
+#include "move_list.h"
+#include "notation.h"
+#include "pgn.h"
+#include "psqt.h"
+
+#include <array>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+using namespace std;
+
+namespace movepack {
+
+namespace {
+    const string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    void put_varint(vector<unsigned char> &out, uint64_t v) {
+        for(; v >= 128; v >>= 7)
+            out.push_back((v & 127) | 128);
+        out.push_back(v);
+    }
+
+    bool get_varint(const unsigned char *&at, const unsigned char *end, uint64_t &v) {
+        v = 0;
+        for(int shift=0; at<end && shift<64; shift+=7) {
+            v |= uint64_t(*at & 127) << shift;
+            if(!(*at++ & 128))
+                return true;
+        }
+        return false;
+    }
+
+    // streams without this byte first came before the order below and are refused
+    constexpr unsigned char format_version = 2;
+
+    // the legal moves in the order of their pairs, which does not change when
+    // the generator's order does. The generator goes square by square already,
+    // so an insertion sort has little to move
+    void canonical_moves(const board &pos, move_list &res) {
+        res.clear();
+        pos.gen_legal_moves(res);
+        for(int i=1; i<res.size(); i++) {
+            pair<int, int> move = res[i];
+            int at = i;
+            for(; at > 0 && move < res[at - 1]; at--)
+                res[at] = res[at - 1];
+            res[at] = move;
+        }
+    }
+
+    int index_of(const move_list &moves, const pair<int, int> &move) {
+        for(int i=0; i<moves.size(); i++)
+            if(moves[i] == move)
+                return i;
+        return -1;
+    }
+
+    // bits of the next index, none when the move is forced
+    int width(int legal) {
+        return bit_width(unsigned(legal - 1));
+    }
+
+    class bit_writer {
+        public:
+            explicit bit_writer(vector<unsigned char> &out) : out(out), used(8) {}
+
+            void put(unsigned value, int bits) {
+                for(int i=0; i<bits; i++, used++) {
+                    if(used == 8) {
+                        out.push_back(0);
+                        used = 0;
+                    }
+                    out.back() |= (value >> i & 1) << used;
+                }
+            }
+
+        private:
+            vector<unsigned char> &out;
+            int used;
+    };
+
+    class bit_reader {
+        public:
+            bit_reader(const unsigned char *at, const unsigned char *end) : at(at), end(end), used(0) {}
+
+            // false once the stream runs out
+            bool get(unsigned &value, int bits) {
+                value = 0;
+                for(int i=0; i<bits; i++, used++) {
+                    if(used == 8) {
+                        at++;
+                        used = 0;
+                    }
+                    if(at == end)
+                        return false;
+                    value |= unsigned(*at >> used & 1) << i;
+                }
+                return true;
+            }
+
+        private:
+            const unsigned char *at, *end;
+            int used;
+    };
+
+    // LZMA style: 11 bit probabilities of a zero adapting by 1/32 per bit, and
+    // a 32 bit range with the carry resolved through a cached byte
+    constexpr int probability_bits = 11;
+    constexpr int adapt_shift = 5;
+    constexpr uint32_t top = 1u << 24;
+
+    // a rank is an index into the legal moves, of which no position has more
+    // than 218, so rank + 1 has at most rank_bits bits after its leading one
+    constexpr int max_legal_moves = 218;
+    constexpr int rank_bits = bit_width(unsigned(max_legal_moves)) - 1;
+    static_assert(rank_bits == 7, "the unary length code stops without a terminator at rank_bits");
+
+    struct model {
+        // one context per unary step of the rank's bit length, the last length
+        // needs no stop bit, then a binary tree over the rank's remaining bits
+        // for every length
+        array<uint16_t, rank_bits> length;
+        array<array<uint16_t, 1 << rank_bits>, rank_bits + 1> tail;
+
+        model() {
+            length.fill(1 << (probability_bits - 1));
+            for(auto &t : tail)
+                t.fill(1 << (probability_bits - 1));
+        }
+    };
+
+    class range_encoder {
+        public:
+            explicit range_encoder(vector<unsigned char> &out) : out(out), low(0), range(0xFFFFFFFF), cache(0), pending(1) {}
+
+            void put(uint16_t &p, int bit) {
+                uint32_t bound = (range >> probability_bits) * p;
+                if(!bit) {
+                    range = bound;
+                    p += ((1 << probability_bits) - p) >> adapt_shift;
+                } else {
+                    low += bound;
+                    range -= bound;
+                    p -= p >> adapt_shift;
+                }
+                while(range < top) {
+                    range <<= 8;
+                    shift_low();
+                }
+            }
+
+            void finish() {
+                for(int i=0; i<5; i++)
+                    shift_low();
+            }
+
+        private:
+            vector<unsigned char> &out;
+            uint64_t low;
+            uint32_t range;
+            unsigned char cache;
+            uint64_t pending;
+
+            void shift_low() {
+                if(uint32_t(low) < 0xFF000000u || (low >> 32)) {
+                    unsigned char carry = low >> 32;
+                    unsigned char byte = cache;
+                    do {
+                        out.push_back(byte + carry);
+                        byte = 0xFF;
+                    } while(--pending);
+                    cache = low >> 24;
+                }
+                pending++;
+                low = (low & 0x00FFFFFF) << 8;
+            }
+    };
+
+    class range_decoder {
+        public:
+            range_decoder(const unsigned char *at, const unsigned char *end) : at(at), end(end), code(0), range(0xFFFFFFFF) {
+                for(int i=0; i<5; i++)
+                    code = code << 8 | next();
+            }
+
+            int get(uint16_t &p) {
+                uint32_t bound = (range >> probability_bits) * p;
+                int bit;
+                if(code < bound) {
+                    range = bound;
+                    p += ((1 << probability_bits) - p) >> adapt_shift;
+                    bit = 0;
+                } else {
+                    code -= bound;
+                    range -= bound;
+                    p -= p >> adapt_shift;
+                    bit = 1;
+                }
+                while(range < top) {
+                    range <<= 8;
+                    code = code << 8 | next();
+                }
+                return bit;
+            }
+
+            // reading past the end only happens on a corrupt stream
+            bool overrun() const { return at > end; }
+
+        private:
+            const unsigned char *at, *end;
+            uint32_t code;
+            uint32_t range;
+
+            unsigned next() {
+                return at < end ? *at++ : (at++, 0);
+            }
+    };
+
+    // the bit length of rank + 1 goes in unary, then the bits below its leading one
+    void put_rank(range_encoder &rc, model &m, int rank) {
+        assert(rank >= 0 && rank < max_legal_moves);
+        int value = rank + 1, bits = bit_width(unsigned(value)) - 1;
+        for(int i=0; i<bits; i++)
+            rc.put(m.length[i], 1);
+        if(bits < rank_bits)
+            rc.put(m.length[bits], 0);
+        for(int i=bits-1, node=1; i>=0; i--) {
+            int bit = value >> i & 1;
+            rc.put(m.tail[bits][node], bit);
+            node = node * 2 + bit;
+        }
+    }
+
+    int get_rank(range_decoder &rc, model &m) {
+        int bits = 0;
+        while(bits < rank_bits && rc.get(m.length[bits]))
+            bits++;
+        int node = 1;
+        for(int i=0; i<bits; i++)
+            node = node * 2 + rc.get(m.tail[bits][node]);
+        return node - 1;
+    }
+
+    int piece_on(const board &pos, int square) {
+        for(int piece=0; piece<12; piece++)
+            if(pos.pieces()[piece][square])
+                return piece;
+        return -1;
+    }
+
+    // pawn, knight, bishop, rook, queen, king
+    constexpr array<int, 6> piece_value = {100, 320, 330, 500, 900, 0};
+
+    // the middlegame psqt gain of every move for the side to move, less the
+    // piece when it lands on an attacked square and plus it when it leaves
+    // one. Ties are kept in generation order
+    void rank_moves(board &pos, const move_list &moves, array<unsigned char, 256> &order) {
+        int turn = pos.side_to_move(), sign = turn ? -1 : 1;
+        bitboard attacked = pos.gen_attacked(!turn);
+        array<int, 256> scores;
+        for(int i=0; i<moves.size(); i++) {
+            auto [from, to] = moves[i];
+            int score;
+            if(from == to) {
+                score = 30;
+            } else {
+                int piece, placed;
+                if(from < 0) {
+                    from = -from;
+                    placed = 6 * turn + (to & 3) + 1;
+                    to >>= 2;
+                    piece = 6 * turn;
+                } else {
+                    piece = placed = piece_on(pos, from);
+                }
+                int victim = piece_on(pos, to);
+                score = sign * (psqt::mg(placed, to) - psqt::mg(piece, from) - (victim >= 0 ? psqt::mg(victim, to) : 0));
+                if(attacked[to])
+                    score -= piece_value[placed % 6];
+                if(attacked[from])
+                    score += piece_value[piece % 6] / 2;
+            }
+            int at = i;
+            for(; at > 0 && scores[at - 1] < score; at--) {
+                scores[at] = scores[at - 1];
+                order[at] = order[at - 1];
+            }
+            scores[at] = score;
+            order[at] = i;
+        }
+    }
+}
+
+bool encode(const string &fen, const vector<pair<int, int>> &moves, coding how, vector<unsigned char> &out) {
+    board pos(fen);
+    out.push_back(format_version);
+    put_varint(out, moves.size());
+    bit_writer bits(out);
+    range_encoder rc(out);
+    model m;
+    move_list legal;
+    array<unsigned char, 256> order;
+
+    for(auto &move : moves) {
+        canonical_moves(pos, legal);
+        int index = index_of(legal, move);
+        if(index < 0)
+            return false;
+        if(how == index_bits) {
+            bits.put(index, width(legal.size()));
+        } else if(legal.size() > 1) {
+            rank_moves(pos, legal, order);
+            int rank = 0;
+            while(order[rank] != index)
+                rank++;
+            put_rank(rc, m, rank);
+        }
+        pos.make_move(move);
+    }
+    if(how == ranked_range)
+        rc.finish();
+    return true;
+}
+
+bool decode(board &pos, const unsigned char *data, size_t size, coding how, vector<pair<int, int>> &moves) {
+    const unsigned char *at = data, *end = data + size;
+    uint64_t count;
+    if(at == end || *at++ != format_version || !get_varint(at, end, count))
+        return false;
+    bit_reader bits(at, end);
+    // the range coder starts reading at once, a game of forced moves has no bytes
+    range_decoder rc(at, end);
+    model m;
+    move_list legal;
+    array<unsigned char, 256> order;
+
+    for(uint64_t i=0; i<count; i++) {
+        canonical_moves(pos, legal);
+        if(!legal.size())
+            return false;
+        unsigned index = 0;
+        if(how == index_bits) {
+            if(!bits.get(index, width(legal.size())))
+                return false;
+        } else if(legal.size() > 1) {
+            unsigned rank = get_rank(rc, m);
+            if(rank >= unsigned(legal.size()))
+                return false;
+            rank_moves(pos, legal, order);
+            index = order[rank];
+        }
+        if(index >= unsigned(legal.size()))
+            return false;
+        moves.push_back(legal[index]);
+        pos.make_move(legal[index]);
+    }
+    return how == index_bits || !rc.overrun();
+}
+
+// every game of the files is packed both ways and checked to come back, then
+// the sizes and the time to replay the games are compared with the PGN text
+int bench_command(const vector<string> &args) {
+    if(args.empty()) {
+        cerr << "usage: chess movepack <pgn file>...\n";
+        return 1;
+    }
+
+    struct stored {
+        string fen;
+        vector<pair<int, int>> moves;
+        string text;
+        array<vector<unsigned char>, 2> packed;
+    };
+    vector<stored> games;
+    size_t text_bytes = 0, move_count = 0, skipped = 0, failures = 0;
+    array<size_t, 2> packed_bytes = {0, 0};
+
+    pgn::reader file;
+    pgn::game g;
+    for(auto &path : args) {
+        if(!file.open(path))
+            return 1;
+        while(file.next(g)) {
+            string_view fen = g.find("FEN");
+            stored s{fen.empty() ? start_fen : string(fen), {}, string(g.movetext), {}};
+            board pos(s.fen);
+            pgn::move_tokens tokens(g.movetext);
+            bool ok = true;
+            for(string_view san; tokens.next(san); ) {
+                auto move = notation::parse_san(pos, san);
+                if(move == notation::no_move) {
+                    ok = false;
+                    break;
+                }
+                s.moves.push_back(move);
+                pos.make_move(move);
+            }
+            if(!ok) {
+                skipped++;
+                continue;
+            }
+            for(int how=0; how<2; how++) {
+                encode(s.fen, s.moves, coding(how), s.packed[how]);
+                board back(s.fen);
+                vector<pair<int, int>> moves;
+                if(!decode(back, s.packed[how].data(), s.packed[how].size(), coding(how), moves) ||
+                   moves != s.moves || back.hash() != pos.hash())
+                    failures++;
+                packed_bytes[how] += s.packed[how].size();
+            }
+            text_bytes += s.text.size();
+            move_count += s.moves.size();
+            games.push_back(move(s));
+        }
+    }
+    if(games.empty()) {
+        cerr << "movepack: no games read\n";
+        return 1;
+    }
+
+    auto timed = [&](auto replay) {
+        auto start = chrono::steady_clock::now();
+        for(auto &s : games)
+            replay(s);
+        return games.size() / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+    unsigned long long sink = 0;
+    double text_rate = timed([&](stored &s) {
+        board pos(s.fen);
+        pgn::move_tokens tokens(s.text);
+        for(string_view san; tokens.next(san); )
+            pos.make_move(notation::parse_san(pos, san));
+        sink ^= pos.hash();
+    });
+    array<double, 2> packed_rate;
+    vector<pair<int, int>> moves;
+    for(int how=0; how<2; how++)
+        packed_rate[how] = timed([&](stored &s) {
+            board pos(s.fen);
+            moves.clear();
+            decode(pos, s.packed[how].data(), s.packed[how].size(), coding(how), moves);
+            sink ^= pos.hash();
+        });
+
+    double n = games.size();
+    cout << "games: " << games.size() << ", moves: " << move_count << ", skipped: " << skipped
+         << ", round trip failures: " << failures << '\n'
+         << "pgn movetext: " << text_bytes / n << " bytes/game, " << text_rate << " games/s\n"
+         << "index bits: " << packed_bytes[0] / n << " bytes/game, " << 8.0 * packed_bytes[0] / move_count
+         << " bits/move, " << packed_rate[0] << " games/s\n"
+         << "ranked range: " << packed_bytes[1] / n << " bytes/game, " << 8.0 * packed_bytes[1] / move_count
+         << " bits/move, " << packed_rate[1] << " games/s (" << hex << sink << dec << ")\n";
+    return failures ? 1 : 0;
+}
+
+}
@@ -0,0 +1,453 @@
+#include "nnue.h"
+#include "board.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined(__AVX2__) || defined(__SSSE3__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace nnue {
+
+bool network_loaded = false;
+
+namespace {
+    constexpr uint32_t magic = 0x45554e4e; // "NNUE"
+    constexpr uint32_t version = 1;
+
+    // first layer values are scaled so that 1.0 maps onto the int8 clip at 127,
+    // dense layer weights get 6 more bits
+    constexpr int ft_scale = 127;
+    constexpr int weight_scale = 64;
+
+    struct network {
+        float output_scale;
+
+        // float copies for the reference implementation
+        vector<float> ft_weights_f;
+        vector<float> ft_bias_f;
+        vector<float> l2_weights_f;
+        vector<float> l2_bias_f;
+        vector<float> out_weights_f;
+        float out_bias_f;
+
+        vector<int16_t> ft_weights;
+        array<int16_t, l1> ft_bias;
+        vector<int8_t> l2_weights;
+        array<int32_t, l2> l2_bias;
+        array<int8_t, l2> out_weights;
+        int32_t out_bias;
+    };
+
+    unique_ptr<network> active;
+
+    template<typename T>
+    T quantize(float value, float scale) {
+        float lo = numeric_limits<T>::min(), hi = numeric_limits<T>::max();
+        return T(clamp(roundf(value * scale), lo, hi));
+    }
+
+    template<bool add>
+    void update(int16_t *values, const int16_t *column) {
+#if defined(__AVX2__)
+        for(int i=0; i<l1; i+=16) {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(values + i));
+            __m256i w = _mm256_loadu_si256((const __m256i *)(column + i));
+            v = add ? _mm256_add_epi16(v, w) : _mm256_sub_epi16(v, w);
+            _mm256_storeu_si256((__m256i *)(values + i), v);
+        }
+#elif defined(__SSE2__)
+        for(int i=0; i<l1; i+=8) {
+            __m128i v = _mm_loadu_si128((const __m128i *)(values + i));
+            __m128i w = _mm_loadu_si128((const __m128i *)(column + i));
+            v = add ? _mm_add_epi16(v, w) : _mm_sub_epi16(v, w);
+            _mm_storeu_si128((__m128i *)(values + i), v);
+        }
+#else
+        for(int i=0; i<l1; i++)
+            values[i] = add ? values[i] + column[i] : values[i] - column[i];
+#endif
+    }
+
+    // clipped relu of one accumulator half into [0, 127]
+    void clip(const int16_t *values, uint8_t *out) {
+#if defined(__AVX2__)
+        const __m256i zero = _mm256_setzero_si256();
+        for(int i=0; i<l1; i+=32) {
+            __m256i a = _mm256_loadu_si256((const __m256i *)(values + i));
+            __m256i b = _mm256_loadu_si256((const __m256i *)(values + i + 16));
+            __m256i packed = _mm256_max_epi8(_mm256_packs_epi16(a, b), zero);
+            // packs works per 128 bit lane, put the quarters back in order
+            packed = _mm256_permute4x64_epi64(packed, 0xD8);
+            _mm256_storeu_si256((__m256i *)(out + i), packed);
+        }
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for(int i=0; i<l1; i+=16) {
+            __m128i a = _mm_loadu_si128((const __m128i *)(values + i));
+            __m128i b = _mm_loadu_si128((const __m128i *)(values + i + 8));
+            __m128i packed = _mm_packus_epi16(_mm_max_epi16(a, zero), _mm_max_epi16(b, zero));
+            packed = _mm_min_epu8(packed, _mm_set1_epi8(127));
+            _mm_storeu_si128((__m128i *)(out + i), packed);
+        }
+#else
+        for(int i=0; i<l1; i++)
+            out[i] = uint8_t(clamp<int>(values[i], 0, 127));
+#endif
+    }
+
+    int32_t dot(const uint8_t *input, const int8_t *weights) {
+#if defined(__AVX2__)
+        const __m256i ones = _mm256_set1_epi16(1);
+        __m256i sum = _mm256_setzero_si256();
+        for(int i=0; i<2*l1; i+=32) {
+            __m256i in = _mm256_loadu_si256((const __m256i *)(input + i));
+            __m256i w = _mm256_loadu_si256((const __m256i *)(weights + i));
+            // 127 * 127 * 2 still fits the saturating int16 pair sums
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(in, w), ones));
+        }
+        __m128i half = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0x4E));
+        half = _mm_add_epi32(half, _mm_shuffle_epi32(half, 0xB1));
+        return _mm_cvtsi128_si32(half);
+#elif defined(__SSSE3__)
+        const __m128i ones = _mm_set1_epi16(1);
+        __m128i sum = _mm_setzero_si128();
+        for(int i=0; i<2*l1; i+=16) {
+            __m128i in = _mm_loadu_si128((const __m128i *)(input + i));
+            __m128i w = _mm_loadu_si128((const __m128i *)(weights + i));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(_mm_maddubs_epi16(in, w), ones));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4E));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xB1));
+        return _mm_cvtsi128_si32(sum);
+#else
+        int32_t sum = 0;
+        for(int i=0; i<2*l1; i++)
+            sum += int32_t(input[i]) * weights[i];
+        return sum;
+#endif
+    }
+
+    template<typename T>
+    bool read_array(ifstream &in, vector<T> &res, size_t count) {
+        res.resize(count);
+        return bool(in.read((char *)res.data(), count * sizeof(T)));
+    }
+
+    template<typename T>
+    void write_array(ofstream &out, const vector<T> &values) {
+        out.write((const char *)values.data(), values.size() * sizeof(T));
+    }
+}
+
+bool load(const string &path) {
+    ifstream in(path, ios::binary);
+    if(!in) {
+        cerr << "nnue: cannot open " << path << '\n';
+        return false;
+    }
+
+    array<uint32_t, 5> header;
+    auto net = make_unique<network>();
+    in.read((char *)header.data(), sizeof(header));
+    in.read((char *)&net->output_scale, sizeof(float));
+    if(!in || header[0] != magic || header[1] != version || 
+       header[2] != features || header[3] != l1 || header[4] != l2) {
+        cerr << "nnue: " << path << " is not a compatible network\n";
+        return false;
+    }
+
+    vector<float> out_bias;
+    bool ok = read_array(in, net->ft_weights_f, size_t(features) * l1) &&
+              read_array(in, net->ft_bias_f, l1) &&
+              read_array(in, net->l2_weights_f, size_t(l2) * 2 * l1) &&
+              read_array(in, net->l2_bias_f, l2) &&
+              read_array(in, net->out_weights_f, l2) &&
+              read_array(in, out_bias, 1);
+    if(!ok) {
+        cerr << "nnue: " << path << " is truncated\n";
+        return false;
+    }
+    net->out_bias_f = out_bias[0];
+
+    net->ft_weights.resize(net->ft_weights_f.size());
+    for(size_t i=0; i<net->ft_weights.size(); i++)
+        net->ft_weights[i] = quantize<int16_t>(net->ft_weights_f[i], ft_scale);
+    for(int i=0; i<l1; i++)
+        net->ft_bias[i] = quantize<int16_t>(net->ft_bias_f[i], ft_scale);
+
+    net->l2_weights.resize(net->l2_weights_f.size());
+    for(size_t i=0; i<net->l2_weights.size(); i++)
+        net->l2_weights[i] = quantize<int8_t>(net->l2_weights_f[i], weight_scale);
+    for(int i=0; i<l2; i++) {
+        net->l2_bias[i] = quantize<int32_t>(net->l2_bias_f[i], ft_scale * weight_scale);
+        net->out_weights[i] = quantize<int8_t>(net->out_weights_f[i], weight_scale);
+    }
+    net->out_bias = quantize<int32_t>(net->out_bias_f, ft_scale * weight_scale);
+
+    active = std::move(net);
+    network_loaded = true;
+    return true;
+}
+
+bool write_random(const string &path, unsigned seed) {
+    ofstream out(path, ios::binary);
+    if(!out) {
+        cerr << "nnue: cannot write " << path << '\n';
+        return false;
+    }
+
+    mt19937 gen(seed);
+    auto fill = [&](size_t count, float lo, float hi) {
+        uniform_real_distribution<float> dist(lo, hi);
+        vector<float> res(count);
+        for(auto &elem : res) elem = dist(gen);
+        return res;
+    };
+
+    array<uint32_t, 5> header = {magic, version, features, l1, l2};
+    float output_scale = 400;
+    out.write((const char *)header.data(), sizeof(header));
+    out.write((const char *)&output_scale, sizeof(float));
+    write_array(out, fill(size_t(features) * l1, -0.1f, 0.1f));
+    write_array(out, fill(l1, 0.0f, 0.2f));
+    write_array(out, fill(size_t(l2) * 2 * l1, -0.25f, 0.25f));
+    write_array(out, fill(l2, -0.1f, 0.1f));
+    write_array(out, fill(l2, -1.0f, 1.0f));
+    write_array(out, fill(1, -0.1f, 0.1f));
+    return bool(out);
+}
+
+int feature_index(int perspective, int king_square, int piece, int square) {
+    if(perspective) {
+        king_square ^= 56;
+        square ^= 56;
+    }
+    int kind = piece % 6 + (piece / 6 == perspective ? 0 : 5);
+    return (king_square * piece_kinds + kind) * 64 + square;
+}
+
+void add_feature(accumulator &acc, int perspective, int index) {
+    update<true>(acc.values[perspective].data(), &active->ft_weights[size_t(index) * l1]);
+}
+
+void sub_feature(accumulator &acc, int perspective, int index) {
+    update<false>(acc.values[perspective].data(), &active->ft_weights[size_t(index) * l1]);
+}
+
+void refresh(accumulator &acc, int perspective, const array<bitboard, 12> &pieces) {
+    acc.values[perspective] = active->ft_bias;
+    int king_square = countr_zero((unsigned long long)pieces[5 + 6 * perspective]);
+    for(int piece=0; piece<12; piece++) {
+        if(piece % 6 == 5)
+            continue;
+        for(unsigned long long bb = pieces[piece]; bb; bb &= bb - 1)
+            add_feature(acc, perspective, feature_index(perspective, king_square, piece, countr_zero(bb)));
+    }
+    acc.computed[perspective] = true;
+}
+
+int evaluate(const accumulator &acc, int side_to_move) {
+    alignas(32) array<uint8_t, 2 * l1> input;
+    clip(acc.values[side_to_move].data(), input.data());
+    clip(acc.values[!side_to_move].data(), input.data() + l1);
+
+    int32_t out = active->out_bias;
+    for(int j=0; j<l2; j++) {
+        int32_t sum = active->l2_bias[j] + dot(input.data(), &active->l2_weights[j * 2 * l1]);
+        int32_t hidden = (sum + weight_scale / 2) / weight_scale;
+        out += clamp(hidden, 0, 127) * active->out_weights[j];
+    }
+    return int(out * active->output_scale / (ft_scale * weight_scale));
+}
+
+float evaluate_float(const array<bitboard, 12> &pieces, int side_to_move, bool dequantized) {
+    const network &net = *active;
+    auto ft_weight = [&](size_t i) { return dequantized ? float(net.ft_weights[i]) / ft_scale : net.ft_weights_f[i]; };
+    auto ft_bias = [&](int i) { return dequantized ? float(net.ft_bias[i]) / ft_scale : net.ft_bias_f[i]; };
+    auto l2_weight = [&](int i) { return dequantized ? float(net.l2_weights[i]) / weight_scale : net.l2_weights_f[i]; };
+    auto l2_bias = [&](int j) {
+        return dequantized ? float(net.l2_bias[j]) / (ft_scale * weight_scale) : net.l2_bias_f[j];
+    };
+    auto out_weight = [&](int j) { return dequantized ? float(net.out_weights[j]) / weight_scale : net.out_weights_f[j]; };
+    float out_bias = dequantized ? float(net.out_bias) / (ft_scale * weight_scale) : net.out_bias_f;
+
+    array<array<float, l1>, 2> acc;
+    for(int perspective=0; perspective<2; perspective++) {
+        for(int i=0; i<l1; i++)
+            acc[perspective][i] = ft_bias(i);
+        int king_square = countr_zero((unsigned long long)pieces[5 + 6 * perspective]);
+        for(int piece=0; piece<12; piece++) {
+            if(piece % 6 == 5)
+                continue;
+            for(unsigned long long bb = pieces[piece]; bb; bb &= bb - 1) {
+                size_t index = feature_index(perspective, king_square, piece, countr_zero(bb));
+                for(int i=0; i<l1; i++)
+                    acc[perspective][i] += ft_weight(index * l1 + i);
+            }
+        }
+    }
+
+    array<float, 2 * l1> input;
+    for(int i=0; i<l1; i++) {
+        input[i] = clamp(acc[side_to_move][i], 0.0f, 1.0f);
+        input[l1 + i] = clamp(acc[!side_to_move][i], 0.0f, 1.0f);
+    }
+
+    float out = out_bias;
+    for(int j=0; j<l2; j++) {
+        float hidden = l2_bias(j);
+        for(int i=0; i<2*l1; i++)
+            hidden += input[i] * l2_weight(j * 2 * l1 + i);
+        out += clamp(hidden, 0.0f, 1.0f) * out_weight(j);
+    }
+    return out * net.output_scale;
+}
+
+namespace {
+    // how far the integer pass may be from the dequantized float one: every
+    // hidden unit is rounded to the nearest 1/127 step, then the output is
+    // truncated to whole centipawns
+    float rounding_bound() {
+        float sum = 0;
+        for(int j=0; j<l2; j++)
+            sum += abs(active->out_weights[j]);
+        return 0.5f * sum * active->output_scale / (ft_scale * weight_scale) + 1.01f;
+    }
+}
+
+const char *simd_name() {
+#if defined(__AVX2__)
+    return "avx2";
+#elif defined(__SSSE3__)
+    return "ssse3";
+#elif defined(__SSE2__)
+    return "sse2";
+#else
+    return "scalar";
+#endif
+}
+
+int init_command(const vector<string> &args) {
+    const char *usage = "usage: chess nnue-init <weights file> [seed]\n";
+    if(args.empty()) {
+        cerr << usage;
+        return 1;
+    }
+    unsigned seed;
+    try {
+        seed = args.size() > 1 ? stoul(args[1]) : 1;
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    return write_random(args[0], seed) ? 0 : 1;
+}
+
+// plays random games with the network loaded, checks the incremental accumulators and
+// the quantized output against the float pass over the same quantized
+// weights, where only rounding separates the two, so every position has to
+// stay within the rounding bound or the given one. The error against the
+// float weights is the quantization loss and only reported. Then times the
+// forward pass
+int bench_command(const vector<string> &args) {
+    const char *usage = "usage: chess nnue-bench <weights file> [games] [max error cp]\n";
+    if(args.empty()) {
+        cerr << usage;
+        return 1;
+    }
+    int games;
+    float bound;
+    try {
+        games = args.size() > 1 ? stoi(args[1]) : 20;
+        bound = args.size() > 2 ? stof(args[2]) : 0;
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(!load(args[0]))
+        return 1;
+    if(args.size() <= 2)
+        bound = rounding_bound();
+
+    mt19937 gen(1);
+    vector<board> positions;
+    int mismatches = 0;
+    float max_error = 0, max_loss = 0, total_loss = 0, total_eval = 0;
+    string worst;
+
+    for(int game=0; game<games; game++) {
+        board pos("rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1");
+        for(int ply=0; ply<200; ply++) {
+            auto moves = pos.gen_moves();
+            if(moves.empty())
+                break;
+            for(int skip = gen() % moves.size(); skip > 0; skip--)
+                moves.pop();
+            pos.make_move(moves.top());
+
+            if(!pos.accumulator_is_consistent())
+                mismatches++;
+            int eval = pos.evaluate();
+            float error = fabs(eval - evaluate_float(pos.pieces(), pos.side_to_move(), true));
+            if(error > max_error) {
+                max_error = error;
+                worst = pos.to_fen();
+            }
+            float reference = evaluate_float(pos.pieces(), pos.side_to_move());
+            float loss = fabs(eval - reference);
+            total_eval += fabs(reference);
+            max_loss = max(max_loss, loss);
+            total_loss += loss;
+            positions.push_back(pos);
+        }
+    }
+
+    // identical across the simd paths, the kernels are exact integer arithmetic
+    long long checksum = 0;
+    for(auto &pos : positions)
+        checksum += pos.evaluate();
+
+    long long evals = 0;
+    long long sink = 0;
+    auto start = chrono::steady_clock::now();
+    double elapsed = 0;
+    while(elapsed < 1.0) {
+        for(auto &pos : positions)
+            sink += pos.evaluate();
+        evals += positions.size();
+        elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    size_t n = max<size_t>(positions.size(), 1);
+    cout << "simd: " << simd_name() << '\n'
+         << "positions: " << positions.size() << '\n'
+         << "evals/sec: " << (long long)(evals / elapsed) << " (" << (sink & 1) << ")\n"
+         << "checksum: " << checksum << '\n'
+         << "mean |eval|: " << total_eval / n << " cp\n"
+         << "max error vs quantized float: " << max_error << " cp, bound " << bound << " cp\n"
+         << "worst position: " << worst << '\n'
+         << "quantization loss vs float weights: max " << max_loss << " cp, mean " << total_loss / n << " cp\n"
+         << "accumulator mismatches: " << mismatches << '\n';
+
+    if(max_error > bound)
+        cerr << "nnue: " << max_error << " cp off the reference in " << worst << '\n';
+    return (mismatches == 0 && max_error <= bound) ? 0 : 1;
+}
+
+}
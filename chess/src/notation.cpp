@@ -0,0 +1,336 @@
+#include "notation.h"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+using namespace std;
+
+namespace notation {
+
+namespace {
+    // castling is written as the king's two square step
+    struct squares {
+        int from, to, promotion;
+
+        bool operator==(const squares &other) const = default;
+    };
+
+    squares decode(const pair<int, int> &move) {
+        if(move.first == move.second) {
+            int row = move.first < 2 ? 0 : 7;
+            return {row * 8 + 4, row * 8 + (move.first % 2 ? 2 : 6), -1};
+        }
+        if(move.first < 0)
+            return {-move.first, move.second >> 2, move.second & 3};
+        return {move.first, move.second, -1};
+    }
+
+    char *put_square(char *p, int square) {
+        *p++ = char('a' + square % 8);
+        *p++ = char('1' + square / 8);
+        return p;
+    }
+
+    int read_square(string_view text, size_t at) {
+        if(at + 1 >= text.size() || text[at] < 'a' || text[at] > 'h' || text[at + 1] < '1' || text[at + 1] > '8')
+            return -1;
+        return (text[at + 1] - '1') * 8 + (text[at] - 'a');
+    }
+
+    // position of c in letters, -1 if it is not there
+    int letter_index(const char *letters, char c) {
+        const char *at = c ? strchr(letters, c) : nullptr;
+        return at ? at - letters : -1;
+    }
+
+    int finish(char *buf, char *p) {
+        *p = 0;
+        return p - buf;
+    }
+
+    bool leaves_king_safe(const board &pos, const pair<int, int> &move) {
+        return pos.is_legal(move);
+    }
+
+    bool has_legal_move(const board &pos) {
+        move_list moves;
+        pos.gen_pseudo_moves(moves, board::all_moves);
+        for(auto &move : moves)
+            if(leaves_king_safe(pos, move))
+                return true;
+        return false;
+    }
+
+    int piece_on(const board &pos, int square) {
+        for(int piece=0; piece<12; piece++)
+            if(pos.pieces()[piece][square])
+                return piece;
+        return -1;
+    }
+
+    pair<int, int> find(const move_list &legal, const squares &wanted) {
+        for(auto &move : legal)
+            if(decode(move) == wanted)
+                return move;
+        return no_move;
+    }
+
+    pair<int, int> find_castling(const move_list &legal, bool long_side) {
+        for(auto &move : legal)
+            if(move.first == move.second && move.first % 2 == long_side)
+                return move;
+        return no_move;
+    }
+}
+
+int write_uci(char *buf, const pair<int, int> &move) {
+    squares s = decode(move);
+    char *p = put_square(put_square(buf, s.from), s.to);
+    if(s.promotion >= 0)
+        *p++ = "nbrq"[s.promotion];
+    return finish(buf, p);
+}
+
+int write_long(char *buf, const pair<int, int> &move) {
+    if(move.first == move.second) {
+        const char *text = move.first % 2 ? "o-o-o" : "o-o";
+        strcpy(buf, text);
+        return strlen(text);
+    }
+    squares s = decode(move);
+    char *p = put_square(buf, s.from);
+    *p++ = '-';
+    p = put_square(p, s.to);
+    if(s.promotion >= 0) {
+        *p++ = '=';
+        *p++ = "NBRQ"[s.promotion];
+    }
+    return finish(buf, p);
+}
+
+int write_san(char *buf, const board &pos, const pair<int, int> &move) {
+    char *p = buf;
+    if(move.first == move.second) {
+        const char *text = move.first % 2 ? "O-O-O" : "O-O";
+        strcpy(buf, text);
+        p += strlen(text);
+    } else {
+        squares s = decode(move);
+        int piece = piece_on(pos, s.from) % 6;
+        bool capture = piece_on(pos, s.to) != -1 || (piece == 0 && s.from % 8 != s.to % 8);
+
+        if(piece) {
+            *p++ = "NBRQK"[piece - 1];
+
+            // the other pieces of the kind that could go to the same square
+            bool other = false, same_column = false, same_row = false;
+            unsigned long long others = pos.pieces()[piece + 6 * pos.side_to_move()] & ~(1ULL << s.from);
+            if(others) {
+                move_list moves;
+                pos.gen_pseudo_moves(moves, board::all_moves, others);
+                for(auto &candidate : moves) {
+                    if(candidate.first == candidate.second || candidate.second != s.to || !leaves_king_safe(pos, candidate))
+                        continue;
+                    other = true;
+                    same_column |= candidate.first % 8 == s.from % 8;
+                    same_row |= candidate.first / 8 == s.from / 8;
+                }
+            }
+            if(other && (!same_column || same_row))
+                *p++ = char('a' + s.from % 8);
+            if(same_column)
+                *p++ = char('1' + s.from / 8);
+        } else if(capture) {
+            *p++ = char('a' + s.from % 8);
+        }
+        if(capture)
+            *p++ = 'x';
+        p = put_square(p, s.to);
+        if(s.promotion >= 0) {
+            *p++ = '=';
+            *p++ = "NBRQ"[s.promotion];
+        }
+    }
+
+    board after(pos);
+    after.make_move(move);
+    if(after.in_check())
+        *p++ = has_legal_move(after) ? '+' : '#';
+    return finish(buf, p);
+}
+
+pair<int, int> parse_uci(const move_list &legal, string_view text) {
+    if(text.size() != 4 && text.size() != 5)
+        return no_move;
+    squares wanted{read_square(text, 0), read_square(text, 2), -1};
+    if(text.size() == 5) {
+        wanted.promotion = letter_index("nbrq", text[4] | 0x20);
+        if(wanted.promotion < 0)
+            return no_move;
+    }
+    if(wanted.from < 0 || wanted.to < 0)
+        return no_move;
+    return find(legal, wanted);
+}
+
+pair<int, int> parse_long(const move_list &legal, string_view text) {
+    if(text == "o-o" || text == "O-O" || text == "0-0")
+        return find_castling(legal, false);
+    if(text == "o-o-o" || text == "O-O-O" || text == "0-0-0")
+        return find_castling(legal, true);
+
+    if((text.size() != 5 && text.size() != 7) || (text[2] != '-' && text[2] != 'x'))
+        return no_move;
+    squares wanted{read_square(text, 0), read_square(text, 3), -1};
+    if(text.size() == 7) {
+        wanted.promotion = letter_index("NBRQ", text[6]);
+        if(text[5] != '=' || wanted.promotion < 0)
+            return no_move;
+    }
+    if(wanted.from < 0 || wanted.to < 0)
+        return no_move;
+    return find(legal, wanted);
+}
+
+pair<int, int> parse_san(const board &pos, string_view san) {
+    while(!san.empty() && letter_index("+#!?", san.back()) >= 0)
+        san.remove_suffix(1);
+
+    int turn = pos.side_to_move();
+    move_list moves;
+
+    if(san == "O-O" || san == "0-0" || san == "O-O-O" || san == "0-0-0") {
+        int side = 2 * turn + (san.size() > 3);
+        pos.gen_pseudo_moves(moves, board::quiets, 1ULL << (4 + 56 * turn));
+        for(auto &move : moves)
+            if(move == make_pair(side, side) && leaves_king_safe(pos, move))
+                return move;
+        return no_move;
+    }
+
+    int piece = san.empty() ? 0 : letter_index("NBRQK", san.front()) + 1;
+    if(piece)
+        san.remove_prefix(1);
+
+    int promotion = piece == 0 && san.size() > 2 ? letter_index("NBRQ", san.back()) : -1;
+    if(promotion >= 0) {
+        san.remove_suffix(1);
+        if(san.back() == '=')
+            san.remove_suffix(1);
+    }
+
+    if(san.size() < 2)
+        return no_move;
+    int to = read_square(san, san.size() - 2);
+    if(to < 0)
+        return no_move;
+    san.remove_suffix(2);
+
+    // whatever is left narrows the origin down, a file, a rank or both
+    unsigned long long from = pos.pieces()[piece + 6 * turn];
+    for(char c : san) {
+        if(c >= 'a' && c <= 'h') from &= 0x0101010101010101ULL << (c - 'a');
+        else if(c >= '1' && c <= '8') from &= 0xFFULL << 8 * (c - '1');
+        else if(c != 'x' && c != '-' && c != ':') return no_move;
+    }
+    if(!from)
+        return no_move;
+
+    pos.gen_pseudo_moves(moves, board::all_moves, from);
+    pair<int, int> found = no_move;
+    for(auto &move : moves) {
+        if(move.first == move.second)
+            continue;
+        squares s = decode(move);
+        if(s.to != to || s.promotion != promotion || !leaves_king_safe(pos, move))
+            continue;
+        if(found != no_move)
+            return no_move;
+        found = move;
+    }
+    return found;
+}
+
+// round trips every legal move of a few positions through each notation and
+// reports conversions per second, a write and a parse each count as one
+int bench_command(const vector<string> &args) {
+    double budget;
+    try {
+        budget = args.size() > 0 ? stod(args[0]) : 0.3;
+    } catch(const logic_error &) {
+        cerr << "usage: chess notation-bench [seconds]\n";
+        return 1;
+    }
+    const vector<string> fens = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+    };
+
+    vector<board> positions;
+    vector<move_list> legal;
+    for(auto &fen : fens) {
+        positions.emplace_back(fen);
+        legal.emplace_back();
+        positions.back().gen_legal_moves(legal.back());
+    }
+
+    int failures = 0;
+    auto run = [&](const char *name, auto write, auto parse) {
+        vector<vector<array<char, max_length>>> texts(positions.size());
+        for(size_t i=0; i<positions.size(); i++)
+            for(auto &move : legal[i]) {
+                texts[i].emplace_back();
+                write(texts[i].back().data(), positions[i], move);
+                if(parse(positions[i], legal[i], texts[i].back().data()) != move) {
+                    failures++;
+                    cerr << name << ": " << texts[i].back().data() << " does not read back in " << fens[i] << '\n';
+                }
+            }
+
+        long long conversions = 0;
+        double write_seconds = 0, parse_seconds = 0;
+        char text[max_length];
+        volatile int sink = 0;
+        while(write_seconds + parse_seconds < budget) {
+            auto start = chrono::steady_clock::now();
+            for(int repeat=0; repeat<16; repeat++)
+                for(size_t i=0; i<positions.size(); i++)
+                    for(auto &move : legal[i])
+                        sink = sink + write(text, positions[i], move) + text[1];
+            auto middle = chrono::steady_clock::now();
+            for(int repeat=0; repeat<16; repeat++)
+                for(size_t i=0; i<positions.size(); i++)
+                    for(auto &written : texts[i])
+                        sink = sink + parse(positions[i], legal[i], written.data()).second;
+            auto end = chrono::steady_clock::now();
+
+            for(auto &moves : legal)
+                conversions += 16 * moves.size();
+            write_seconds += chrono::duration<double>(middle - start).count();
+            parse_seconds += chrono::duration<double>(end - middle).count();
+        }
+        cout << name << ": write " << conversions / write_seconds / 1e6 << " M/s, parse "
+             << conversions / parse_seconds / 1e6 << " M/s\n";
+    };
+
+    run("uci",
+        [](char *text, board &, const pair<int, int> &move) { return write_uci(text, move); },
+        [](board &, const move_list &moves, const char *text) { return parse_uci(moves, text); });
+    run("long",
+        [](char *text, board &, const pair<int, int> &move) { return write_long(text, move); },
+        [](board &, const move_list &moves, const char *text) { return parse_long(moves, text); });
+    run("san",
+        [](char *text, const board &pos, const pair<int, int> &move) { return write_san(text, pos, move); },
+        [](board &pos, const move_list &, const char *text) { return parse_san(pos, text); });
+
+    cout << "round trip failures: " << failures << '\n';
+    return failures ? 1 : 0;
+}
+
+}
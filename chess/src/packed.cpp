@@ -0,0 +1,281 @@
+#include "packed.h"
+#include "board.h"
+
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace packed {
+
+namespace {
+    const char magic[8] = {'P', 'A', 'C', 'K', 'P', 'O', 'S', '1'};
+    constexpr uint32_t version = 1;
+
+    void put_le(unsigned char *p, uint64_t v, int bytes) {
+        for(int i=0; i<bytes; i++)
+            p[i] = v >> (8 * i);
+    }
+
+    uint64_t get_le(const unsigned char *p, int bytes) {
+        uint64_t res = 0;
+        for(int i=bytes-1; i>=0; i--)
+            res = res << 8 | p[i];
+        return res;
+    }
+}
+
+bool is_valid(const packed_position &p) {
+    uint64_t occupied = p.occupancy();
+    int count = popcount(occupied);
+    if(count > 32)
+        return false;
+
+    int kings[2] = {0, 0};
+    for(int n=0; n<count; n++) {
+        int piece = p.piece(n);
+        if(piece > 11)
+            return false;
+        if(piece % 6 == 5)
+            kings[piece / 6]++;
+    }
+    for(int n=count; n<32; n++)
+        if(p.piece(n))
+            return false;
+
+    int ep = p.bytes[packed_position::state_at + 1];
+    return kings[0] == 1 && kings[1] == 1 && p.bytes[packed_position::state_at] < 32 &&
+           (ep == packed_position::no_square || ep < 64) && p.bytes[packed_position::label_at] < 4;
+}
+
+void fill_header(unsigned char *header, uint64_t records, uint64_t segments) {
+    memset(header, 0, header_bytes);
+    memcpy(header, magic, 8);
+    put_le(header + 8, version, 4);
+    put_le(header + 12, sizeof(packed_position), 4);
+    put_le(header + 16, records, 8);
+    put_le(header + 24, segments, 8);
+    put_le(header + 32, header_bytes + records * sizeof(packed_position), 8);
+}
+
+bool dataset_writer::open(const string &path) {
+    out.open(path, ios::binary | ios::trunc);
+    count = 0;
+    segment_ends.clear();
+    char header[header_bytes] = {};
+    out.write(header, header_bytes);
+    return bool(out);
+}
+
+void dataset_writer::add(const packed_position &p) {
+    out.write((const char *)p.bytes.data(), p.bytes.size());
+    count++;
+}
+
+void dataset_writer::end_segment() {
+    if(count && (segment_ends.empty() || segment_ends.back() != count))
+        segment_ends.push_back(count);
+}
+
+bool dataset_writer::close() {
+    end_segment();
+    for(uint64_t end : segment_ends) {
+        unsigned char bytes[8];
+        put_le(bytes, end, 8);
+        out.write((const char *)bytes, 8);
+    }
+
+    unsigned char header[header_bytes];
+    fill_header(header, count, segment_ends.size());
+    out.seekp(0);
+    out.write((const char *)header, header_bytes);
+    out.close();
+    return !out.fail();
+}
+
+dataset::dataset() : data(nullptr), length(0), records(nullptr), count(0), index(nullptr), segment_count(0) {}
+
+dataset::~dataset() {
+    close();
+}
+
+bool dataset::open(const string &path) {
+    close();
+#ifdef _WIN32
+    cerr << "packed: memory mapped files are not supported on this platform\n";
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        cerr << "packed: cannot open " << path << '\n';
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1 || size_t(info.st_size) < header_bytes) {
+        cerr << "packed: " << path << " is not a position file\n";
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        cerr << "packed: cannot map " << path << '\n';
+        return false;
+    }
+
+    data = (const unsigned char *)mapped;
+    length = info.st_size;
+    uint64_t records_in = get_le(data + 16, 8);
+    uint64_t segments_in = get_le(data + 24, 8);
+    uint64_t index_offset = get_le(data + 32, 8);
+    if(memcmp(data, magic, 8) || get_le(data + 8, 4) != version || get_le(data + 12, 4) != sizeof(packed_position) ||
+       index_offset != header_bytes + records_in * sizeof(packed_position) || index_offset + 8 * segments_in != length) {
+        cerr << "packed: " << path << " is not a position file\n";
+        close();
+        return false;
+    }
+
+    records = (const packed_position *)(data + header_bytes);
+    count = records_in;
+    index = data + index_offset;
+    segment_count = segments_in;
+    return true;
+#endif
+}
+
+void dataset::close() {
+#ifndef _WIN32
+    if(data)
+        munmap((void *)data, length);
+#endif
+    data = index = nullptr;
+    records = nullptr;
+    length = count = segment_count = 0;
+}
+
+pair<size_t, size_t> dataset::segment(size_t i) const {
+    size_t begin = i ? get_le(index + 8 * (i - 1), 8) : 0;
+    return {begin, get_le(index + 8 * i, 8)};
+}
+
+// one fen per line, an empty line ends a segment. Every position is checked
+// to come back from its packed form unchanged
+int pack_command(const vector<string> &args) {
+    if(args.size() < 2) {
+        cerr << "usage: chess pack <fen file> <position file>\n";
+        return 1;
+    }
+    ifstream in(args[0]);
+    if(!in) {
+        cerr << "packed: cannot open " << args[0] << '\n';
+        return 1;
+    }
+    dataset_writer writer;
+    if(!writer.open(args[1])) {
+        cerr << "packed: cannot write " << args[1] << '\n';
+        return 1;
+    }
+
+    size_t positions = 0, text_bytes = 0, mismatches = 0;
+    for(string line; getline(in, line); ) {
+        if(line.empty()) {
+            writer.end_segment();
+            continue;
+        }
+        board pos(line);
+        packed_position p = pos.pack();
+        board back = board::from_packed(p);
+        if(!is_valid(p) || back.to_fen() != pos.to_fen() || back.hash() != pos.hash()) {
+            mismatches++;
+            cerr << "packed: " << line << " does not survive packing\n";
+        }
+        writer.add(p);
+        positions++;
+        text_bytes += line.size() + 1;
+    }
+    if(!writer.close()) {
+        cerr << "packed: cannot write " << args[1] << '\n';
+        return 1;
+    }
+    cout << "positions: " << positions << ", " << text_bytes / double(max<size_t>(positions, 1))
+         << " bytes each as fen, " << sizeof(packed_position) << " packed, mismatches: " << mismatches << '\n';
+    return mismatches ? 1 : 0;
+}
+
+int unpack_command(const vector<string> &args) {
+    const char *usage = "usage: chess unpack <position file> [first] [count]\n";
+    if(args.empty()) {
+        cerr << usage;
+        return 1;
+    }
+    dataset positions;
+    if(!positions.open(args[0]))
+        return 1;
+    size_t first, count;
+    try {
+        first = args.size() > 1 ? stoull(args[1]) : 0;
+        count = args.size() > 2 ? stoull(args[2]) : positions.size();
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    for(size_t i=first; i<positions.size() && i-first<count; i++) {
+        if(!is_valid(positions[i])) {
+            cerr << "packed: record " << i << " is corrupt\n";
+            return 1;
+        }
+        cout << board::from_packed(positions[i]).to_fen() << '\n';
+    }
+    return 0;
+}
+
+// a raw pass over the mapping, then full decoding into boards
+int bench_command(const vector<string> &args) {
+    const char *usage = "usage: chess pack-bench <position file> [passes]\n";
+    if(args.empty()) {
+        cerr << usage;
+        return 1;
+    }
+    dataset positions;
+    if(!positions.open(args[0]) || !positions.size())
+        return 1;
+    int passes;
+    try {
+        passes = args.size() > 1 ? stoi(args[1]) : 20;
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    uint64_t pieces = 0;
+    for(int pass=0; pass<passes; pass++)
+        for(auto &p : positions)
+            pieces += popcount(p.occupancy());
+    double scan = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    start = chrono::steady_clock::now();
+    uint64_t keys = 0;
+    for(auto &p : positions)
+        keys ^= board::from_packed(p).hash();
+    double decode = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    double scanned = double(passes) * positions.size();
+    cout << "positions: " << positions.size() << ", segments: " << positions.segments() << '\n'
+         << "scan: " << scanned / scan / 1e6 << " M positions/s, "
+         << scanned * sizeof(packed_position) / scan / 1e9 << " GB/s (" << pieces / scanned << " pieces each)\n"
+         << "decode to board: " << positions.size() / decode / 1e6 << " M positions/s (key " << hex << keys << dec << ")\n";
+    return 0;
+}
+
+}
@@ -0,0 +1,219 @@
+#include "pawns.h"
+#include "board.h"
+#include "stats.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace pawns {
+
+namespace {
+    constexpr unsigned long long file_a = 0x0101010101010101ULL;
+    constexpr unsigned long long file_h = 0x8080808080808080ULL;
+
+    // indexed by the rank counted from the side's own back rank
+    constexpr array<int, 8> passed_mg = {0, 5, 10, 15, 25, 45, 70, 0};
+    constexpr array<int, 8> passed_eg = {0, 10, 15, 30, 55, 90, 140, 0};
+
+    constexpr int isolated_mg = -10, isolated_eg = -15;
+    constexpr int doubled_mg = -10, doubled_eg = -25;
+    constexpr int backward_mg = -8, backward_eg = -10;
+
+    // shelter pawn still on its starting rank, one step advanced, missing
+    constexpr array<int, 3> shelter_value = {0, -10, -25};
+
+    int relative_rank(int square, int side) {
+        return side ? 7 - square / 8 : square / 8;
+    }
+}
+
+unsigned long long north_fill(unsigned long long bb) {
+    bb |= bb << 8;
+    bb |= bb << 16;
+    bb |= bb << 32;
+    return bb;
+}
+
+unsigned long long south_fill(unsigned long long bb) {
+    bb |= bb >> 8;
+    bb |= bb >> 16;
+    bb |= bb >> 32;
+    return bb;
+}
+
+unsigned long long file_fill(unsigned long long bb) {
+    return north_fill(bb) | south_fill(bb);
+}
+
+unsigned long long east(unsigned long long bb) {
+    return (bb << 1) & ~file_a;
+}
+
+unsigned long long west(unsigned long long bb) {
+    return (bb >> 1) & ~file_h;
+}
+
+unsigned long long front_span(unsigned long long own, int side) {
+    return side ? south_fill(own) >> 8 : north_fill(own) << 8;
+}
+
+unsigned long long rear_span(unsigned long long own, int side) {
+    return side ? north_fill(own) << 8 : south_fill(own) >> 8;
+}
+
+unsigned long long attacks(unsigned long long own, int side) {
+    unsigned long long pushed = side ? own >> 8 : own << 8;
+    return east(pushed) | west(pushed);
+}
+
+unsigned long long attack_span(unsigned long long own, int side) {
+    unsigned long long front = front_span(own, side);
+    return east(front) | west(front);
+}
+
+// no enemy pawn in front or on a neighbouring file in front, and not stuck behind an own pawn
+unsigned long long passed(unsigned long long own, unsigned long long enemy, int side) {
+    return own & ~(front_span(enemy, !side) | attack_span(enemy, !side)) & ~rear_span(own, side);
+}
+
+unsigned long long isolated(unsigned long long own) {
+    unsigned long long files = file_fill(own);
+    return own & ~(east(files) | west(files));
+}
+
+// every pawn with an own pawn in front of it, so a doubled pair counts once
+unsigned long long doubled(unsigned long long own, int side) {
+    return own & rear_span(own, side);
+}
+
+// the stop square is covered by an enemy pawn and no own pawn can ever come to defend it
+unsigned long long backward(unsigned long long own, unsigned long long enemy, int side) {
+    unsigned long long stops = side ? own >> 8 : own << 8;
+    unsigned long long weak = stops & attacks(enemy, !side) & ~attack_span(own, side);
+    return side ? weak << 8 : weak >> 8;
+}
+
+unsigned long long shelter_mask(unsigned long long own, int king_file, int side) {
+    unsigned long long files = file_a << king_file;
+    files |= east(files) | west(files);
+    unsigned long long ranks = side ? 0x00FFFF0000000000ULL : 0x0000000000FFFF00ULL;
+    return own & files & ranks;
+}
+
+void analyse(entry &res, unsigned long long white, unsigned long long black) {
+    array<unsigned long long, 2> own = {white, black};
+    res.mg = res.eg = 0;
+
+    for(int side=0; side<2; side++) {
+        int sign = side ? -1 : 1;
+        unsigned long long enemy = own[!side];
+
+        res.passed[side]       = passed(own[side], enemy, side);
+        res.isolated[side]     = isolated(own[side]);
+        res.doubled[side]      = doubled(own[side], side);
+        res.backward[side]     = backward(own[side], enemy, side);
+        res.attack_spans[side] = attack_span(own[side], side);
+
+        for(unsigned long long bb = res.passed[side]; bb; bb &= bb - 1) {
+            int rank = relative_rank(countr_zero(bb), side);
+            res.mg += sign * passed_mg[rank];
+            res.eg += sign * passed_eg[rank];
+        }
+
+        int isolated_count = popcount(res.isolated[side]);
+        int doubled_count  = popcount(res.doubled[side]);
+        int backward_count = popcount(res.backward[side] & ~res.isolated[side]);
+
+        res.mg += sign * (isolated_count * isolated_mg + doubled_count * doubled_mg + backward_count * backward_mg);
+        res.eg += sign * (isolated_count * isolated_eg + doubled_count * doubled_eg + backward_count * backward_eg);
+
+        for(int king_file=0; king_file<8; king_file++) {
+            unsigned long long shelter = shelter_mask(own[side], king_file, side);
+            int score = 0;
+            for(int file = max(king_file - 1, 0); file <= min(king_file + 1, 7); file++) {
+                unsigned long long on_file = shelter & (file_a << file);
+                unsigned long long near = side ? 0x00FF000000000000ULL : 0x000000000000FF00ULL;
+                score += shelter_value[on_file & near ? 0 : (on_file ? 1 : 2)];
+            }
+            res.shelter[side][king_file] = short(score);
+        }
+    }
+}
+
+table::table(int size)
+    : mask(bit_floor((unsigned)max(size, 1)) - 1),
+      hit_count(0),
+      miss_count(0)
+{
+    // positions without pawns hash to 0, so an empty table already holds their entry
+    entry empty;
+    empty.key = 0;
+    analyse(empty, 0, 0);
+    entries.assign(mask + 1, empty);
+}
+
+const entry &table::probe(unsigned long long key, unsigned long long white, unsigned long long black) {
+    CHESS_COUNT(pawn_probes, 1);
+    entry &res = entries[key & mask];
+    if(res.key == key) {
+        CHESS_COUNT(pawn_hits, 1);
+        hit_count++;
+        return res;
+    }
+    miss_count++;
+    res.key = key;
+    analyse(res, white, black);
+    return res;
+}
+
+namespace {
+    long long walk(board &pos, int depth, table &cache, long long &checksum) {
+        checksum += pos.evaluate(cache);
+        if(depth == 0)
+            return 1;
+        long long nodes = 1;
+        auto moves = pos.gen_moves();
+        while(moves.size()) {
+            board copy(pos);
+            copy.make_move(moves.top());
+            moves.pop();
+            nodes += walk(copy, depth - 1, cache, checksum);
+        }
+        return nodes;
+    }
+}
+
+// evaluates every node of a full-width tree and reports how often the pawn work was skipped
+int bench_command(const vector<string> &args) {
+    int depth;
+    try {
+        depth = args.size() > 0 ? stoi(args[0]) : 4;
+    } catch(const logic_error &) {
+        cerr << "usage: chess pawn-bench [depth] [fen]\n";
+        return 1;
+    }
+    string fen = args.size() > 1 ? args[1] : "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    board pos(fen);
+    table cache;
+    long long checksum = 0;
+    auto start = chrono::steady_clock::now();
+    long long nodes = walk(pos, depth, cache, checksum);
+    double elapsed = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "nodes: " << nodes << '\n'
+         << "pawn cache hits: " << cache.hits() << ", misses: " << cache.misses() << '\n'
+         << "hit rate: " << 100.0 * cache.hits() / max(1LL, cache.hits() + cache.misses()) << "%\n"
+         << "time: " << elapsed << "s (checksum " << checksum << ")\n";
+    return 0;
+}
+
+}
@@ -0,0 +1,859 @@
+#include "perft.h"
+#include "counters.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <unordered_map>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace perft {
+
+namespace {
+    const string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    // distinct positions per ply from the start position, the published figures (OEIS A083276)
+    const array<uint64_t, 7> start_distinct = {1, 20, 400, 5362, 72078, 822518, 9417681};
+
+    // drops a flag from the arguments, true if it was there
+    bool take_flag(vector<string> &args, const string &flag) {
+        bool found = false;
+        for(size_t i=0; i<args.size(); )
+            if(args[i] == flag) {
+                args.erase(args.begin() + i);
+                found = true;
+            } else {
+                i++;
+            }
+        return found;
+    }
+
+    void print_missing(const counters::group &events) {
+        if(!events.available())
+            cout << "counters: none available, " << events.problem() << '\n';
+        else if(!events.problem().empty())
+            cout << "counters missing: " << events.problem() << '\n';
+    }
+
+    // finished sub-positions wait at most this long before they are saved
+    constexpr double checkpoint_seconds = 5;
+    // every sub-position takes one line of this length, so one can be read back on its own
+    constexpr int line_bytes = 128;
+
+    struct work_item {
+        string position; // a fen without the move counters
+        uint64_t paths = 0;
+        int64_t leaves = -1; // -1 until counted
+    };
+
+    struct work_queue {
+        string root;
+        int depth = 0, split = 0;
+        vector<work_item> items;
+        size_t header_bytes = 0;
+    };
+
+    // the fen up to the move counters, which perft does not depend on
+    string without_counters(const string &fen) {
+        size_t at = 0;
+        for(int field=0; field<4 && at != string::npos; field++)
+            at = fen.find(' ', at + 1);
+        return fen.substr(0, at);
+    }
+
+    void expand(const board &pos, int plies, unordered_map<string, size_t> &seen, work_queue &q) {
+        if(plies == 0) {
+            auto [at, fresh] = seen.try_emplace(without_counters(pos.to_fen()), q.items.size());
+            if(fresh)
+                q.items.push_back({at->first});
+            q.items[at->second].paths++;
+            return;
+        }
+        move_list moves;
+        pos.gen_legal_moves(moves);
+        for(auto &move : moves) {
+            board child(pos);
+            child.make_move(move);
+            expand(child, plies - 1, seen, q);
+        }
+    }
+
+    string item_line(const work_item &item) {
+        char line[line_bytes + 1];
+        string leaves = item.leaves < 0 ? "-" : to_string(item.leaves);
+        snprintf(line, sizeof(line), "%16" PRIu64 " %20s %-89s\n", item.paths, leaves.c_str(), item.position.c_str());
+        return line;
+    }
+
+    bool parse_item(const string &line, work_item &res) {
+        istringstream in(line);
+        string leaves;
+        if(!(in >> res.paths >> leaves) || !getline(in >> ws, res.position))
+            return false;
+        res.position.erase(res.position.find_last_not_of(' ') + 1);
+        try {
+            res.leaves = leaves == "-" ? -1 : stoll(leaves);
+        } catch(const logic_error &) {
+            return false;
+        }
+        return !res.position.empty();
+    }
+
+    bool read_queue(const string &path, work_queue &res) {
+        ifstream in(path);
+        string magic, line;
+        size_t count = 0;
+        res = work_queue();
+        bool ok = getline(in, magic) && magic == "deep-perft 1" && getline(in, line) && line.rfind("root ", 0) == 0;
+        if(ok) {
+            res.root = line.substr(5);
+            ok = bool(in >> line >> res.depth) && line == "depth" && bool(in >> line >> res.split) && line == "split" &&
+                 bool(in >> line >> count) && line == "items" && in.get() == '\n';
+        }
+        res.header_bytes = ok ? size_t(in.tellg()) : 0;
+        res.items.resize(ok ? count : 0);
+        for(size_t i=0; ok && i<count; i++)
+            ok = getline(in, line) && line.size() + 1 == line_bytes && parse_item(line, res.items[i]);
+        if(!ok)
+            cerr << "perft: " << path << " is not a deep perft checkpoint\n";
+        return ok;
+    }
+
+#ifndef _WIN32
+    bool write_all(int fd, const string &data) {
+        for(size_t done = 0; done < data.size(); ) {
+            ssize_t n = ::write(fd, data.data() + done, data.size() - done);
+            if(n <= 0)
+                return false;
+            done += n;
+        }
+        return true;
+    }
+
+    // written aside and renamed over, synced on both sides of the rename
+    bool write_queue(const string &path, work_queue &q) {
+        string header = "deep-perft 1\nroot " + q.root + "\ndepth " + to_string(q.depth) + "\nsplit " +
+                        to_string(q.split) + "\nitems " + to_string(q.items.size()) + "\n";
+        string data = header;
+        data.reserve(header.size() + q.items.size() * line_bytes);
+        for(auto &item : q.items)
+            data += item_line(item);
+        q.header_bytes = header.size();
+
+        string temporary = path + ".tmp" + to_string(getpid());
+        int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        bool ok = fd != -1 && write_all(fd, data) && fsync(fd) == 0;
+        ok = fd != -1 && ::close(fd) == 0 && ok;
+        ok = ok && rename(temporary.c_str(), path.c_str()) == 0;
+        if(!ok) {
+            cerr << "perft: cannot write " << path << '\n';
+            unlink(temporary.c_str());
+            return false;
+        }
+        size_t slash = path.rfind('/');
+        string directory = slash == string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+        int dir = ::open(directory.c_str(), O_RDONLY);
+        if(dir != -1) {
+            fsync(dir);
+            ::close(dir);
+        }
+        return true;
+    }
+
+    // the leaves of one sub-position as the file has them now, -1 if not counted yet
+    int64_t leaves_on_disk(const string &path, const work_queue &q, size_t i) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if(fd == -1)
+            return -1;
+        char line[line_bytes];
+        work_item item;
+        bool ok = pread(fd, line, line_bytes, q.header_bytes + i * line_bytes) == line_bytes &&
+                  parse_item(string(line, line_bytes - 1), item);
+        ::close(fd);
+        return ok ? item.leaves : -1;
+    }
+
+    // one byte locks on the lock file: byte 0 guards the checkpoint file, byte 1 + i sub-position i
+    bool lock(int fd, size_t at, bool wait) {
+        struct flock l = {};
+        l.l_type = F_WRLCK;
+        l.l_whence = SEEK_SET;
+        l.l_start = at;
+        l.l_len = 1;
+        while(fcntl(fd, wait ? F_SETLKW : F_SETLK, &l) == -1)
+            if(!wait || errno != EINTR)
+                return false;
+        return true;
+    }
+
+    void unlock(int fd, size_t at) {
+        struct flock l = {};
+        l.l_type = F_UNLCK;
+        l.l_whence = SEEK_SET;
+        l.l_start = at;
+        l.l_len = 1;
+        fcntl(fd, F_SETLK, &l);
+    }
+#endif
+
+    // open addressing over 64 bit keys, inserted with a compare and swap so
+    // threads share it without locks. Zero marks an empty slot. Keys are full
+    // position hashes, two positions only merge if their 64 bits collide
+    class key_set {
+        public:
+            explicit key_set(size_t megabytes)
+                : slots(bit_floor(max<size_t>(megabytes << 20, 1 << 20) / sizeof(uint64_t))), mask(slots.size() - 1) {
+                for(auto &slot : slots)
+                    slot.store(0, memory_order_relaxed);
+            }
+
+            // true if the key was not there yet, false if it was or the set is full
+            bool insert(uint64_t key) {
+                key += !key;
+                // stops well short of full so probe runs stay short
+                if(used.load(memory_order_relaxed) >= slots.size() / 10 * 9) {
+                    overflow.store(true, memory_order_relaxed);
+                    return false;
+                }
+                for(size_t i=key & mask; ; i=(i + 1) & mask) {
+                    uint64_t seen = slots[i].load(memory_order_relaxed);
+                    if(seen == key)
+                        return false;
+                    if(seen == 0 && slots[i].compare_exchange_strong(seen, key, memory_order_relaxed)) {
+                        used.fetch_add(1, memory_order_relaxed);
+                        return true;
+                    }
+                    if(seen == key)
+                        return false;
+                }
+            }
+
+            bool full() const { return overflow.load(); }
+            double load() const { return double(used.load()) / slots.size(); }
+
+        private:
+            vector<atomic<uint64_t>> slots;
+            size_t mask;
+            atomic<size_t> used{0};
+            atomic<bool> overflow{false};
+    };
+
+    // a different salt per ply keeps a position reached at two plies apart
+    uint64_t ply_key(const board &pos, int ply) {
+        uint64_t key = pos.position_key();
+        uint64_t salt = (ply + 1) * 0x9E3779B97F4A7C15ULL;
+        salt = (salt ^ (salt >> 31)) * 0xBF58476D1CE4E5B9ULL;
+        return key ^ salt ^ (salt >> 29);
+    }
+
+    struct unique_walk {
+        key_set &set;
+        int depth;
+        bool all_paths;
+        // per ply, this thread's share
+        vector<uint64_t> distinct, paths;
+
+        void walk(const board &pos, int ply) {
+            paths[ply]++;
+            if(set.insert(ply_key(pos, ply)))
+                distinct[ply]++;
+            else if(!all_paths)
+                return;
+            if(ply == depth)
+                return;
+            move_list moves;
+            pos.gen_legal_moves(moves);
+            for(auto &move : moves) {
+                board child(pos);
+                child.make_move(move);
+                walk(child, ply + 1);
+            }
+        }
+    };
+
+    string duration_text(double seconds) {
+        char text[32];
+        if(seconds < 120) snprintf(text, sizeof(text), "%.0f s", seconds);
+        else if(seconds < 7200) snprintf(text, sizeof(text), "%.1f min", seconds / 60);
+        else snprintf(text, sizeof(text), "%.1f h", seconds / 3600);
+        return text;
+    }
+}
+
+uint64_t count(const board &pos, int depth) {
+    if(depth == 0)
+        return 1;
+    move_list moves;
+    pos.gen_legal_moves(moves);
+    uint64_t res = 0;
+    for(auto &move : moves) {
+        board child(pos);
+        child.make_move(move);
+        res += count(child, depth - 1);
+    }
+    return res;
+}
+
+uint64_t count_bulk(const board &pos, int depth) {
+    if(depth == 0)
+        return 1;
+    move_list moves;
+    pos.gen_legal_moves(moves);
+    if(depth == 1)
+        return moves.size();
+    uint64_t res = 0;
+    for(auto &move : moves) {
+        board child(pos);
+        child.make_move(move);
+        res += count_bulk(child, depth - 1);
+    }
+    return res;
+}
+
+bool deep(const string &path, const deep_options &opts, uint64_t &leaves_done) {
+    leaves_done = 0;
+#ifdef _WIN32
+    cerr << "perft: checkpointed runs need POSIX file locks\n";
+    return false;
+#else
+    int lock_fd = ::open((path + ".lock").c_str(), O_RDWR | O_CREAT, 0644);
+    if(lock_fd == -1) {
+        cerr << "perft: cannot open " << path << ".lock\n";
+        return false;
+    }
+
+    // the first process splits the tree, the others read its split
+    work_queue q;
+    bool ok = true;
+    lock(lock_fd, 0, true);
+    struct stat info;
+    if(stat(path.c_str(), &info) == 0) {
+        ok = read_queue(path, q);
+        if(ok && opts.depth && (opts.depth != q.depth || board(opts.fen).to_fen() != q.root)) {
+            cerr << "perft: " << path << " holds depth " << q.depth << " from " << q.root << '\n';
+            ok = false;
+        }
+    } else if(!opts.depth) {
+        cerr << "perft: " << path << " does not exist, give a depth to start a run\n";
+        ok = false;
+    } else {
+        board root(opts.fen);
+        q.root = root.to_fen();
+        q.depth = opts.depth;
+        q.split = clamp(opts.split ? opts.split : min(opts.depth - 1, 4), 0, opts.depth);
+        unordered_map<string, size_t> seen;
+        expand(root, q.split, seen, q);
+        ok = write_queue(path, q);
+        cout << "split " << q.split << " plies deep into " << q.items.size() << " distinct positions\n";
+    }
+    unlock(lock_fd, 0);
+    if(!ok) {
+        ::close(lock_fd);
+        return false;
+    }
+
+    size_t n = q.items.size();
+    auto finished = [&]() { return size_t(count_if(q.items.begin(), q.items.end(), [](auto &item) { return item.leaves >= 0; })); };
+    // everything below is guarded by this, the lock file locks only work between processes
+    mutex m;
+    vector<char> taken(n);
+    vector<size_t> fresh;
+    size_t cursor = 0, finished_at_start = finished();
+    bool failed = false;
+    auto start = chrono::steady_clock::now(), last_checkpoint = start;
+
+    // merges this process's counts into the file and takes up everyone else's
+    auto checkpoint = [&]() {
+        lock(lock_fd, 0, true);
+        work_queue disk;
+        if(read_queue(path, disk) && disk.items.size() == n) {
+            for(size_t i : fresh)
+                disk.items[i].leaves = q.items[i].leaves;
+            if(write_queue(path, disk)) {
+                for(size_t i : fresh)
+                    unlock(lock_fd, 1 + i);
+                fresh.clear();
+                for(size_t i=0; i<n; i++)
+                    q.items[i].leaves = max(q.items[i].leaves, disk.items[i].leaves);
+            } else {
+                failed = true;
+            }
+        } else {
+            failed = true;
+        }
+        unlock(lock_fd, 0);
+
+        auto now = chrono::steady_clock::now();
+        last_checkpoint = now;
+        size_t done = finished();
+        uint64_t leaves = 0;
+        for(auto &item : q.items)
+            if(item.leaves >= 0)
+                leaves += item.paths * item.leaves;
+        double seconds = chrono::duration<double>(now - start).count();
+        cout << "sub-positions: " << done << "/" << n << ", leaves so far: " << leaves << ", " << duration_text(seconds);
+        if(done > finished_at_start && done < n)
+            cout << ", eta " << duration_text(seconds / (done - finished_at_start) * (n - done));
+        cout << endl;
+    };
+
+    // a sub-position nobody has counted and no thread or process holds
+    auto claim = [&](size_t &res) {
+        for(size_t i=cursor; i<n && !failed; i++) {
+            if(q.items[i].leaves >= 0 || taken[i]) {
+                cursor += i == cursor;
+                continue;
+            }
+            if(!lock(lock_fd, 1 + i, false))
+                continue;
+            // another process may have counted and let go of it since the last checkpoint
+            int64_t leaves = leaves_on_disk(path, q, i);
+            if(leaves >= 0) {
+                q.items[i].leaves = leaves;
+                unlock(lock_fd, 1 + i);
+                continue;
+            }
+            taken[i] = true;
+            res = i;
+            return true;
+        }
+        return false;
+    };
+
+    auto worker = [&]() {
+        for(;;) {
+            size_t i;
+            {
+                lock_guard<mutex> hold(m);
+                if(!claim(i))
+                    return;
+            }
+            board pos(q.items[i].position + " 0 1");
+            uint64_t leaves = count_bulk(pos, q.depth - q.split);
+            lock_guard<mutex> hold(m);
+            q.items[i].leaves = leaves;
+            fresh.push_back(i);
+            if(chrono::duration<double>(chrono::steady_clock::now() - last_checkpoint).count() >= checkpoint_seconds)
+                checkpoint();
+        }
+    };
+
+    int threads = opts.threads > 0 ? opts.threads : max(1u, thread::hardware_concurrency());
+    vector<thread> pool;
+    for(int i=1; i<threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for(auto &t : pool)
+        t.join();
+    checkpoint();
+    ::close(lock_fd);
+
+    for(auto &item : q.items)
+        if(item.leaves >= 0)
+            leaves_done += item.paths * item.leaves;
+    size_t left = n - finished();
+    if(left && !failed)
+        cout << left << " sub-positions are held by other processes, run again to take over any that stopped\n";
+    return !failed && !left;
+#endif
+}
+
+bool unique(const unique_options &opts, unique_stats &res) {
+    int depth = max(opts.depth, 0);
+    res.distinct.assign(depth + 1, 0);
+    res.paths.assign(opts.all_paths ? depth + 1 : 0, 0);
+    key_set set(opts.memory_mb);
+    auto start = chrono::steady_clock::now();
+
+    // the first two plies are walked here, the tasks are the positions below them
+    const unique_walk empty{set, depth, opts.all_paths, vector<uint64_t>(depth + 1), vector<uint64_t>(depth + 1)};
+    unique_walk top = empty;
+    vector<board> tasks;
+    int task_ply = min(depth, 2);
+    auto collect = [&](auto &self, const board &pos, int ply) -> void {
+        if(ply == task_ply) {
+            tasks.push_back(pos);
+            return;
+        }
+        top.paths[ply]++;
+        if(set.insert(ply_key(pos, ply)))
+            top.distinct[ply]++;
+        else if(!opts.all_paths)
+            return;
+        move_list moves;
+        pos.gen_legal_moves(moves);
+        for(auto &move : moves) {
+            board child(pos);
+            child.make_move(move);
+            self(self, child, ply + 1);
+        }
+    };
+    board root(opts.fen);
+    collect(collect, root, 0);
+
+    int threads = opts.threads > 0 ? opts.threads : max(1u, thread::hardware_concurrency());
+    vector<unique_walk> walks(threads, empty);
+    atomic<size_t> next{0};
+    auto worker = [&](int id) {
+        for(size_t i; (i = next++) < tasks.size(); )
+            walks[id].walk(tasks[i], task_ply);
+    };
+    vector<thread> pool;
+    for(int i=1; i<threads; i++)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for(auto &t : pool)
+        t.join();
+
+    walks.push_back(top);
+    for(auto &w : walks)
+        for(int ply=0; ply<=depth; ply++) {
+            res.distinct[ply] += w.distinct[ply];
+            if(opts.all_paths)
+                res.paths[ply] += w.paths[ply];
+        }
+    res.load = set.load();
+    res.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return !set.full();
+}
+
+int perft_command(const vector<string> &args_in) {
+    vector<string> args = args_in;
+    bool use_counters = take_flag(args, "--counters");
+    bool bulk = take_flag(args, "--bulk");
+    const char *usage = "usage: chess perft <depth> [fen] [--bulk] [--counters]\n";
+    if(args.empty()) {
+        cerr << usage;
+        return 1;
+    }
+    int depth;
+    try {
+        depth = stoi(args[0]);
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    board pos(args.size() > 1 ? args[1] : start_fen);
+
+    counters::group events;
+    if(use_counters) {
+        print_missing(events);
+        events.start();
+    }
+    auto start = chrono::steady_clock::now();
+    uint64_t nodes = bulk ? count_bulk(pos, depth) : count(pos, depth);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    counters::reading r = use_counters ? events.stop() : counters::reading();
+
+    cout << "nodes: " << nodes << ", time: " << seconds << " s, " << nodes / seconds / 1e6 << " M nodes/s\n";
+    if(use_counters && events.available())
+        counters::report(cout, r, nodes);
+    return 0;
+}
+
+int deep_command(const vector<string> &args) {
+    deep_options opts;
+    string path;
+    const char *usage = "usage: chess perft-deep <checkpoint file> [depth] [--fen fen] [--split plies] [--threads n]\n";
+    try {
+        for(size_t i=0; i<args.size(); i++) {
+            bool value = i + 1 < args.size();
+            if(args[i] == "--fen" && value) opts.fen = args[++i];
+            else if(args[i] == "--split" && value) opts.split = stoi(args[++i]);
+            else if(args[i] == "--threads" && value) opts.threads = stoi(args[++i]);
+            else if(path.empty()) path = args[i];
+            else opts.depth = stoi(args[i]);
+        }
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(path.empty()) {
+        cerr << usage;
+        return 1;
+    }
+
+    uint64_t leaves;
+    if(!deep(path, opts, leaves))
+        return 1;
+    cout << "nodes: " << leaves << '\n';
+    return 0;
+}
+
+int unique_command(const vector<string> &args) {
+    unique_options opts;
+    bool have_depth = false;
+    const char *usage = "usage: chess perft-unique <depth> [fen] [--threads n] [--memory mb] [--all-paths]\n";
+    try {
+        for(size_t i=0; i<args.size(); i++) {
+            bool value = i + 1 < args.size();
+            if(args[i] == "--threads" && value) opts.threads = stoi(args[++i]);
+            else if(args[i] == "--memory" && value) opts.memory_mb = stoi(args[++i]);
+            else if(args[i] == "--all-paths") opts.all_paths = true;
+            else if(have_depth) opts.fen = args[i];
+            else {
+                opts.depth = stoi(args[i]);
+                have_depth = true;
+            }
+        }
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(!have_depth) {
+        cerr << usage;
+        return 1;
+    }
+
+    unique_stats s;
+    bool ok = unique(opts, s);
+    for(int ply=0; ply<=opts.depth; ply++) {
+        cout << "ply " << ply << ": " << s.distinct[ply] << " distinct";
+        if(opts.all_paths)
+            cout << ", " << s.paths[ply] << " paths, " << 100 * (1 - double(s.distinct[ply]) / s.paths[ply])
+                 << "% transpositions";
+        cout << '\n';
+    }
+    cout << "time: " << s.seconds << " s, set load " << 100 * s.load << "%\n";
+    if(!ok) {
+        cerr << "perft: the position set is full, the counts are too low, give more --memory\n";
+        return 1;
+    }
+    if(opts.fen == start_fen) {
+        for(int ply=0; ply<=min<int>(opts.depth, start_distinct.size() - 1); ply++)
+            if(s.distinct[ply] != start_distinct[ply]) {
+                cerr << "perft: ply " << ply << " should have " << start_distinct[ply] << " distinct positions\n";
+                ok = false;
+            }
+        cout << "published counts: " << (ok ? "ok" : "FAILED") << '\n';
+    }
+    return ok ? 0 : 1;
+}
+
+// positions come from random games out of the usual perft positions. On each
+// one every from and to square pair, every castling and every promotion
+// code, and a few malformed moves, are put to is_pseudo_legal and is_legal
+// and compared with the generator, the legal moves being the pseudo legal
+// ones that leave a board passing is_legal() after make_move
+int legality_command(const vector<string> &args) {
+    size_t wanted;
+    uint64_t seed;
+    try {
+        wanted = args.size() > 0 ? stoull(args[0]) : 2000;
+        seed = args.size() > 1 ? stoull(args[1]) : 1;
+    } catch(const logic_error &) {
+        cerr << "usage: chess legality-selftest [positions] [seed]\n";
+        return 1;
+    }
+    mt19937_64 rng(seed);
+    const vector<string> fens = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    };
+
+    vector<pair<int, int>> candidates = {{64, 0}, {0, -1}, {0, 64}, {-64, 0}, {-8, -1}, {-8, 256}, {4, 4}, {-1, -1}};
+    for(int from=0; from<64; from++)
+        for(int to=0; to<64; to++) {
+            if(from != to)
+                candidates.push_back({from, to});
+            if(from / 8 == 1 || from / 8 == 6)
+                for(int piece=0; piece<4; piece++)
+                    candidates.push_back({-from, (to << 2) + piece});
+        }
+    for(int side=0; side<4; side++)
+        candidates.push_back({side, side});
+
+    size_t positions = 0, checked = 0, mismatches = 0;
+    auto report = [&](const board &pos, const pair<int, int> &move, const char *what) {
+        if(mismatches++ < 10)
+            cerr << "perft: " << what << " disagrees on {" << move.first << ", " << move.second << "} in "
+                 << pos.to_fen() << '\n';
+    };
+
+    while(positions < wanted) {
+        board pos(fens[rng() % fens.size()]);
+        for(int ply=0; ply<120 && positions<wanted; ply++) {
+            move_list pseudo, legal, generated;
+            pos.gen_pseudo_moves(pseudo, board::all_moves);
+            for(auto &move : pseudo) {
+                board copy(pos);
+                copy.make_move(move);
+                if(copy.is_legal())
+                    legal.push(move);
+            }
+            pos.gen_legal_moves(generated);
+            if(generated.size() != legal.size() || !equal(legal.begin(), legal.end(), generated.begin()))
+                report(pos, {-1, -1}, "gen_legal_moves");
+            sort(pseudo.begin(), pseudo.end());
+            sort(legal.begin(), legal.end());
+
+            for(auto &move : candidates) {
+                if(pos.is_pseudo_legal(move) != binary_search(pseudo.begin(), pseudo.end(), move))
+                    report(pos, move, "is_pseudo_legal");
+                if(pos.is_legal(move) != binary_search(legal.begin(), legal.end(), move))
+                    report(pos, move, "is_legal");
+            }
+            checked += candidates.size();
+            positions++;
+
+            if(legal.empty())
+                break;
+            pos.make_move(legal[rng() % legal.size()]);
+        }
+    }
+    cout << "positions: " << positions << ", moves checked: " << checked << ", mismatches: " << mismatches << '\n';
+    return mismatches ? 1 : 0;
+}
+
+// every thread runs the read only queries over the same positions, each
+// starting at its own offset, and compares what it gets with what one thread
+// got before the others started. The positions are const from there on, so a
+// disagreement, or a report from a -fsanitize=thread build, means a query
+// writes to the board
+int shared_command(const vector<string> &args) {
+    int threads, rounds;
+    size_t wanted;
+    try {
+        threads = args.size() > 0 ? stoi(args[0]) : max(2u, thread::hardware_concurrency());
+        wanted = args.size() > 1 ? stoull(args[1]) : 2000;
+        rounds = args.size() > 2 ? stoi(args[2]) : 4;
+    } catch(const logic_error &) {
+        cerr << "usage: chess shared-read-selftest [threads] [positions] [rounds]\n";
+        return 1;
+    }
+
+    mt19937_64 rng(1);
+    vector<board> games;
+    while(games.size() < wanted) {
+        board pos(start_fen);
+        for(int ply=0; ply<120 && games.size()<wanted; ply++) {
+            games.push_back(pos);
+            move_list legal;
+            pos.gen_legal_moves(legal);
+            if(legal.empty())
+                break;
+            pos.make_move(legal[rng() % legal.size()]);
+        }
+    }
+    const vector<board> &positions = games;
+
+    auto fingerprint = [](const board &pos) {
+        move_list moves = pos.gen_moves(), pseudo;
+        pos.gen_pseudo_moves(pseudo, board::all_moves);
+        uint64_t res = pos.state(moves) * 0x9E3779B97F4A7C15ULL;
+        for(auto &move : moves)
+            res = (res ^ (move.first * 64 + move.second + 4096)) * 0x100000001B3ULL;
+        for(auto &move : pseudo)
+            res = (res ^ pos.is_legal(move)) * 0x100000001B3ULL;
+        res ^= (unsigned long long)pos.gen_attacked(0) + 3 * (unsigned long long)pos.gen_attacked(1);
+        res ^= uint64_t(pos.in_check() + 2 * pos.is_legal() + 4 * (pos.state() == pos.state(moves))) << 61;
+        return res + count_bulk(pos, 2);
+    };
+    vector<uint64_t> expected(positions.size());
+    for(size_t i=0; i<positions.size(); i++)
+        expected[i] = fingerprint(positions[i]);
+
+    atomic<size_t> mismatches{0};
+    auto reader = [&](int id) {
+        size_t n = positions.size();
+        for(size_t k=0; k<n * rounds; k++) {
+            size_t i = (k + id * n / threads) % n;
+            if(fingerprint(positions[i]) != expected[i] && mismatches++ < 10)
+                cerr << "perft: thread " << id << " disagrees on " << positions[i].to_fen() << '\n';
+        }
+    };
+    auto start = chrono::steady_clock::now();
+    vector<thread> pool;
+    for(int i=1; i<threads; i++)
+        pool.emplace_back(reader, i);
+    reader(0);
+    for(auto &t : pool)
+        t.join();
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    cout << "threads: " << threads << ", positions: " << positions.size() << ", queries: "
+         << positions.size() * rounds * threads << " in " << seconds << " s, mismatches: " << mismatches << '\n';
+    return mismatches ? 1 : 0;
+}
+
+int movegen_command(const vector<string> &args_in) {
+    vector<string> args = args_in;
+    bool use_counters = take_flag(args, "--counters");
+    double budget;
+    try {
+        budget = args.size() > 0 ? stod(args[0]) : 0.5;
+    } catch(const logic_error &) {
+        cerr << "usage: chess movegen-bench [seconds] [--counters]\n";
+        return 1;
+    }
+
+    vector<board> positions;
+    for(const char *fen : {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                           "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                           "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+                           "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+                           "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10"})
+        positions.emplace_back(fen);
+
+    counters::group events;
+    if(use_counters)
+        print_missing(events);
+
+    // one generation per position per repeat, the counters cover the whole run
+    auto run = [&](const char *name, auto generate) {
+        long long generations = 0;
+        double seconds = 0;
+        uint64_t sink = 0;
+        if(use_counters)
+            events.start();
+        while(seconds < budget) {
+            auto start = chrono::steady_clock::now();
+            for(int repeat=0; repeat<64; repeat++)
+                for(auto &pos : positions)
+                    sink += generate(pos);
+            seconds += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            generations += 64 * positions.size();
+        }
+        counters::reading r = use_counters ? events.stop() : counters::reading();
+        cout << name << ": " << generations / seconds / 1e6 << " M generations/s (" << (sink & 1) << ")\n";
+        if(use_counters && events.available())
+            counters::report(cout, r, generations);
+    };
+
+    move_list moves;
+    run("gen_pseudo_moves", [&](board &pos) {
+        moves.clear();
+        pos.gen_pseudo_moves(moves, board::all_moves);
+        return moves.size();
+    });
+    run("gen_legal_moves", [&](board &pos) {
+        pos.gen_legal_moves(moves);
+        return moves.size();
+    });
+    run("gen_moves", [&](board &pos) { return pos.gen_moves().size(); });
+    return 0;
+}
+
+}
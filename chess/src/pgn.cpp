@@ -0,0 +1,425 @@
+#include "pgn.h"
+#include "notation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace pgn {
+
+namespace {
+    constexpr pair<int, int> no_move = notation::no_move;
+    const string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    bool is_space(char c) {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+    }
+
+    bool is_delimiter(char c) {
+        return is_space(c) || c == '{' || c == '}' || c == '(' || c == ')' || c == ';' || c == '[' || c == ']';
+    }
+
+    bool is_result(string_view token) {
+        return token == "1-0" || token == "0-1" || token == "1/2-1/2" || token == "*";
+    }
+
+    size_t skip_past(string_view text, size_t at, char c) {
+        size_t end = text.find(c, at);
+        return end == string_view::npos ? text.size() : end + 1;
+    }
+
+    // where the movetext of a game stops: after its termination marker, or at
+    // the tag section of the next game when the marker is missing
+    size_t movetext_end(string_view text) {
+        int depth = 0;
+        bool line_start = true;
+        for(size_t at=0; at<text.size(); ) {
+            char c = text[at];
+            if(c == '\n') {
+                line_start = true;
+                at++;
+                continue;
+            }
+            if(c == '{') {
+                at = skip_past(text, at, '}');
+                line_start = false;
+                continue;
+            }
+            if(c == ';' || (line_start && c == '%')) {
+                at = text.find('\n', at);
+                if(at == string_view::npos)
+                    return text.size();
+                continue;
+            }
+            if(line_start && c == '[' && depth == 0)
+                return at;
+            line_start = false;
+            if(is_space(c) || c == '[' || c == ']') {
+                at++;
+                continue;
+            }
+            if(c == '(' || c == ')') {
+                depth = c == '(' ? depth + 1 : max(0, depth - 1);
+                at++;
+                continue;
+            }
+
+            size_t end = at;
+            while(end < text.size() && !is_delimiter(text[end]))
+                end++;
+            if(depth == 0 && is_result(text.substr(at, end - at)))
+                return end;
+            at = end;
+        }
+        return text.size();
+    }
+}
+
+string_view game::find(string_view name) const {
+    for(auto &t : tags)
+        if(t.name == name)
+            return t.value;
+    return {};
+}
+
+reader::reader() : data(nullptr), length(0), offset(0) {}
+
+reader::~reader() {
+    close();
+}
+
+bool reader::open(const string &path) {
+    close();
+#ifdef _WIN32
+    cerr << "pgn: memory mapped files are not supported on this platform\n";
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        cerr << "pgn: cannot open " << path << '\n';
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1) {
+        cerr << "pgn: cannot read " << path << '\n';
+        ::close(fd);
+        return false;
+    }
+    if(info.st_size == 0) {
+        ::close(fd);
+        data = "";
+        return true;
+    }
+
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        cerr << "pgn: cannot map " << path << '\n';
+        return false;
+    }
+    madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+
+    data = (const char *)mapped;
+    length = info.st_size;
+    return true;
+#endif
+}
+
+void reader::close() {
+#ifndef _WIN32
+    if(data && length)
+        munmap((void *)data, length);
+#endif
+    data = nullptr;
+    length = offset = 0;
+}
+
+bool reader::next(game &g) {
+    g.tags.clear();
+    g.movetext = {};
+    string_view text(data ? data : "", length);
+
+    auto skip_space = [&]() {
+        while(offset < length && is_space(text[offset]))
+            offset++;
+    };
+
+    skip_space();
+    if(offset == length)
+        return false;
+
+    while(offset < length && text[offset] == '[') {
+        size_t line_end = text.find('\n', offset);
+        if(line_end == string_view::npos)
+            line_end = length;
+        string_view line = text.substr(offset + 1, line_end - offset - 1);
+        offset = line_end;
+
+        size_t name_end = 0;
+        while(name_end < line.size() && !is_space(line[name_end]) && line[name_end] != '"' && line[name_end] != ']')
+            name_end++;
+        size_t open_quote = line.find('"', name_end);
+        size_t close_quote = open_quote;
+        while(close_quote != string_view::npos) {
+            close_quote = line.find('"', close_quote + 1);
+            if(close_quote == string_view::npos || line[close_quote - 1] != '\\')
+                break;
+        }
+        if(name_end && open_quote != string_view::npos && close_quote != string_view::npos)
+            g.tags.push_back({line.substr(0, name_end), line.substr(open_quote + 1, close_quote - open_quote - 1)});
+        skip_space();
+    }
+
+    size_t end = offset + movetext_end(text.substr(offset));
+    g.movetext = text.substr(offset, end - offset);
+    offset = end;
+    return true;
+}
+
+bool move_tokens::next(string_view &san) {
+    int depth = 0;
+    while(at < text.size()) {
+        char c = text[at];
+        if(is_space(c) || c == '[' || c == ']' || c == '}') {
+            at++;
+            continue;
+        }
+        if(c == '{') {
+            at = skip_past(text, at, '}');
+            continue;
+        }
+        if(c == ';' || c == '%') {
+            at = skip_past(text, at, '\n');
+            continue;
+        }
+        if(c == '(' || c == ')') {
+            depth = c == '(' ? depth + 1 : max(0, depth - 1);
+            at++;
+            continue;
+        }
+
+        size_t end = at;
+        while(end < text.size() && !is_delimiter(text[end]))
+            end++;
+        string_view token = text.substr(at, end - at);
+        at = end;
+        if(depth || c == '$' || c == '!' || c == '?' || token == "e.p.")
+            continue;
+        if(is_result(token)) {
+            ending = token;
+            at = text.size();
+            return false;
+        }
+
+        // a move number, possibly glued to the move that follows it
+        if(token.substr(0, 3) != "0-0") {
+            size_t digits = 0;
+            while(digits < token.size() && token[digits] >= '0' && token[digits] <= '9')
+                digits++;
+            size_t dots = digits;
+            while(dots < token.size() && token[dots] == '.')
+                dots++;
+            if(dots > digits || digits == token.size())
+                token.remove_prefix(dots);
+        }
+        if(token.empty())
+            continue;
+        san = token;
+        return true;
+    }
+    return false;
+}
+
+replay_stats replay(const vector<string> &paths, int threads) {
+    if(threads <= 0)
+        threads = max(1u, thread::hardware_concurrency());
+    threads = min<int>(threads, max<size_t>(1, paths.size()));
+
+    auto start = chrono::steady_clock::now();
+    atomic<size_t> next_file{0};
+    atomic<long long> games{0}, moves{0}, errors{0};
+
+    auto worker = [&]() {
+        reader file;
+        game g;
+        long long local_games = 0, local_moves = 0, local_errors = 0;
+        for(size_t i; (i = next_file++) < paths.size(); ) {
+            if(!file.open(paths[i])) {
+                local_errors++;
+                continue;
+            }
+            while(file.next(g)) {
+                string_view fen = g.find("FEN");
+                board pos(fen.empty() ? start_fen : string(fen));
+                move_tokens tokens(g.movetext);
+                string_view san;
+                local_games++;
+                while(tokens.next(san)) {
+                    auto move = notation::parse_san(pos, san);
+                    if(move == no_move) {
+                        local_errors++;
+                        break;
+                    }
+                    pos.make_move(move);
+                    local_moves++;
+                }
+            }
+        }
+        games += local_games;
+        moves += local_moves;
+        errors += local_errors;
+    };
+
+    vector<thread> pool;
+    for(int i=1; i<threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for(auto &t : pool)
+        t.join();
+
+    return {games, moves, errors, chrono::duration<double>(chrono::steady_clock::now() - start).count()};
+}
+
+int pgn_command(const vector<string> &args) {
+    int threads = 0;
+    vector<string> paths;
+    const char *usage = "usage: chess pgn [--threads n] <file>...\n";
+    try {
+        for(size_t i=0; i<args.size(); i++) {
+            if(args[i] == "--threads" && i + 1 < args.size())
+                threads = stoi(args[++i]);
+            else
+                paths.push_back(args[i]);
+        }
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(paths.empty()) {
+        cerr << usage;
+        return 1;
+    }
+
+    replay_stats stats = replay(paths, threads);
+    cout << "games: " << stats.games << ", moves: " << stats.moves << ", errors: " << stats.errors << '\n'
+         << "time: " << stats.seconds << " s, " << stats.moves / stats.seconds << " moves/s\n";
+    return stats.errors ? 1 : 0;
+}
+
+// writes random games with comments, variations and NAGs mixed in, reads them
+// back and checks that every game ends in the position it was written from
+int selftest_command(const vector<string> &args) {
+    int count;
+    try {
+        count = args.size() > 0 ? stoi(args[0]) : 200;
+    } catch(const logic_error &) {
+        cerr << "usage: chess pgn-selftest [games] [file]\n";
+        return 1;
+    }
+    string path = args.size() > 1 ? args[1] : (filesystem::temp_directory_path() / "chess-pgn-selftest.pgn").string();
+    const string kiwipete = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+
+    mt19937 gen(11);
+    vector<unsigned long long> final_keys;
+    vector<int> lengths;
+    {
+        ofstream out(path);
+        for(int i=0; i<count; i++) {
+            bool from_fen = i % 10 == 9;
+            board pos(from_fen ? kiwipete : start_fen);
+            out << "[Event \"selftest \\\"" << i << "\\\"\"]\n[Site \"?\"]\n[Round \"" << i << "\"]\n";
+            if(from_fen)
+                out << "[SetUp \"1\"]\n[FEN \"" << kiwipete << "\"]\n";
+            out << "[Result \"*\"]\n\n";
+
+            int plies = 0;
+            for(int move_number=1; plies<160; plies++) {
+                vector<pair<int, int>> legal;
+                for(auto moves = pos.gen_moves(); moves.size(); moves.pop())
+                    legal.push_back(moves.top());
+                if(legal.empty() || pos.halfmove_clock() >= 100)
+                    break;
+                sort(legal.begin(), legal.end());
+                auto move = legal[gen() % legal.size()];
+
+                if(!pos.side_to_move())
+                    out << move_number << ". ";
+                else if(plies == 0 || gen() % 8 == 0)
+                    out << move_number << "... ";
+                char san[notation::max_length];
+                notation::write_san(san, pos, move);
+                out << san;
+                switch(gen() % 16) {
+                    case 0: out << " {a comment (with parentheses) ; and a semicolon}"; break;
+                    case 1: out << " $" << gen() % 20; break;
+                    case 2: out << "!?"; break;
+                    case 3: out << " (" << move_number << ". Qh5 {bad} (" << move_number << ". e4 e5) Kxe8 $2)"; break;
+                    case 4: out << " ; rest of the line\n"; break;
+                }
+                out << (gen() % 12 ? ' ' : '\n');
+                pos.make_move(move);
+                if(!pos.side_to_move())
+                    move_number++;
+            }
+            out << "*\n\n";
+            final_keys.push_back(pos.hash());
+            lengths.push_back(plies);
+        }
+    }
+
+    reader file;
+    if(!file.open(path))
+        return 1;
+    game g;
+    int games = 0, failures = 0;
+    long long total_moves = 0;
+    while(file.next(g)) {
+        string_view fen = g.find("FEN");
+        board pos(fen.empty() ? start_fen : string(fen));
+        move_tokens tokens(g.movetext);
+        string_view san;
+        int plies = 0;
+        bool parsed = true;
+        while(parsed && tokens.next(san)) {
+            auto move = notation::parse_san(pos, san);
+            parsed = move != no_move;
+            if(parsed) {
+                pos.make_move(move);
+                plies++;
+            }
+        }
+        total_moves += plies;
+        if(games >= count || !parsed || tokens.result() != "*" || plies != lengths[games] || pos.hash() != final_keys[games]) {
+            failures++;
+            cerr << "game " << games << " does not replay (" << plies << " plies";
+            if(!parsed)
+                cerr << ", stuck at " << san;
+            cerr << ")\n";
+        }
+        games++;
+    }
+    if(games != count)
+        failures++;
+
+    replay_stats stats = replay({path}, 1);
+    cout << "games: " << games << ", moves: " << total_moves << ", failures: " << failures << '\n'
+         << "replay: " << stats.moves / stats.seconds << " moves/s on one thread\n";
+    return failures ? 1 : 0;
+}
+
+}
@@ -0,0 +1,344 @@
+#include "posindex.h"
+#include "board.h"
+#include "extsort.h"
+#include "notation.h"
+#include "pgn.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace posindex {
+
+namespace {
+    const char magic[8] = {'P', 'O', 'S', 'I', 'N', 'D', 'X', '1'};
+    // 2 keys positions by board::position_key, 3 once that drops a file
+    // whose only en passant captures are illegal
+    constexpr uint32_t version = 3;
+    constexpr size_t entry_bytes = 16;
+    constexpr size_t block_entries = page_bytes / entry_bytes;
+    const string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+
+    void put_le(unsigned char *p, uint64_t v, int bytes) {
+        for(int i=0; i<bytes; i++)
+            p[i] = v >> (8 * i);
+    }
+
+    uint64_t get_le(const unsigned char *p, int bytes) {
+        uint64_t res = 0;
+        for(int i=bytes-1; i>=0; i--)
+            res = res << 8 | p[i];
+        return res;
+    }
+
+    // the records start on the second page so that blocks and pages line up:
+    // magic, version u32, entry bytes u32, entries u64, games u64, fences u64, fence offset u64
+    class index_writer {
+        public:
+            bool open(const string &path) {
+                out.open(path, ios::binary | ios::trunc);
+                vector<char> header(page_bytes, 0);
+                out.write(header.data(), header.size());
+                return bool(out);
+            }
+
+            void add(const entry &e) {
+                if(count % block_entries == 0)
+                    fences.push_back(e.key);
+                unsigned char bytes[entry_bytes];
+                put_le(bytes, e.key, 8);
+                put_le(bytes + 8, e.game, 4);
+                put_le(bytes + 12, e.ply, 4);
+                out.write((const char *)bytes, entry_bytes);
+                count++;
+            }
+
+            // size of the file, 0 if anything failed
+            size_t close(size_t games) {
+                for(uint64_t fence : fences) {
+                    unsigned char bytes[8];
+                    put_le(bytes, fence, 8);
+                    out.write((const char *)bytes, 8);
+                }
+                size_t fence_offset = page_bytes + count * entry_bytes;
+                unsigned char header[64] = {};
+                memcpy(header, magic, 8);
+                put_le(header + 8, version, 4);
+                put_le(header + 12, entry_bytes, 4);
+                put_le(header + 16, count, 8);
+                put_le(header + 24, games, 8);
+                put_le(header + 32, fences.size(), 8);
+                put_le(header + 40, fence_offset, 8);
+                out.seekp(0);
+                out.write((const char *)header, sizeof(header));
+                out.close();
+                return out.fail() ? 0 : fence_offset + 8 * fences.size();
+            }
+
+        private:
+            ofstream out;
+            size_t count = 0;
+            vector<uint64_t> fences;
+    };
+}
+
+bool build(const vector<string> &pgn_paths, const string &path, size_t memory_bytes, build_stats *stats) {
+    auto start = chrono::steady_clock::now();
+    size_t capacity = max<size_t>(block_entries, memory_bytes / sizeof(entry));
+    vector<entry> buffer;
+    buffer.reserve(capacity);
+    // the budget is shared by the runs' read buffers during the merge
+    extsort::sorter<entry> runs(path, capacity);
+    size_t games = 0, entries = 0, errors = 0;
+    bool ok = true;
+
+    auto emit = [&](const board &pos, uint32_t ply) {
+        if(buffer.size() == capacity)
+            ok = runs.spill(buffer) && ok;
+        buffer.push_back({pos.position_key(), uint32_t(games), ply});
+        entries++;
+    };
+
+    pgn::reader file;
+    pgn::game g;
+    for(auto &pgn_path : pgn_paths) {
+        if(!file.open(pgn_path))
+            return false;
+        while(file.next(g)) {
+            string_view fen = g.find("FEN");
+            board pos(fen.empty() ? start_fen : string(fen));
+            pgn::move_tokens tokens(g.movetext);
+            uint32_t ply = 0;
+            emit(pos, ply);
+            for(string_view san; tokens.next(san); ) {
+                auto move = notation::parse_san(pos, san);
+                if(move == notation::no_move) {
+                    errors++;
+                    break;
+                }
+                pos.make_move(move);
+                emit(pos, ++ply);
+            }
+            games++;
+        }
+    }
+
+    index_writer out;
+    if(!out.open(path)) {
+        cerr << "posindex: cannot write " << path << '\n';
+        return false;
+    }
+    size_t run_count = 1;
+    if(!runs.runs()) {
+        sort(buffer.begin(), buffer.end());
+        for(auto &e : buffer)
+            out.add(e);
+    } else {
+        if(!buffer.empty())
+            ok = runs.spill(buffer) && ok;
+        run_count = runs.runs();
+        buffer = vector<entry>();
+        ok = runs.merge([&](const entry &e) { out.add(e); }) && ok;
+    }
+
+    size_t file_bytes = out.close(games);
+    if(!ok || !file_bytes) {
+        cerr << "posindex: cannot write " << path << '\n';
+        return false;
+    }
+    if(stats)
+        *stats = {games, entries, run_count, errors, file_bytes,
+                  chrono::duration<double>(chrono::steady_clock::now() - start).count()};
+    return true;
+}
+
+index::index() : data(nullptr), length(0), count(0), game_count(0) {}
+
+index::~index() {
+    close();
+}
+
+bool index::open(const string &path) {
+    close();
+#ifdef _WIN32
+    cerr << "posindex: memory mapped files are not supported on this platform\n";
+    return false;
+#else
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd == -1) {
+        cerr << "posindex: cannot open " << path << '\n';
+        return false;
+    }
+    struct stat info;
+    if(fstat(fd, &info) == -1 || size_t(info.st_size) < page_bytes) {
+        cerr << "posindex: " << path << " is not a position index\n";
+        ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if(mapped == MAP_FAILED) {
+        cerr << "posindex: cannot map " << path << '\n';
+        return false;
+    }
+    // lookups jump around, read ahead would only fetch pages nobody asked for
+    madvise(mapped, info.st_size, MADV_RANDOM);
+
+    data = (const unsigned char *)mapped;
+    length = info.st_size;
+    count = get_le(data + 16, 8);
+    game_count = get_le(data + 24, 8);
+    size_t fence_count = get_le(data + 32, 8), fence_offset = get_le(data + 40, 8);
+    if(memcmp(data, magic, 8) || get_le(data + 8, 4) != version || get_le(data + 12, 4) != entry_bytes ||
+       fence_offset != page_bytes + count * entry_bytes || fence_count != (count + block_entries - 1) / block_entries ||
+       fence_offset + 8 * fence_count != length) {
+        cerr << "posindex: " << path << " is not a position index\n";
+        close();
+        return false;
+    }
+    fences.resize(fence_count);
+    for(size_t i=0; i<fence_count; i++)
+        fences[i] = get_le(data + fence_offset + 8 * i, 8);
+    return true;
+#endif
+}
+
+void index::close() {
+#ifndef _WIN32
+    if(data)
+        munmap((void *)data, length);
+#endif
+    data = nullptr;
+    length = count = game_count = 0;
+    fences.clear();
+}
+
+entry index::operator[](size_t i) const {
+    const unsigned char *p = data + page_bytes + i * entry_bytes;
+    return {get_le(p, 8), uint32_t(get_le(p + 8, 4)), uint32_t(get_le(p + 12, 4))};
+}
+
+size_t index::find(uint64_t key, vector<entry> &res) const {
+    // the key's run of entries can start at the end of the block before the
+    // first block whose fence is the key itself
+    size_t block = lower_bound(fences.begin(), fences.end(), key) - fences.begin();
+    if(block)
+        block--;
+
+    size_t reads = 0;
+    for(; block < fences.size() && fences[block] <= key; block++) {
+        reads++;
+        const unsigned char *p = data + page_bytes + block * page_bytes;
+        size_t n = min(block_entries, count - block * block_entries);
+        for(size_t i=0; i<n; i++, p+=entry_bytes) {
+            uint64_t k = get_le(p, 8);
+            if(k > key)
+                return reads;
+            if(k == key)
+                res.push_back({k, uint32_t(get_le(p + 8, 4)), uint32_t(get_le(p + 12, 4))});
+        }
+    }
+    return reads;
+}
+
+int posindex_command(const vector<string> &args) {
+    string mode = args.empty() ? "" : args[0];
+    const char *usage = "usage: chess posindex build <index> [--memory mb] <pgn file>...\n"
+                        "       chess posindex query <index> <fen>...\n"
+                        "       chess posindex bench <index> [queries]\n";
+
+    if(mode == "build" && args.size() > 2) {
+        size_t memory = 256;
+        vector<string> paths;
+        try {
+            for(size_t i=2; i<args.size(); i++) {
+                if(args[i] == "--memory" && i + 1 < args.size())
+                    memory = stoull(args[++i]);
+                else
+                    paths.push_back(args[i]);
+            }
+        } catch(const logic_error &) {
+            cerr << usage;
+            return 1;
+        }
+        build_stats stats;
+        if(!build(paths, args[1], memory << 20, &stats))
+            return 1;
+        cout << "games: " << stats.games << ", positions: " << stats.entries << ", errors: " << stats.errors
+             << ", sorted runs: " << stats.runs << '\n'
+             << "time: " << stats.seconds << " s, " << stats.entries / stats.seconds << " positions/s\n"
+             << "index: " << stats.file_bytes << " bytes, " << double(stats.file_bytes) / max<size_t>(stats.entries, 1)
+             << " per position\n";
+        return 0;
+    }
+
+    if(mode == "query" && args.size() > 2) {
+        index idx;
+        if(!idx.open(args[1]))
+            return 1;
+        for(size_t i=2; i<args.size(); i++) {
+            vector<entry> hits;
+            auto start = chrono::steady_clock::now();
+            size_t reads = idx.find(board(args[i]).position_key(), hits);
+            double micros = chrono::duration<double, micro>(chrono::steady_clock::now() - start).count();
+            cout << args[i] << ": " << hits.size() << " hits, " << reads << " blocks, " << micros << " us\n";
+            for(auto &hit : hits)
+                cout << "  game " << hit.game << " ply " << hit.ply << '\n';
+        }
+        return 0;
+    }
+
+    // lookups of keys that are in the index and of random ones that are not
+    if(mode == "bench" && args.size() > 1) {
+        int queries;
+        try {
+            queries = args.size() > 2 ? stoi(args[2]) : 100000;
+        } catch(const logic_error &) {
+            cerr << usage;
+            return 1;
+        }
+        index idx;
+        if(!idx.open(args[1]) || !idx.size())
+            return 1;
+
+        mt19937_64 rng(1);
+        vector<uint64_t> present, absent;
+        for(int i=0; i<queries; i++) {
+            present.push_back(idx[rng() % idx.size()].key);
+            absent.push_back(rng());
+        }
+
+        vector<entry> hits;
+        for(auto *keys : {&present, &absent}) {
+            size_t reads = 0, found = 0;
+            auto start = chrono::steady_clock::now();
+            for(uint64_t key : *keys) {
+                hits.clear();
+                reads += idx.find(key, hits);
+                found += hits.size();
+            }
+            double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+            cout << (keys == &present ? "stored keys: " : "random keys: ") << 1e6 * seconds / queries << " us/lookup, "
+                 << double(reads) / queries << " blocks/lookup, " << double(found) / queries << " hits/lookup\n";
+        }
+        return 0;
+    }
+
+    cerr << usage;
+    return 1;
+}
+
+}
@@ -0,0 +1,284 @@
+#include "search.h"
+#include "board_utils.h"
+#include "move_picker.h"
+#include "notation.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+using namespace board_utils;
+
+namespace {
+    constexpr pair<int, int> no_move = move_picker::no_move;
+
+    // mate scores are stored relative to the node so they stay valid when reached from elsewhere
+    int score_to_tt(int score, int ply) {
+        if(score >= searcher::mate_score - searcher::max_ply) return score + ply;
+        if(score <= -searcher::mate_score + searcher::max_ply) return score - ply;
+        return score;
+    }
+
+    int score_from_tt(int score, int ply) {
+        if(score >= searcher::mate_score - searcher::max_ply) return score - ply;
+        if(score <= -searcher::mate_score + searcher::max_ply) return score + ply;
+        return score;
+    }
+}
+
+string move_string(const pair<int, int> &move) {
+    char text[notation::max_length];
+    notation::write_long(text, move);
+    return text;
+}
+
+string score_string(int score) {
+    if(abs(score) >= searcher::mate_score - searcher::max_ply) {
+        int moves = (searcher::mate_score - abs(score) + 1) / 2;
+        return "mate " + to_string(score > 0 ? moves : -moves);
+    }
+    return "cp " + to_string(score);
+}
+
+searcher::searcher(transposition_table &tt)
+    : tt(tt),
+      node_count(0),
+      node_limit(0),
+      stopped(false)
+{
+}
+
+bool searcher::out_of_nodes() {
+    node_count++;
+    if(node_limit && node_count >= node_limit)
+        stopped = true;
+    return stopped;
+}
+
+void searcher::update_pv(int ply, const pair<int, int> &move) {
+    pv_table[ply][ply] = move;
+    for(int i=ply+1; i<pv_length[ply+1]; i++)
+        pv_table[ply][i] = pv_table[ply+1][i];
+    pv_length[ply] = max(pv_length[ply+1], ply + 1);
+}
+
+vector<search_line> searcher::search(const board &root, const search_limits &limits, const report_fn &report) {
+    node_count = 0;
+    node_limit = limits.nodes;
+    stopped = false;
+    for(auto &killer : killers)
+        killer = {no_move, no_move};
+
+    vector<pair<int, int>> root_moves;
+    for(auto moves = root.gen_moves(); moves.size(); moves.pop())
+        root_moves.push_back(moves.top());
+
+    vector<search_line> best;
+    int lines = min<int>(max(limits.multipv, 1), root_moves.size());
+    if(lines == 0)
+        return best;
+
+    for(int depth=1; depth<=min(limits.depth, max_ply - 1); depth++) {
+        // every root move ends up either among the ranked lines or with an upper bound below them
+        vector<search_line> ranked;
+        vector<pair<int, pair<int, int>>> order;
+
+        for(auto &move : root_moves) {
+            board child(root);
+            child.make_move(move);
+            pv_length[1] = 1;
+
+            int score;
+            if((int)ranked.size() < lines) {
+                score = -alpha_beta(child, depth - 1, -infinity, infinity, 1);
+            } else {
+                int alpha = ranked.back().score;
+                score = -alpha_beta(child, depth - 1, -alpha - 1, -alpha, 1);
+                if(score > alpha && !stopped)
+                    score = -alpha_beta(child, depth - 1, -infinity, -alpha, 1);
+            }
+            if(stopped)
+                break;
+
+            order.push_back({score, move});
+            if((int)ranked.size() == lines && score <= ranked.back().score)
+                continue;
+
+            search_line line{{move}, score};
+            for(int i=1; i<pv_length[1]; i++)
+                line.pv.push_back(pv_table[1][i]);
+
+            auto it = upper_bound(ranked.begin(), ranked.end(), score, 
+                                  [](int value, const search_line &elem) { return value > elem.score; });
+            ranked.insert(it, line);
+            if((int)ranked.size() > lines)
+                ranked.pop_back();
+        }
+
+        if(stopped && depth > 1)
+            break;
+
+        best = ranked;
+        if(report)
+            report(depth, best);
+        if(stopped)
+            break;
+
+        // next iteration starts with the best moves so the window tightens early
+        stable_sort(order.begin(), order.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+        root_moves.clear();
+        for(auto &[score, move] : order)
+            root_moves.push_back(move);
+    }
+
+    return best;
+}
+
+int searcher::alpha_beta(const board &pos, int depth, int alpha, int beta, int ply) {
+    pv_length[ply] = ply;
+
+    if(pos.halfmove_clock() >= 100)
+        return 0;
+
+    bool check = pos.in_check();
+    if(check && ply < max_ply - 1)
+        depth++;
+
+    if(depth <= 0 || ply >= max_ply - 1)
+        return quiescence(pos, alpha, beta, ply);
+
+    if(out_of_nodes())
+        return 0;
+
+    pair<int, int> hash_move = no_move;
+    transposition_table::entry hit;
+    if(tt.probe(pos.hash(), hit)) {
+        hash_move = hit.move;
+        int score = score_from_tt(hit.score, ply);
+        if(hit.depth >= depth) {
+            if(hit.flag == transposition_table::exact_bound) return score;
+            if(hit.flag == transposition_table::lower_bound && score >= beta) return score;
+            if(hit.flag == transposition_table::upper_bound && score <= alpha) return score;
+        }
+    }
+
+    int original_alpha = alpha;
+    int best = -infinity;
+    pair<int, int> best_move = no_move;
+    pair<int, int> move;
+    int legal_moves = 0;
+
+    move_picker picker(pos, hash_move, killers[ply]);
+    while(picker.next(move)) {
+        legal_moves++;
+        board child(pos);
+        child.make_move(move);
+        int score = -alpha_beta(child, depth - 1, -beta, -alpha, ply + 1);
+        if(stopped)
+            return 0;
+
+        if(score > best) {
+            best = score;
+            best_move = move;
+        }
+        if(score > alpha) {
+            alpha = score;
+            update_pv(ply, move);
+        }
+        if(alpha >= beta) {
+            if(move_picker::is_quiet(pos, move) && killers[ply][0] != move) {
+                killers[ply][1] = killers[ply][0];
+                killers[ply][0] = move;
+            }
+            break;
+        }
+    }
+
+    if(legal_moves == 0)
+        return check ? -mate_score + ply : 0;
+
+    auto flag = best >= beta ? transposition_table::lower_bound :
+                best > original_alpha ? transposition_table::exact_bound : transposition_table::upper_bound;
+    tt.store(pos.hash(), best_move, score_to_tt(best, ply), depth, flag);
+    return best;
+}
+
+int searcher::quiescence(const board &pos, int alpha, int beta, int ply) {
+    pv_length[ply] = ply;
+    if(out_of_nodes())
+        return 0;
+
+    int stand_pat = pos.evaluate(pawn_cache);
+    if(stand_pat >= beta || ply >= max_ply - 1)
+        return stand_pat;
+    alpha = max(alpha, stand_pat);
+
+    pair<int, int> move;
+    move_picker picker(pos, no_move, {no_move, no_move}, true);
+    while(picker.next(move)) {
+        board child(pos);
+        child.make_move(move);
+        int score = -quiescence(child, -beta, -alpha, ply + 1);
+        if(stopped)
+            return 0;
+        if(score >= beta)
+            return score;
+        if(score > alpha) {
+            alpha = score;
+            update_pv(ply, move);
+        }
+    }
+    return alpha;
+}
+
+// reads one FEN per line and streams the ranked lines of every completed depth
+int multipv_command(const vector<string> &args) {
+    if(args.empty()) {
+        cerr << "usage: chess multipv <fen file> [lines] [depth] [hash MB]\n";
+        return 1;
+    }
+
+    ifstream in(args[0]);
+    if(!in) {
+        cerr << "multipv: cannot open " << args[0] << '\n';
+        return 1;
+    }
+
+    search_limits limits;
+    int hash_mb;
+    try {
+        limits.multipv = args.size() > 1 ? stoi(args[1]) : 3;
+        limits.depth = args.size() > 2 ? stoi(args[2]) : 6;
+        hash_mb = args.size() > 3 ? stoi(args[3]) : 16;
+    } catch(const logic_error &) {
+        cerr << "usage: chess multipv <fen file> [lines] [depth] [hash MB]\n";
+        return 1;
+    }
+    transposition_table tt(hash_mb);
+
+    string fen;
+    while(getline(in, fen)) {
+        if(fen.empty() || fen[0] == '#')
+            continue;
+
+        board pos(fen);
+        searcher engine(tt);
+        cout << "position " << fen << '\n';
+        engine.search(pos, limits, [&](int depth, const vector<search_line> &lines) {
+            for(int i=0; i<(int)lines.size(); i++) {
+                cout << "depth " << depth << " multipv " << i + 1 << " score " << score_string(lines[i].score)
+                     << " nodes " << engine.nodes() << " pv";
+                for(auto &move : lines[i].pv)
+                    cout << ' ' << move_string(move);
+                cout << '\n';
+            }
+            cout.flush();
+        });
+        tt.clear();
+    }
+    return 0;
+}
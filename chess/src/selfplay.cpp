@@ -0,0 +1,324 @@
+#include "selfplay.h"
+#include "board.h"
+#include "packed.h"
+#include "search.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace selfplay {
+
+namespace {
+    const string start_fen = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
+    // records a thread collects before it writes them out, whole games only
+    constexpr size_t flush_records = 1 << 15;
+
+    enum ending { mate, stalemate, fifty_moves, repetition, insufficient, too_long };
+
+    // no pawns or majors and at most a minor piece, or one bishop each on the same colour
+    bool insufficient_material(const board &pos) {
+        auto &p = pos.pieces();
+        if(p[0] || p[3] || p[4] || p[6] || p[9] || p[10])
+            return false;
+        int minors = popcount(p[1] | p[2] | p[7] | p[8]);
+        if(minors <= 1)
+            return true;
+        const unsigned long long dark = 0xAA55AA55AA55AA55ULL;
+        return minors == 2 && popcount(p[2]) == 1 && popcount(p[8]) == 1 &&
+               bool(p[2] & dark) == bool(p[8] & dark);
+    }
+
+    // keys holds every position of the game so far, the current one last
+    bool threefold(const vector<unsigned long long> &keys, int halfmove_clock) {
+        int seen = 0;
+        size_t last = keys.size() - 1;
+        for(size_t back=2; back<=size_t(halfmove_clock) && back<=last; back+=2)
+            if(keys[last - back] == keys[last] && ++seen == 2)
+                return true;
+        return false;
+    }
+
+    // captures and promotions are favoured so random games still resolve
+    pair<int, int> weighted_random(const board &pos, const move_list &moves, mt19937_64 &rng) {
+        unsigned long long theirs = 0;
+        for(int piece=0; piece<6; piece++)
+            theirs |= pos.pieces()[piece + 6 * !pos.side_to_move()];
+        int weights[256], total = 0, n = 0;
+        for(auto &move : moves) {
+            int weight = 1;
+            if(move.first < 0)
+                weight = (move.second & 3) == 3 ? 8 : 2;
+            else if(move.first != move.second && theirs >> move.second & 1)
+                weight = 4;
+            total += weights[n++] = weight;
+        }
+        int pick = uniform_int_distribution<int>(0, total - 1)(rng);
+        n = 0;
+        for(auto &move : moves)
+            if((pick -= weights[n++]) < 0)
+                return move;
+        return moves[0];
+    }
+
+    // a game's records in the file, first and one past the last
+    struct game_range {
+        long long number;
+        uint64_t first, end;
+    };
+
+    // records of a thread's finished games waiting to be written. A flush
+    // claims a range of the file with one atomic add, so threads never wait
+    // on each other, and the games are kept as file record numbers
+    struct buffer {
+        vector<packed_position> records;
+        vector<pair<long long, size_t>> game_ends; // game number and its end in records
+        vector<uint64_t> segment_ends;
+        vector<game_range> games;
+    };
+
+    struct output {
+        int fd = -1;
+        atomic<uint64_t> next_record{0};
+        atomic<bool> failed{false};
+    };
+
+    void flush(output &out, buffer &buf) {
+        uint64_t first = out.next_record.fetch_add(buf.records.size());
+#ifndef _WIN32
+        size_t bytes = buf.records.size() * sizeof(packed_position);
+        const char *data = (const char *)buf.records.data();
+        off_t at = packed::header_bytes + first * sizeof(packed_position);
+        for(size_t done=0; done<bytes; ) {
+            ssize_t written = pwrite(out.fd, data + done, bytes - done, at + done);
+            if(written <= 0) {
+                out.failed = true;
+                break;
+            }
+            done += written;
+        }
+#endif
+        size_t begin = 0;
+        for(auto &[number, end] : buf.game_ends) {
+            buf.games.push_back({number, first + begin, first + end});
+            if(end != begin)
+                buf.segment_ends.push_back(first + end);
+            begin = end;
+        }
+        buf.records.clear();
+        buf.game_ends.clear();
+    }
+
+    bool write_games(const string &path, vector<game_range> &games) {
+        sort(games.begin(), games.end(), [](const game_range &a, const game_range &b) { return a.number < b.number; });
+        vector<unsigned char> bytes(16 * games.size());
+        for(size_t i=0; i<games.size(); i++)
+            for(int b=0; b<8; b++) {
+                bytes[16 * i + b] = games[i].first >> (8 * b);
+                bytes[16 * i + 8 + b] = games[i].end >> (8 * b);
+            }
+        ofstream out(path, ios::binary | ios::trunc);
+        out.write((const char *)bytes.data(), bytes.size());
+        out.close();
+        return !out.fail();
+    }
+
+    struct game_result {
+        int white; // -1, 0, 1
+        ending how;
+    };
+
+    game_result play(long long number, const options &opts, searcher &engine, transposition_table &tt,
+                     vector<packed_position> &records) {
+        mt19937_64 rng(opts.seed * 0x9E3779B97F4A7C15ULL + number);
+        board pos(start_fen);
+        vector<unsigned long long> keys = {pos.position_key()};
+        vector<int> scores;
+        size_t first = records.size();
+        tt.clear();
+
+        move_list moves;
+        game_result res{0, too_long};
+        for(int ply=0; ply<opts.max_plies; ply++) {
+            moves.clear();
+            pos.gen_legal_moves(moves);
+            int turn = pos.side_to_move();
+            if(moves.empty()) {
+                res = pos.in_check() ? game_result{turn ? 1 : -1, mate} : game_result{0, stalemate};
+                break;
+            }
+            if(pos.halfmove_clock() >= 100) { res = {0, fifty_moves}; break; }
+            if(threefold(keys, pos.halfmove_clock())) { res = {0, repetition}; break; }
+            if(insufficient_material(pos)) { res = {0, insufficient}; break; }
+
+            pair<int, int> move = moves[0];
+            int score = packed::no_score;
+            bool opening = ply < opts.random_plies;
+            if(opening || !opts.nodes) {
+                move = weighted_random(pos, moves, rng);
+            } else {
+                search_limits limits;
+                limits.nodes = opts.nodes;
+                auto lines = engine.search(pos, limits);
+                if(!lines.empty() && !lines[0].pv.empty()) {
+                    move = lines[0].pv[0];
+                    score = lines[0].score;
+                } else {
+                    move = weighted_random(pos, moves, rng);
+                }
+            }
+            if(!opening) {
+                records.push_back(pos.pack());
+                scores.push_back(score);
+            }
+            pos.make_move(move);
+            keys.push_back(pos.position_key());
+        }
+
+        for(size_t i=first; i<records.size(); i++)
+            records[i].set_label(res.white, scores[i - first]);
+        return res;
+    }
+}
+
+string games_path(const string &path) {
+    return path + ".games";
+}
+
+bool generate(const string &path, const options &opts, stats &res) {
+    res = {};
+#ifdef _WIN32
+    cerr << "selfplay: positional writes are not supported on this platform\n";
+    return false;
+#else
+    output out;
+    out.fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(out.fd == -1) {
+        cerr << "selfplay: cannot write " << path << '\n';
+        return false;
+    }
+
+    int threads = opts.threads > 0 ? opts.threads : max(1u, thread::hardware_concurrency());
+    threads = int(min<long long>(threads, max(1LL, opts.games)));
+    vector<array<long long, 6>> endings(threads);
+    vector<array<long long, 3>> results(threads);
+    atomic<long long> next_game{0};
+
+    auto start = chrono::steady_clock::now();
+    vector<buffer> buffers(threads);
+    auto worker = [&](int id) {
+        transposition_table tt(4);
+        searcher engine(tt);
+        buffer &buf = buffers[id];
+        buf.records.reserve(flush_records + 2 * opts.max_plies);
+        for(long long number; (number = next_game++) < opts.games; ) {
+            auto outcome = play(number, opts, engine, tt, buf.records);
+            endings[id][outcome.how]++;
+            results[id][outcome.white + 1]++;
+            buf.game_ends.push_back({number, buf.records.size()});
+            if(buf.records.size() >= flush_records)
+                flush(out, buf);
+        }
+        flush(out, buf);
+    };
+
+    vector<thread> pool;
+    for(int i=1; i<threads; i++)
+        pool.emplace_back(worker, i);
+    worker(0);
+    for(auto &t : pool)
+        t.join();
+
+    // the game ends of all threads in file order make the index
+    vector<uint64_t> ends;
+    vector<game_range> games;
+    for(auto &buf : buffers) {
+        ends.insert(ends.end(), buf.segment_ends.begin(), buf.segment_ends.end());
+        games.insert(games.end(), buf.games.begin(), buf.games.end());
+    }
+    sort(ends.begin(), ends.end());
+    uint64_t count = out.next_record;
+    vector<unsigned char> index(8 * ends.size());
+    for(size_t i=0; i<ends.size(); i++)
+        for(int b=0; b<8; b++)
+            index[8 * i + b] = ends[i] >> (8 * b);
+    unsigned char header[packed::header_bytes];
+    packed::fill_header(header, count, ends.size());
+    off_t index_at = packed::header_bytes + count * sizeof(packed_position);
+    bool ok = !out.failed && pwrite(out.fd, index.data(), index.size(), index_at) == ssize_t(index.size()) &&
+              pwrite(out.fd, header, sizeof(header), 0) == ssize_t(sizeof(header));
+    ok = ::close(out.fd) == 0 && ok;
+    ok = write_games(games_path(path), games) && ok;
+
+    res.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    res.positions = count;
+    for(int i=0; i<threads; i++) {
+        res.black_wins += results[i][0];
+        res.draws += results[i][1];
+        res.white_wins += results[i][2];
+        res.mates += endings[i][mate];
+        res.stalemates += endings[i][stalemate];
+        res.fifty_moves += endings[i][fifty_moves];
+        res.repetitions += endings[i][repetition];
+        res.insufficient += endings[i][insufficient];
+        res.too_long += endings[i][too_long];
+    }
+    res.games = res.white_wins + res.draws + res.black_wins;
+    if(!ok)
+        cerr << "selfplay: cannot write " << path << '\n';
+    return ok;
+#endif
+}
+
+int selfplay_command(const vector<string> &args) {
+    options opts;
+    string path;
+    const char *usage = "usage: chess selfplay <position file> [--games n] [--threads n] [--nodes n]"
+                        " [--random-plies n] [--max-plies n] [--seed n]\n";
+    try {
+        for(size_t i=0; i<args.size(); i++) {
+            bool value = i + 1 < args.size();
+            if(args[i] == "--games" && value) opts.games = stoll(args[++i]);
+            else if(args[i] == "--threads" && value) opts.threads = stoi(args[++i]);
+            else if(args[i] == "--nodes" && value) opts.nodes = stoll(args[++i]);
+            else if(args[i] == "--random-plies" && value) opts.random_plies = stoi(args[++i]);
+            else if(args[i] == "--max-plies" && value) opts.max_plies = stoi(args[++i]);
+            else if(args[i] == "--seed" && value) opts.seed = stoull(args[++i]);
+            else path = args[i];
+        }
+    } catch(const logic_error &) {
+        cerr << usage;
+        return 1;
+    }
+    if(path.empty()) {
+        cerr << usage;
+        return 1;
+    }
+
+    stats s;
+    bool ok = generate(path, opts, s);
+    cout << "games: " << s.games << " (+" << s.white_wins << " =" << s.draws << " -" << s.black_wins << "), positions: "
+         << s.positions << '\n'
+         << "endings: mate " << s.mates << ", stalemate " << s.stalemates << ", fifty moves " << s.fifty_moves
+         << ", repetition " << s.repetitions << ", material " << s.insufficient << ", too long " << s.too_long << '\n'
+         << "time: " << s.seconds << " s, " << s.games / s.seconds << " games/s, " << s.positions / s.seconds
+         << " positions/s\n";
+    return ok ? 0 : 1;
+}
+
+}
@@ -0,0 +1,222 @@
+#include "stats.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+#if defined(CHESS_STATS) && !defined(_WIN32)
+#include <csignal>
+#include <pthread.h>
+#include <thread>
+#endif
+
+#if defined(CHESS_STATS) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define STATS_TSC
+#endif
+
+using namespace std;
+
+namespace stats {
+
+namespace {
+    const char *counter_names[counter_count] = {
+        "gen_moves_calls", "pseudo_moves", "legal_moves", "illegal_moves", "gen_attacked_calls", "make_move_calls",
+        "is_legal_calls", "tt_probes", "tt_hits", "pawn_probes", "pawn_hits"};
+    const char *timer_names[timer_count] = {"gen_legal_moves", "gen_pseudo_moves", "gen_attacked", "make_move",
+                                            "is_legal"};
+
+    struct totals {
+        uint64_t counts[counter_count] = {};
+        uint64_t ticks[timer_count] = {};
+        uint64_t timed[timer_count] = {};
+        uint64_t threads = 0;
+    };
+
+    double ratio(uint64_t a, uint64_t b) {
+        return b ? double(a) / b : 0;
+    }
+
+#ifdef CHESS_STATS
+    struct registry {
+        mutex lock;
+        vector<block *> live;
+        totals finished;
+    };
+
+    registry &shared() {
+        static registry res;
+        return res;
+    }
+
+    // what the block counted since the last reset
+    void add(totals &res, const block &b) {
+        for(int c=0; c<counter_count; c++)
+            res.counts[c] += b.counts[c].load(memory_order_relaxed) - b.base_counts[c];
+        for(int t=0; t<timer_count; t++) {
+            res.ticks[t] += b.ticks[t].load(memory_order_relaxed) - b.base_ticks[t];
+            res.timed[t] += b.timed[t].load(memory_order_relaxed) - b.base_timed[t];
+        }
+    }
+
+    totals snapshot() {
+        registry &r = shared();
+        lock_guard<mutex> hold(r.lock);
+        totals res = r.finished;
+        for(block *b : r.live)
+            add(res, *b);
+        res.threads += r.live.size();
+        return res;
+    }
+
+    // where the tick count and the clock started, to turn ticks into nanoseconds
+    const uint64_t origin_ticks = now();
+    const chrono::steady_clock::time_point origin_time = chrono::steady_clock::now();
+
+    double nanoseconds_per_tick() {
+#ifdef STATS_TSC
+        uint64_t ticks = now() - origin_ticks;
+        double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - origin_time).count();
+        return ticks ? ns / ticks : 1;
+#else
+        return 1;
+#endif
+    }
+
+    void dump_now() {
+        const char *path = getenv("CHESS_STATS_FILE");
+        if(path && *path)
+            dump(path);
+        else
+            write_json(cerr);
+    }
+
+    // the registry is complete before the hook goes in, so it is still there when the hook runs
+    const bool hooked = (shared(), atexit(dump_now) == 0);
+
+#ifndef _WIN32
+    // SIGUSR1 is blocked while static initialisation still runs on the only
+    // thread, every later thread inherits the mask, so the signal is only
+    // ever taken by the watcher's sigwait and the dump runs as plain code
+    bool watch_signal() {
+        sigset_t set;
+        sigemptyset(&set);
+        sigaddset(&set, SIGUSR1);
+        if(pthread_sigmask(SIG_BLOCK, &set, nullptr) != 0)
+            return false;
+        thread([set]() {
+            for(int signal; sigwait(&set, &signal) == 0; )
+                dump_now();
+        }).detach();
+        return true;
+    }
+
+    const bool watching = watch_signal();
+#endif
+#else
+    totals snapshot() {
+        return {};
+    }
+
+    double nanoseconds_per_tick() {
+        return 1;
+    }
+#endif
+}
+
+#ifdef CHESS_STATS
+block::block() {
+    for(auto &c : counts)
+        c.store(0, memory_order_relaxed);
+    for(int t=0; t<timer_count; t++) {
+        ticks[t].store(0, memory_order_relaxed);
+        timed[t].store(0, memory_order_relaxed);
+    }
+    registry &r = shared();
+    lock_guard<mutex> hold(r.lock);
+    r.live.push_back(this);
+}
+
+block::~block() {
+    registry &r = shared();
+    lock_guard<mutex> hold(r.lock);
+    add(r.finished, *this);
+    r.finished.threads++;
+    erase(r.live, this);
+}
+
+uint64_t now() {
+#ifdef STATS_TSC
+    return __rdtsc();
+#else
+    return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+#endif
+
+bool enabled() {
+#ifdef CHESS_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void write_json(ostream &out) {
+    if(!enabled()) {
+        out << "{\"enabled\": false}\n";
+        return;
+    }
+    totals t = snapshot();
+    double scale = nanoseconds_per_tick();
+    const uint64_t *c = t.counts;
+
+    out << "{\n  \"enabled\": true,\n  \"threads\": " << t.threads << ",\n  \"counters\": {";
+    for(int i=0; i<counter_count; i++)
+        out << (i ? ",\n    \"" : "\n    \"") << counter_names[i] << "\": " << c[i];
+    out << "\n  },\n  \"timers\": {";
+    for(int i=0; i<timer_count; i++) {
+        double ns = t.ticks[i] * scale;
+        out << (i ? ",\n    \"" : "\n    \"") << timer_names[i] << "\": {\"calls\": " << t.timed[i]
+            << ", \"ns\": " << uint64_t(ns) << ", \"ns_per_call\": " << ratio(ns, t.timed[i]) << '}';
+    }
+    // a node is a move made
+    out << "\n  },\n  \"derived\": {"
+        << "\n    \"legal_per_pseudo\": " << ratio(c[legal_moves], c[pseudo_moves])
+        << ",\n    \"gen_attacked_per_node\": " << ratio(c[gen_attacked_calls], c[make_move_calls])
+        << ",\n    \"tt_hit_rate\": " << ratio(c[tt_hits], c[tt_probes])
+        << ",\n    \"pawn_hit_rate\": " << ratio(c[pawn_hits], c[pawn_probes])
+        << "\n  }\n}\n";
+}
+
+bool dump(const string &path) {
+    ofstream out(path);
+    write_json(out);
+    out.close();
+    if(!out) {
+        cerr << "stats: cannot write " << path << '\n';
+        return false;
+    }
+    return true;
+}
+
+void reset() {
+#ifdef CHESS_STATS
+    registry &r = shared();
+    lock_guard<mutex> hold(r.lock);
+    r.finished = totals();
+    for(block *b : r.live) {
+        for(int c=0; c<counter_count; c++)
+            b->base_counts[c] = b->counts[c].load(memory_order_relaxed);
+        for(int t=0; t<timer_count; t++) {
+            b->base_ticks[t] = b->ticks[t].load(memory_order_relaxed);
+            b->base_timed[t] = b->timed[t].load(memory_order_relaxed);
+        }
+    }
+#endif
+}
+
+}
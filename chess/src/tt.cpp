@@ -0,0 +1,41 @@
+#include "tt.h"
+#include "stats.h"
+
+#include <bit>
+
+using namespace std;
+
+transposition_table::transposition_table(int megabytes) {
+    unsigned long long count = bit_floor((unsigned long long)megabytes * 1024 * 1024 / sizeof(entry));
+    entries.resize(count ? count : 1);
+    mask = entries.size() - 1;
+    clear();
+}
+
+bool transposition_table::probe(unsigned long long key, entry &res) const {
+    CHESS_COUNT(tt_probes, 1);
+    const entry &slot = entries[key & mask];
+    if(slot.flag == no_bound || slot.key != key)
+        return false;
+    CHESS_COUNT(tt_hits, 1);
+    res = slot;
+    return true;
+}
+
+// shallower results only replace entries of other positions, a known best move is kept
+void transposition_table::store(unsigned long long key, const pair<int, int> &move, int score, int depth, bound flag) {
+    entry &slot = entries[key & mask];
+    if(slot.key == key && slot.flag != no_bound && slot.depth > depth && flag != exact_bound)
+        return;
+    if(slot.key != key || move.first != -1 || move.second != -1)
+        slot.move = move;
+    slot.key = key;
+    slot.score = score;
+    slot.depth = short(depth);
+    slot.flag = flag;
+}
+
+void transposition_table::clear() {
+    for(auto &slot : entries)
+        slot = {0, {-1, -1}, 0, 0, no_bound};
+}
@@ -0,0 +1,45 @@
+#include "zobrist.h"
+
+#include <array>
+
+using namespace std;
+
+namespace zobrist {
+
+namespace {
+    constexpr int piece_keys = 12 * 64;
+    constexpr int side_key = piece_keys;
+    constexpr int castling_keys = side_key + 1;
+    constexpr int en_passant_keys = castling_keys + 16;
+    constexpr int total_keys = en_passant_keys + 8;
+
+    constexpr array<unsigned long long, total_keys> keys = []() {
+        array<unsigned long long, total_keys> res{};
+        unsigned long long state = 0x9E3779B97F4A7C15ULL;
+        for(auto &key : res) { // splitmix64
+            unsigned long long z = (state += 0x9E3779B97F4A7C15ULL);
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            key = z ^ (z >> 31);
+        }
+        return res;
+    }();
+}
+
+unsigned long long piece(int piece, int square) {
+    return keys[piece * 64 + square];
+}
+
+unsigned long long side() {
+    return keys[side_key];
+}
+
+unsigned long long castling(int rights) {
+    return keys[castling_keys + rights];
+}
+
+unsigned long long en_passant(int file) {
+    return keys[en_passant_keys + file];
+}
+
+}